@@ -160,4 +160,31 @@ const char* ps::eventToString(snd_seq_event_type_t event)
   }
   #undef PS_ALSA_CASE
   return "Unknown Alsa Event";
-}
\ No newline at end of file
+}
+
+snd_seq_addr_t ps::findSeqPort(snd_seq_t& seq, const string& portName)
+{
+  snd_seq_client_info_t* cinfo = nullptr;
+  snd_seq_client_info_alloca(&cinfo);
+
+  snd_seq_port_info_t* pinfo = nullptr;
+  snd_seq_port_info_alloca(&pinfo);
+
+  snd_seq_client_info_set_client(cinfo, -1);
+  while (snd_seq_query_next_client(&seq, cinfo) >= 0) {
+    int client = snd_seq_client_info_get_client(cinfo);
+
+    snd_seq_port_info_set_client(pinfo, client);
+    snd_seq_port_info_set_port(pinfo, -1);
+    while (snd_seq_query_next_port(&seq, pinfo) >= 0) {
+      if (snd_seq_port_info_get_name(pinfo) == portName) {
+        return snd_seq_addr_t{
+          (uint8_t)snd_seq_port_info_get_client(pinfo),
+          (uint8_t)snd_seq_port_info_get_port(pinfo)
+        };
+      }
+    }
+  }
+
+  throw Exception("Could not find midi port {}", portName);
+}
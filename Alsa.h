@@ -7,6 +7,7 @@
 #include "fmt.h"
 
 #include <memory>
+#include <string>
 
 namespace ps
 {
@@ -25,6 +26,9 @@ namespace ps
   /// Turn an event into string, mostly useful for debugging.
   const char* eventToString(snd_seq_event_type_t event);
 
+  /// Of the sequencer port named `portName`, throws when there is none.
+  snd_seq_addr_t findSeqPort(snd_seq_t& seq, const std::string& portName);
+
   struct FrameFormat
   {
     int Rate;
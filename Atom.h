@@ -10,6 +10,7 @@
 ///
 /// NOTE: should only depend on the standard library
 
+#include <charconv>
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -257,12 +258,15 @@ namespace atom
 
   inline Color Color::fromString(std::string_view sv)
   {
-    if (sv.empty() or sv[0] != '#') {
+    if (sv.size() != 7 or sv[0] != '#') {
       throw std::runtime_error("Invalid color value " + std::string(sv));
     }
 
-    // TODO: would need std::from_chars for OK performance.
-    unsigned hex = stoul((std::string)sv.substr(1), nullptr, 16);
+    unsigned hex = 0;
+    auto [end, error] = std::from_chars(sv.data() + 1, sv.data() + 7, hex, 16);
+    if (error != std::errc() or end != sv.data() + 7) {
+      throw std::runtime_error("Invalid color value " + std::string(sv));
+    }
 
     return Color{
       .r = uint8_t((hex >> 16) / 2),
@@ -0,0 +1,333 @@
+#include "BankImage.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+using namespace ps;
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace
+{
+  auto logger = Log("IMAGE");
+
+  constexpr char Magic[8] = "PSBANKS";
+  constexpr size_t PageSize = 4096;
+
+  struct Header
+  {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t Rate;
+    uint32_t BankCount;
+    uint32_t SampleCount;
+    // The samples file it was built from.
+    int64_t SamplesTime;
+    uint64_t SamplesSize;
+    uint64_t StringsOffset;
+    uint64_t StringsSize;
+    uint64_t DataOffset;
+    uint64_t DataSize;
+    uint64_t MetaChecksum; // sample table and strings
+    uint64_t DataChecksum;
+  };
+
+  struct Entry
+  {
+    uint32_t Bank;
+    uint8_t Pad;
+    uint8_t Precision; // SamplePrecision
+    uint8_t Channels;  // 0 when the sample could not be loaded
+    uint8_t Mode;      // PlayMode
+    uint8_t Color[3];  // r, g, b
+    uint8_t Retrigger;
+    uint32_t NameOffset;
+    uint32_t NameSize;
+    uint32_t FileOffset;
+    uint32_t FileSize;
+    uint32_t Choke;
+    int64_t FileTime;
+    uint64_t FileBytes;
+    int64_t Frames;
+    uint64_t DataOffset; // from Header::DataOffset
+    int64_t LoopStart;
+    int64_t LoopEnd;
+    uint32_t AttackMs;
+    uint32_t ReleaseMs;
+    uint32_t OutputOffset;
+    uint32_t OutputSize;
+    uint32_t Quantize; // QuantizeMode
+    int32_t Pitch;
+    double Bpm;
+  };
+
+  static_assert(is_trivially_copyable_v<Header> and sizeof(Header) == 88);
+  static_assert(is_trivially_copyable_v<Entry> and sizeof(Entry) == 112);
+
+  /// FNV-1a over 8 byte words, plenty to catch a truncated or corrupted
+  /// file at memory speed.
+  uint64_t checksum(const uint8_t* data, size_t size, uint64_t hash = 0xcbf29ce484222325)
+  {
+    constexpr uint64_t Prime = 0x100000001b3;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      hash = (hash ^ word) * Prime;
+    }
+    for (; i < size; ++i) {
+      hash = (hash ^ data[i]) * Prime;
+    }
+    return hash;
+  }
+
+  size_t alignUp(size_t value, size_t alignment)
+  {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+}
+
+void BankImage::write(
+    const fs::path& image, const fs::path& samplesFile,
+    const vector<BankConfig>& configs,
+    const vector<shared_ptr<const SampleBank>>& banks,
+    int rate)
+{
+  vector<Entry> entries;
+  string strings;
+  uint64_t dataSize = 0;
+
+  auto addString = [&](string_view str, uint32_t& offset, uint32_t& size) {
+    offset = strings.size();
+    size = str.size();
+    strings += str;
+  };
+
+  for (size_t b = 0; b < configs.size(); ++b) {
+    for (int p = 0; p < atom::NumPads; ++p) {
+      const auto& config = configs[b][p];
+      if (not config.has_value()) {
+        continue;
+      }
+      const SampleBuffer* sample = b < banks.size() and banks[b] ?
+          &banks[b]->Samples[p] : nullptr;
+
+      Entry entry{};
+      entry.Bank = b;
+      entry.Pad = p;
+      entry.Color[0] = config->Color.r;
+      entry.Color[1] = config->Color.g;
+      entry.Color[2] = config->Color.b;
+      entry.Mode = uint8_t(config->Play.Mode);
+      entry.Choke = config->Play.Choke;
+      entry.LoopStart = config->Play.LoopStart;
+      entry.LoopEnd = config->Play.LoopEnd;
+      entry.Retrigger = uint8_t(config->Play.Retrigger);
+      entry.AttackMs = config->Play.AttackMs;
+      entry.ReleaseMs = config->Play.ReleaseMs;
+      entry.Quantize = uint32_t(config->Play.Quantize);
+      entry.Pitch = config->Play.Pitch;
+      entry.Bpm = config->Play.Bpm;
+      addString(config->Name, entry.NameOffset, entry.NameSize);
+      addString(config->File, entry.FileOffset, entry.FileSize);
+      addString(config->Output, entry.OutputOffset, entry.OutputSize);
+
+      error_code error;
+      fs::path file = config->File;
+      entry.FileTime = fs::last_write_time(file, error).time_since_epoch().count();
+      entry.FileBytes = error ? 0 : fs::file_size(file, error);
+
+      if (sample and not sample->empty()) {
+        entry.Precision = uint8_t(sample->precision());
+        entry.Channels = sample->channels();
+        entry.Frames = sample->frames();
+        entry.DataOffset = dataSize;
+        dataSize += sample->bytes();
+      }
+      entries.push_back(entry);
+    }
+  }
+
+  Header header{};
+  memcpy(header.Magic, Magic, sizeof(Magic));
+  header.Version = Version;
+  header.Rate = rate;
+  header.BankCount = configs.size();
+  header.SampleCount = entries.size();
+  header.SamplesTime = fs::last_write_time(samplesFile).time_since_epoch().count();
+  header.SamplesSize = fs::file_size(samplesFile);
+  header.StringsOffset = sizeof(Header) + entries.size() * sizeof(Entry);
+  header.StringsSize = strings.size();
+  header.DataOffset = alignUp(header.StringsOffset + strings.size(), PageSize);
+  header.DataSize = dataSize;
+
+  header.MetaChecksum = checksum(
+      reinterpret_cast<const uint8_t*>(entries.data()),
+      entries.size() * sizeof(Entry));
+  header.MetaChecksum = checksum(
+      reinterpret_cast<const uint8_t*>(strings.data()), strings.size(),
+      header.MetaChecksum);
+  uint64_t dataChecksum = 0xcbf29ce484222325;
+  for (auto& entry: entries) {
+    if (entry.Channels != 0) {
+      auto& sample = banks[entry.Bank]->Samples[entry.Pad];
+      dataChecksum = checksum(sample.data(), sample.bytes(), dataChecksum);
+    }
+  }
+  header.DataChecksum = dataChecksum;
+
+  // Written aside and renamed, a running instance may have it mapped.
+  auto temporary = image;
+  temporary += ".tmp";
+  {
+    ofstream out(temporary, ios::binary | ios::trunc);
+    if (not out) {
+      logger.throw_("Could not open {} for writing", temporary);
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()),
+        entries.size() * sizeof(Entry));
+    out.write(strings.data(), strings.size());
+    const string padding(header.DataOffset - header.StringsOffset - strings.size(), '\0');
+    out.write(padding.data(), padding.size());
+    for (auto& entry: entries) {
+      if (entry.Channels != 0) {
+        auto& sample = banks[entry.Bank]->Samples[entry.Pad];
+        out.write(reinterpret_cast<const char*>(sample.data()), sample.bytes());
+      }
+    }
+    out.close();
+    if (not out) {
+      logger.throw_("Failed to write {}", temporary);
+    }
+  }
+  fs::rename(temporary, image);
+
+  logger.info("Compiled {} banks and {} samples in {} ({} MB of audio)",
+      configs.size(), entries.size(), image, dataSize >> 20);
+}
+
+BankImage::BankImage(const fs::path& path, int rate, bool verifyData)
+  : _file(make_shared<MappedFile>(path))
+{
+  PS_TRACE_SCOPE("BankImage::BankImage");
+  auto text = _file->text();
+  auto base = reinterpret_cast<const uint8_t*>(text.data());
+  const size_t size = text.size();
+
+  Header header;
+  if (size < sizeof(Header)) {
+    logger.throw_("{} is too short to be a bank image", path);
+  }
+  memcpy(&header, base, sizeof(header));
+  if (memcmp(header.Magic, Magic, sizeof(Magic)) != 0) {
+    logger.throw_("{} is not a bank image", path);
+  }
+  if (header.Version != Version) {
+    logger.throw_("{} has version {}, expecting {}. Compile it again.",
+        path, header.Version, Version);
+  }
+  if (int(header.Rate) != rate) {
+    logger.throw_("{} was compiled for {}Hz but the card runs at {}Hz",
+        path, header.Rate, rate);
+  }
+  const size_t tableSize = size_t(header.SampleCount) * sizeof(Entry);
+  if (header.StringsOffset != sizeof(Header) + tableSize or
+      header.StringsOffset + header.StringsSize > size or
+      header.DataOffset % PageSize != 0 or
+      header.DataOffset + header.DataSize > size)
+  {
+    logger.throw_("{} is truncated or corrupted", path);
+  }
+
+  auto meta = checksum(base + sizeof(Header), tableSize);
+  meta = checksum(base + header.StringsOffset, header.StringsSize, meta);
+  if (meta != header.MetaChecksum) {
+    logger.throw_("{} is corrupted, wrong checksum", path);
+  }
+  if (verifyData and
+      checksum(base + header.DataOffset, header.DataSize) != header.DataChecksum)
+  {
+    logger.throw_("{} has corrupted audio, wrong checksum", path);
+  }
+
+  _samplesTime = fs::file_time_type(fs::file_time_type::duration(header.SamplesTime));
+  _samplesSize = header.SamplesSize;
+
+  string_view strings(text.data() + header.StringsOffset, header.StringsSize);
+  _configs.resize(header.BankCount);
+  vector<shared_ptr<SampleBank>> banks(header.BankCount);
+  for (auto& bank: banks) {
+    bank = make_shared<SampleBank>();
+    bank->Mapping = _file;
+    bank->Samples.resize(atom::NumPads);
+    bank->Unchanged.resize(atom::NumPads);
+  }
+
+  for (uint32_t i = 0; i < header.SampleCount; ++i) {
+    Entry entry;
+    memcpy(&entry, base + sizeof(Header) + i * sizeof(Entry), sizeof(entry));
+    if (entry.Bank >= header.BankCount or entry.Pad >= atom::NumPads or
+        uint64_t(entry.NameOffset) + entry.NameSize > strings.size() or
+        uint64_t(entry.FileOffset) + entry.FileSize > strings.size() or
+        uint64_t(entry.OutputOffset) + entry.OutputSize > strings.size() or
+        entry.Precision > uint8_t(SamplePrecision::Float) or
+        entry.Mode > uint8_t(PlayMode::Loop) or
+        entry.Retrigger > uint8_t(RetriggerMode::Ignore) or
+        entry.Quantize > uint32_t(QuantizeMode::Bar) or
+        abs(entry.Pitch) > PlaySettings::MaxPitch or not (entry.Bpm >= 0))
+    {
+      logger.throw_("{} is corrupted, invalid sample {}", path, i);
+    }
+
+    _configs[entry.Bank][entry.Pad] = ImageSample{
+      .Name = strings.substr(entry.NameOffset, entry.NameSize),
+      .File = strings.substr(entry.FileOffset, entry.FileSize),
+      .Color = {entry.Color[0], entry.Color[1], entry.Color[2]},
+      .Play = {
+        .Mode = PlayMode(entry.Mode),
+        .LoopStart = long(entry.LoopStart),
+        .LoopEnd = long(entry.LoopEnd),
+        .Choke = int(entry.Choke),
+        .Retrigger = RetriggerMode(entry.Retrigger),
+        .AttackMs = int(entry.AttackMs),
+        .ReleaseMs = int(entry.ReleaseMs),
+        .Quantize = QuantizeMode(entry.Quantize),
+        .Pitch = int(entry.Pitch),
+        .Bpm = entry.Bpm,
+      },
+      .Output = strings.substr(entry.OutputOffset, entry.OutputSize),
+      .FileTime = fs::file_time_type(fs::file_time_type::duration(entry.FileTime)),
+      .FileSize = entry.FileBytes
+    };
+
+    if (entry.Channels == 0) {
+      continue; // could not be loaded when compiled
+    }
+    auto precision = SamplePrecision(entry.Precision);
+    size_t bytes = SampleBuffer::bytesFor(precision, entry.Channels, entry.Frames);
+    if (entry.DataOffset + bytes > header.DataSize) {
+      logger.throw_("{} is corrupted, sample {} is out of the file", path, i);
+    }
+    banks[entry.Bank]->Samples[entry.Pad] = SampleBuffer::view(
+        precision, entry.Channels, entry.Frames,
+        base + header.DataOffset + entry.DataOffset);
+  }
+
+  _banks.assign(banks.begin(), banks.end());
+}
+
+bool BankImage::upToDate(const fs::path& samplesFile) const
+{
+  error_code error;
+  auto time = fs::last_write_time(samplesFile, error);
+  if (error) {
+    return false;
+  }
+  auto size = fs::file_size(samplesFile, error);
+  return not error and time == _samplesTime and size == _samplesSize;
+}
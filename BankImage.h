@@ -0,0 +1,74 @@
+#pragma once
+
+/// \file A samples file and its decoded samples in a single file, mapped at
+/// startup instead of parsing and decoding everything (--compile-banks).
+
+#include "Banks.h"
+#include "SampleArena.h"
+#include "Strings.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace ps
+{
+  /// A pad of a compiled bank, views into the image.
+  struct ImageSample
+  {
+    std::string_view Name;
+    std::string_view File;
+    atom::Color Color;
+    PlaySettings Play;
+    std::string_view Output; // resolved by the player
+    // What the sample was decoded from.
+    std::filesystem::file_time_type FileTime;
+    uintmax_t FileSize;
+  };
+
+  /// Layout, all little endian as on the Pi:
+  ///   header, sample table, strings, then the PCM of every sample as a
+  ///   SampleBuffer lays it out, page aligned so that planes stay aligned.
+  /// The header has a checksum of the table and strings, and another of the
+  /// PCM. Images are only valid for the rate they were built for.
+  class BankImage
+  {
+  public:
+    static constexpr uint32_t Version = 6;
+
+    /// Write `banks`, as made by the player for `rate`, with the
+    /// configuration they were made from.
+    static void write(
+        const std::filesystem::path& image,
+        const std::filesystem::path& samplesFile,
+        const std::vector<BankConfig>& configs,
+        const std::vector<std::shared_ptr<const SampleBank>>& banks,
+        int rate);
+
+    /// Map an image, throws when it is not valid or not for `rate`.
+    /// `verifyData` also checks the PCM checksum, which reads all of it.
+    BankImage(const std::filesystem::path&, int rate, bool verifyData);
+
+    /// Whether `samplesFile` is still the one the image was built from,
+    /// by modification time and size.
+    bool upToDate(const std::filesystem::path& samplesFile) const;
+
+    int bankCount() const { return _configs.size(); }
+    const std::array<std::optional<ImageSample>, atom::NumPads>&
+    config(int bank) const { return _configs[bank]; }
+
+    /// Samples pointing into the image, which stays mapped as long as they
+    /// are used.
+    std::shared_ptr<const SampleBank> bank(int index) const { return _banks[index]; }
+
+  private:
+    std::shared_ptr<MappedFile> _file;
+    std::filesystem::file_time_type _samplesTime;
+    uintmax_t _samplesSize = 0;
+    std::vector<std::array<std::optional<ImageSample>, atom::NumPads>> _configs;
+    std::vector<std::shared_ptr<const SampleBank>> _banks;
+  };
+}
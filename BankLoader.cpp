@@ -0,0 +1,284 @@
+#include "BankLoader.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("BANKS");
+
+  bool all(const vector<bool>& values)
+  {
+    return std::all_of(values.begin(), values.end(), [](bool v) { return v; });
+  }
+}
+
+BankLoader::BankLoader(Player& player, Options options, Callback onReady)
+  : _player(player)
+  , _options(options)
+  , _onReady(move(onReady))
+{
+  _thread = thread([this] { run(); });
+}
+
+BankLoader::~BankLoader()
+{
+  {
+    lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _wake.notify_one();
+  _thread.join();
+}
+
+void BankLoader::update(vector<Plan> plans)
+{
+  lock_guard lock(_mutex);
+  for (size_t b = plans.size(); b < _banks.size(); ++b) {
+    if (_banks[b].Samples) {
+      _handOver.emplace_back(b, nullptr);
+    }
+  }
+  _banks.resize(plans.size());
+
+  for (size_t b = 0; b < plans.size(); ++b) {
+    auto& bank = _banks[b];
+    auto& plan = plans[b];
+    ++bank.Generation;
+    bank.Loaded.resize(plan.Paths.size());
+    bank.Ready.resize(plan.Paths.size());
+    for (size_t p = 0; p < plan.Paths.size(); ++p) {
+      // What changed is decoded again, the previous sample can still be
+      // played until then.
+      if (p >= plan.Keep.size() or not plan.Keep[p]) {
+        bank.Loaded[p] = false;
+        bank.Pinned = false;
+      }
+    }
+    bank.Source = move(plan);
+  }
+  _wake.notify_one();
+}
+
+void BankLoader::preload(int index, shared_ptr<const SampleBank> samples)
+{
+  lock_guard lock(_mutex);
+  if (index < 0 or index >= int(_banks.size())) {
+    logger.throw_("Cannot preload bank {}, there are {} banks",
+        index, _banks.size());
+  }
+  auto& bank = _banks[index];
+  ++bank.Generation; // anything being decoded for it is obsolete
+  bank.Loaded.assign(samples->Samples.size(), true);
+  bank.Ready.resize(samples->Samples.size());
+  for (size_t p = 0; p < samples->Samples.size(); ++p) {
+    bank.Ready[p] = not samples->Samples[p].empty();
+  }
+  bank.Bytes = 0;
+  bank.Pinned = true;
+  bank.Samples = samples;
+  _handOver.emplace_back(index, move(samples));
+  _wake.notify_one();
+}
+
+void BankLoader::setCurrent(int index)
+{
+  lock_guard lock(_mutex);
+  _current = index;
+  if (index >= 0 and index < int(_banks.size())) {
+    _banks[index].LastUsed = ++_clock;
+  }
+  _wake.notify_one();
+}
+
+bool BankLoader::ready(int bank, int pad) const
+{
+  lock_guard lock(_mutex);
+  return bank >= 0 and bank < int(_banks.size()) and pad >= 0 and
+      pad < int(_banks[bank].Ready.size()) and _banks[bank].Ready[pad];
+}
+
+shared_ptr<const SampleBank> BankLoader::bank(int index) const
+{
+  lock_guard lock(_mutex);
+  if (index < 0 or index >= int(_banks.size())) {
+    return nullptr;
+  }
+  return _banks[index].Samples;
+}
+
+vector<int> BankLoader::neighbours() const
+{
+  vector<int> result;
+  const int count = _banks.size();
+  if (_current >= 0 and _current < count) {
+    result.push_back(_current);
+  }
+  // Both directions alternately, nearest first.
+  for (int distance = 1; distance <= _options.Lookahead; ++distance) {
+    for (int b: {_current + distance, _current - distance}) {
+      if (b >= 0 and b < count) {
+        result.push_back(b);
+      }
+    }
+  }
+  return result;
+}
+
+optional<BankLoader::Work> BankLoader::next()
+{
+  auto order = neighbours();
+  // Banks elsewhere are only kept up to date if they are loaded.
+  for (int b = 0; b < int(_banks.size()); ++b) {
+    if (_banks[b].Samples and find(order.begin(), order.end(), b) == order.end()) {
+      order.push_back(b);
+    }
+  }
+
+  for (int b: order) {
+    auto& bank = _banks[b];
+    for (size_t p = 0; p < bank.Loaded.size(); ++p) {
+      if (bank.Loaded[p]) {
+        continue;
+      }
+      auto& path = bank.Source.Paths[p];
+      bool occupied = bank.Samples and p < bank.Samples->Samples.size() and
+          not bank.Samples->Samples[p].empty();
+      if (path.empty() and not occupied) {
+        bank.Loaded[p] = true; // nothing to do
+        continue;
+      }
+      return Work{
+        .Bank = b, .Pad = int(p), .Path = path, .Generation = bank.Generation};
+    }
+  }
+  return nullopt;
+}
+
+void BankLoader::evict()
+{
+  if (_options.Budget == 0) {
+    return;
+  }
+  size_t total = 0;
+  for (auto& bank: _banks) {
+    total += bank.Bytes;
+  }
+  const auto kept = neighbours();
+  while (total > _options.Budget) {
+    Bank* oldest = nullptr;
+    for (size_t b = 0; b < _banks.size(); ++b) {
+      auto& bank = _banks[b];
+      if (bank.Bytes == 0 or find(kept.begin(), kept.end(), int(b)) != kept.end()) {
+        continue;
+      }
+      if (not oldest or bank.LastUsed < oldest->LastUsed) {
+        oldest = &bank;
+      }
+    }
+    if (not oldest) {
+      return; // the banks around the current one do not fit, still keeping them
+    }
+    const int index = oldest - _banks.data();
+    logger.debug("Dropping bank {} ({} MB)", index, oldest->Bytes >> 20);
+    total -= oldest->Bytes;
+    oldest->Samples.reset();
+    oldest->Bytes = 0;
+    fill(oldest->Loaded.begin(), oldest->Loaded.end(), false);
+    fill(oldest->Ready.begin(), oldest->Ready.end(), false);
+    _handOver.emplace_back(index, nullptr);
+  }
+}
+
+void BankLoader::handOver(unique_lock<mutex>& lock)
+{
+  auto banks = move(_handOver);
+  _handOver.clear();
+  if (banks.empty()) {
+    return;
+  }
+  lock.unlock();
+  for (auto& [index, samples]: banks) {
+    _player.setBank(index, move(samples));
+  }
+  lock.lock();
+}
+
+void BankLoader::run()
+{
+  trace::setThreadName("banks");
+
+  unique_lock lock(_mutex);
+  while (not _stop) {
+    handOver(lock);
+    auto work = next();
+    if (not work) {
+      if (_handOver.empty() and not _stop) {
+        _wake.wait(lock);
+      }
+      continue;
+    }
+
+    lock.unlock();
+    SampleBuffer sample;
+    if (not work->Path.empty()) {
+      PS_TRACE_SCOPE("BankLoader::decode");
+      try {
+        sample = _player.decode(work->Path);
+      }
+      catch (const exception& ex) {
+        logger.error("Not loading {} ({})", work->Path, ex.what());
+      }
+    }
+    lock.lock();
+
+    auto current = [&]() -> Bank* {
+      bool valid = work->Bank < int(_banks.size()) and
+          _banks[work->Bank].Generation == work->Generation;
+      return valid ? &_banks[work->Bank] : nullptr;
+    };
+    Bank* bank = current();
+    if (not bank) {
+      continue; // the plan changed meanwhile
+    }
+    bank->Samples = SampleBank::replace(
+        bank->Samples, bank->Source.Paths.size(), work->Pad, move(sample));
+    bank->Loaded[work->Pad] = true;
+    bank->Ready[work->Pad] = not bank->Samples->Samples[work->Pad].empty();
+    bank->Bytes = bank->Pinned ? 0 : bank->Samples->bytes();
+    _handOver.emplace_back(work->Bank, bank->Samples);
+    const bool ready = bank->Ready[work->Pad];
+    // Complete, to pack in one piece rather than a sample here and there.
+    auto layered = all(bank->Loaded) and not bank->Samples->Arena ?
+        bank->Samples : nullptr;
+    evict();
+
+    handOver(lock);
+    if (ready) {
+      lock.unlock();
+      _onReady(work->Bank, work->Pad);
+      lock.lock();
+    }
+
+    if (layered) {
+      lock.unlock();
+      shared_ptr<const SampleBank> packed;
+      {
+        PS_TRACE_SCOPE("BankLoader::pack");
+        packed = SampleBank::pack(
+            vector<SampleBuffer>(layered->Samples.size()), layered.get(),
+            vector<bool>(layered->Samples.size(), true));
+      }
+      lock.lock();
+      bank = current();
+      if (bank and bank->Samples == layered) {
+        bank->Samples = packed;
+        _handOver.emplace_back(work->Bank, move(packed));
+      }
+    }
+  }
+}
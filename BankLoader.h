@@ -0,0 +1,115 @@
+#pragma once
+
+/// \file Banks decoded on demand, around the one being played.
+
+#include "Player.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  /// Gives the player the banks it needs, decoded on its own thread: the
+  /// current bank first, then its neighbours so that paging to them is
+  /// instant, while the least recently used banks are dropped to stay under
+  /// a memory budget.
+  ///
+  /// Samples are handed to the player one at a time as they are decoded
+  /// (see SampleBank::replace), a bank is packed in a single arena once
+  /// complete.
+  class BankLoader
+  {
+  public:
+    struct Options
+    {
+      size_t Budget = 0; // bytes of decoded samples, 0 for no limit
+      int Lookahead = 1; // banks prefetched on each side of the current one
+    };
+
+    /// What a bank is made of, one path per pad, empty for none.
+    struct Plan
+    {
+      std::vector<std::filesystem::path> Paths;
+      // Per pad, whether the file is the same as in the previous plan. Those
+      // are not decoded again when the bank is loaded.
+      std::vector<bool> Keep;
+    };
+
+    /// Called from the loading thread when the sample of a pad can be played.
+    using Callback = std::function<void(int bank, int pad)>;
+
+    BankLoader(Player&, Options, Callback onReady);
+    BankLoader(const BankLoader&) = delete;
+    ~BankLoader();
+
+    /// Replace the plans of all the banks, e.g. after the samples file
+    /// changed. Loaded banks are updated, others wait to be needed.
+    void update(std::vector<Plan>);
+    /// A bank already loaded, e.g. mapped from a bank image. Not counted in
+    /// the budget, and never dropped unless a new plan changes it.
+    void preload(int index, std::shared_ptr<const SampleBank>);
+    /// The bank being played, loaded before anything else.
+    void setCurrent(int index);
+    /// Whether the sample of `pad` can be played right now.
+    bool ready(int bank, int pad) const;
+    /// As given to the player so far, null when not loaded.
+    std::shared_ptr<const SampleBank> bank(int index) const;
+
+  private:
+    struct Bank
+    {
+      Plan Source;
+      std::shared_ptr<const SampleBank> Samples; // null when not loaded
+      std::vector<bool> Loaded; // per pad, up to date with the plan
+      std::vector<bool> Ready;  // per pad, in Samples and not empty
+      size_t Bytes = 0;         // counted in the budget
+      uint64_t LastUsed = 0;
+      uint64_t Generation = 0;  // of the plan
+      bool Pinned = false;      // see preload
+    };
+
+    /// A pad to decode, and for which plan.
+    struct Work
+    {
+      int Bank = -1;
+      int Pad = -1;
+      std::filesystem::path Path;
+      uint64_t Generation = 0;
+    };
+
+    void run();
+    /// The most urgent pad to decode, under the mutex.
+    std::optional<Work> next();
+    /// The current bank and the ones prefetched around it, under the mutex.
+    std::vector<int> neighbours() const;
+    /// Drop banks until under the budget, under the mutex.
+    void evict();
+    /// Give the player the banks waiting for it, unlocks meanwhile.
+    void handOver(std::unique_lock<std::mutex>&);
+
+    Player& _player;
+    const Options _options;
+    const Callback _onReady;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    // ---------- members below must be accessed under the mutex ------------ //
+    std::vector<Bank> _banks;
+    // For the player, in order. Only the loading thread calls setBank so
+    // that the banks it builds on top of each other arrive in order.
+    std::vector<std::pair<int, std::shared_ptr<const SampleBank>>> _handOver;
+    int _current = 0;
+    uint64_t _clock = 0;
+    bool _stop = false;
+    // ---------------------------------------------------------------------- //
+
+    std::thread _thread;
+  };
+}
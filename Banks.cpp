@@ -0,0 +1,270 @@
+#include "Banks.h"
+#include "Strings.h"
+#include "Log.h"
+
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace ps;
+using namespace std;
+
+namespace {
+  auto logger = Log("BANKS");
+
+  enum Key
+  {
+    Name = 1,
+    File = 2,
+    Color = 4,
+    Mode = 8,
+    LoopStart = 16,
+    LoopEnd = 32,
+    Choke = 64,
+    Retrigger = 128,
+    Attack = 256,
+    Release = 512,
+    Output = 1024,
+    Quantize = 2048,
+    Pitch = 4096,
+    Bpm = 8192,
+  };
+}
+
+vector<BankConfig> ps::parseBanks(string_view text, string_view fileName)
+{
+  vector<BankConfig> banks;
+  optional<SampleConfig>* currentSample = nullptr;
+  vector<string_view> bankOutputs; // of [BankX] sections
+  bool inBankSection = false;
+  int currentBank = 0;
+  int seenKeys = 0; // of the current sample or bank
+
+  forEachLine(text, [&](string_view rawLine, int index) {
+    string_view line = trim(rawLine);
+    if (line.empty() || line[0] == '#') {
+      return;
+    }
+
+    // Errors point at `at`, a part of the line.
+    auto fail = [&](string_view at, const char* format, auto&& ... args) {
+      logger.throw_("samples file {}, line {}, column {}: {}", fileName, index,
+          columnOf(rawLine, at), fmt::format(format, args...));
+    };
+
+    if (line[0] == '[') {
+      // new sample
+      if (line.back() != ']') {
+        fail(line.substr(line.size() - 1), "Malformed line: missing closing ']'");
+      }
+      string_view section = line.substr(1, line.size() - 2);
+      auto dot = section.find('.');
+      if (section.substr(0, 4) != "Bank" or
+          (dot != string_view::npos and section.substr(dot + 1, 3) != "Pad"))
+      {
+        fail(section, "Malformed line: Must be [BankX.PadY] or [BankX]");
+      }
+      string_view bankPart = section.substr(4, dot - 4);
+      string_view padPart =
+          dot == string_view::npos ? string_view() : section.substr(dot + 4);
+
+      int bankNo = -1;
+      try {
+        bankNo = svtoi(bankPart);
+      }
+      catch (...) { }
+      if (bankNo < 1) {
+        fail(bankPart, "Could not convert '{}' to a valid bank number (> 0)",
+            bankPart);
+      }
+      if (bankNo != currentBank and bankNo != currentBank + 1) {
+        fail(bankPart, "Bank is {} but last was {} - expecting the same "
+          "value or {}. Banks must be given in order in the file.",
+          bankNo, currentBank, currentBank + 1);
+      }
+      currentBank = bankNo;
+      if (banks.size() < static_cast<unsigned>(bankNo)) {
+        banks.resize(bankNo);
+        bankOutputs.resize(bankNo);
+        // filled with unset samples for pads.
+      }
+      seenKeys = 0;
+      inBankSection = dot == string_view::npos;
+      if (inBankSection) {
+        // Defaults for the pads of the bank.
+        currentSample = nullptr;
+        return;
+      }
+
+      int padNo = -1;
+      try {
+        padNo = svtoi(padPart);
+      }
+      catch (...) { }
+      if (padNo < 1 or padNo > 16) {
+        fail(padPart, "Could not convert '{}' to a valid pad number (1-16)",
+            padPart);
+      }
+
+      if (banks.back()[padNo - 1].has_value()) {
+        fail(section, "Bank{}.Pad{} is present twice in the config",
+            bankNo, padNo);
+      }
+      currentSample = & banks.back()[padNo - 1];
+      *currentSample = SampleConfig();
+      return;
+    }
+
+    if (currentSample == nullptr and not inBankSection) {
+      fail(line, "A property key=value was given before [BankY.PadY]");
+    }
+    auto equal = line.find('=');
+    if (equal == string_view::npos) {
+      fail(line, "Expecting key=value but found {}", line);
+    }
+    string_view key = trim(line.substr(0, equal));
+    string_view value = trim(line.substr(equal + 1));
+    if (key.empty()) {
+      fail(line, "Missing key before '='");
+    }
+    if (value.empty()) {
+      fail(line.substr(equal), "Missing value after '='");
+    }
+
+    int keyId = key == "Name" ? Name : key == "File" ? File :
+        key == "Color" ? Color : key == "Mode" ? Mode :
+        key == "LoopStart" ? LoopStart : key == "LoopEnd" ? LoopEnd :
+        key == "Choke" ? Choke : key == "Retrigger" ? Retrigger :
+        key == "Attack" ? Attack : key == "Release" ? Release :
+        key == "Output" ? Output : key == "Quantize" ? Quantize :
+        key == "Pitch" ? Pitch : key == "Bpm" ? Bpm : 0;
+    if (keyId == 0) {
+      return; // not for us
+    }
+    if (seenKeys & keyId) {
+      fail(key, "{} is given twice for this {}", key,
+          inBankSection ? "bank" : "sample");
+    }
+    seenKeys |= keyId;
+
+    if (inBankSection) {
+      if (keyId != Output) {
+        fail(key, "{} must be given per pad, only Output can be given for a "
+            "whole bank", key);
+      }
+      bankOutputs.back() = value;
+      return;
+    }
+
+    auto& sample = currentSample->value();
+    if (keyId == Name) {
+      sample.Name = value;
+    }
+    else if (keyId == File) {
+      sample.File = value;
+    }
+    else if (keyId == Color) {
+      try {
+        sample.Color = atom::Color::fromString(value);
+      }
+      catch (const exception&) {
+        fail(value, "Expecting an hex color formatted as '#123456' but "
+            "found {}", value);
+      }
+    }
+    else if (keyId == Mode) {
+      if (not parsePlayMode(value, sample.Play.Mode)) {
+        fail(value, "Expecting oneshot, gate or loop but found {}", value);
+      }
+    }
+    else if (keyId == Output) {
+      sample.Output = value;
+    }
+    else if (keyId == Retrigger) {
+      if (not parseRetrigger(value, sample.Play.Retrigger)) {
+        fail(value, "Expecting restart, overlap or ignore but found {}", value);
+      }
+    }
+    else if (keyId == Quantize) {
+      if (not parseQuantize(value, sample.Play.Quantize)) {
+        fail(value, "Expecting off, beat or bar but found {}", value);
+      }
+    }
+    else if (keyId == Pitch) {
+      int semitones = 0;
+      try {
+        semitones = svtoi(value);
+      }
+      catch (...) {
+        semitones = PlaySettings::MaxPitch + 1;
+      }
+      if (abs(semitones) > PlaySettings::MaxPitch) {
+        fail(value, "Expecting semitones from -{} to {} but found {}",
+            PlaySettings::MaxPitch, PlaySettings::MaxPitch, value);
+      }
+      sample.Play.Pitch = semitones;
+    }
+    else if (keyId == Bpm) {
+      double bpm = 0;
+      try {
+        bpm = svtod(value);
+      }
+      catch (...) { }
+      if (not (bpm >= 20 and bpm <= 999)) {
+        fail(value, "Expecting a tempo from 20 to 999 BPM but found {}", value);
+      }
+      sample.Play.Bpm = bpm;
+    }
+    else {
+      long number = -1;
+      try {
+        number = svtoi(value);
+      }
+      catch (...) { }
+      if (number < 0) {
+        fail(value, "Expecting a positive number but found {}", value);
+      }
+      if (keyId == LoopStart) {
+        sample.Play.LoopStart = number;
+      }
+      else if (keyId == LoopEnd) {
+        sample.Play.LoopEnd = number;
+      }
+      // Checked as the second of both is given, in either order.
+      if ((keyId == LoopStart or keyId == LoopEnd) and (seenKeys & LoopEnd) and
+          sample.Play.LoopEnd <= sample.Play.LoopStart)
+      {
+        fail(value, "Expecting LoopEnd after LoopStart but found {} to {}",
+            sample.Play.LoopStart, sample.Play.LoopEnd);
+      }
+      else if (keyId == Attack) {
+        sample.Play.AttackMs = number;
+      }
+      else if (keyId == Release) {
+        sample.Play.ReleaseMs = number;
+      }
+      else {
+        sample.Play.Choke = number;
+      }
+    }
+  });
+
+  for (size_t b = 0; b < banks.size(); ++b) {
+    for (auto& sample: banks[b]) {
+      if (sample.has_value() and sample->Output.empty()) {
+        sample->Output = bankOutputs[b];
+      }
+    }
+  }
+  return banks;
+}
+
+BankTable ps::readBanks(const filesystem::path& path)
+{
+  // Read rather than mapped: it is parsed again as it is saved, and a
+  // mapping truncated meanwhile would crash.
+  auto text = make_shared<const string>(readTextFile(path));
+  return BankTable{
+    .Banks = parseBanks(*text, path.string()),
+    .Text = text
+  };
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/// \file Parsing of the samples .ini file, without loading any audio.
+
+#include "Atom.h"
+#include "Playback.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ps
+{
+  /// A sample as described in the samples file, views into its text.
+  struct SampleConfig
+  {
+    std::string_view Name;
+    std::string_view File;
+    atom::Color Color = {};
+    PlaySettings Play;
+    /// Name of the output of the player, empty for the main one.
+    std::string_view Output;
+  };
+
+  /// A "page" of samples - i.e. 16 pads worth off.
+  using BankConfig = std::array<std::optional<SampleConfig>, atom::NumPads>;
+
+  /// Parse a samples file with sections like:
+  ///   [Bank1.Pad3]
+  ///   Name=Snare
+  ///   File=/home/pi/FX/snare.wav
+  ///   Color=#007f7f
+  ///   Mode=loop          (oneshot, gate or loop)
+  ///   LoopStart=1200     (frames)
+  ///   LoopEnd=96000
+  ///   Choke=1            (pads of the same group cut each other)
+  ///   Retrigger=restart  (restart, overlap or ignore)
+  ///   Attack=2           (ms of fade in)
+  ///   Release=50         (ms of fade out when stopped)
+  ///   Output=cue         (see audio-out-outputs)
+  ///   Quantize=beat      (off, beat or bar, to the tempo)
+  ///   Pitch=-2           (semitones, from -24 to 24)
+  ///   Bpm=124            (of the sample, stretched to the tempo)
+  /// A section like [Bank2] gives the Output of the pads of the bank that do
+  /// not have their own. Banks must be given in order. Throws with the line
+  /// and column on errors. `fileName` is only used for error messages.
+  /// Nothing is copied, `text` must outlive the result.
+  std::vector<BankConfig> parseBanks(std::string_view text, std::string_view fileName);
+
+  /// The banks of a samples file and the text they point into.
+  struct BankTable
+  {
+    std::vector<BankConfig> Banks;
+    std::shared_ptr<const void> Text;
+  };
+
+  /// Same as above, the file is read in memory and parsed in place.
+  BankTable readBanks(const std::filesystem::path&);
+}
@@ -0,0 +1,92 @@
+#include "Bench.h"
+#include "fmt.h"
+
+#include <iostream>
+
+using namespace ps;
+using namespace std;
+namespace c = std::chrono;
+
+namespace
+{
+  struct Case
+  {
+    string Name;
+    function<void()> Run;
+  };
+
+  vector<Case>& cases()
+  {
+    static vector<Case> result;
+    return result;
+  }
+
+  constexpr const char* arch()
+  {
+#if defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#elif defined(__x86_64__)
+    return "x86_64";
+#else
+    return "unknown";
+#endif
+  }
+}
+
+bool bench::add(string name, function<void()> run)
+{
+  cases().push_back(Case{move(name), move(run)});
+  return true;
+}
+
+void bench::measure(
+    string_view name,
+    string_view param,
+    double itemsPerCall,
+    const function<void()>& func,
+    c::milliseconds minTime)
+{
+  // Warm up caches and let lazily initialized things happen.
+  func();
+
+  long iterations = 1;
+  c::nanoseconds elapsed{};
+  while (true) {
+    auto start = c::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+      func();
+    }
+    elapsed = c::steady_clock::now() - start;
+    if (elapsed >= minTime) {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  double nsPerIteration = double(elapsed.count()) / iterations;
+  fmt::print("{{\"bench\":\"{}\",\"param\":\"{}\",\"arch\":\"{}\","
+      "\"compiler\":\"{}\",\"iterations\":{},\"ns_per_iteration\":{:.1f},"
+      "\"items_per_second\":{:.1f}}}\n",
+      name, param, arch(), __VERSION__, iterations, nsPerIteration,
+      itemsPerCall * 1e9 / nsPerIteration);
+  cout.flush();
+}
+
+/// Usage: pisample-bench [name filter]
+/// Runs every benchmark whose name contains the filter.
+int main(int argc, const char* const* argv)
+try {
+  string_view filter = argc > 1 ? argv[1] : "";
+  for (auto& c: cases()) {
+    if (c.Name.find(filter) != string::npos) {
+      c.Run();
+    }
+  }
+  return EXIT_SUCCESS;
+}
+catch (const exception& ex) {
+  cerr << ex.what() << '\n';
+  return EXIT_FAILURE;
+}
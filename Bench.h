@@ -0,0 +1,43 @@
+#pragma once
+
+/// \file A minimal micro benchmark harness for `make bench`.
+///
+/// Every result is printed as one JSON object per line, with stable keys, so
+/// runs on different machines (Pi vs. x86) can be diffed or loaded in a
+/// script:
+///   {"bench":"extractChannels","param":"bits=24","arch":"arm", ...}
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ps::bench
+{
+  /// Prevent the compiler from optimizing away a computed value.
+  template <class T>
+  inline void keep(T& value)
+  {
+    asm volatile("" : : "g"(&value) : "memory");
+  }
+
+  /// Register a benchmark, it then calls `measure` once per parameter it
+  /// wants to test. Use PS_BENCH rather than calling this directly.
+  bool add(std::string name, std::function<void()> run);
+
+  /// Time `func` (called repeatedly for about `minTime`) and print a result.
+  /// `itemsPerCall` is used to compute a throughput in items per second.
+  void measure(
+      std::string_view name,
+      std::string_view param,
+      double itemsPerCall,
+      const std::function<void()>& func,
+      std::chrono::milliseconds minTime = std::chrono::milliseconds(300));
+
+  #define PS_BENCH(name) \
+    static void psBench_ ## name(); \
+    [[maybe_unused]] static bool psBench_ ## name ## Registered = \
+        ::ps::bench::add(#name, &psBench_ ## name); \
+    static void psBench_ ## name()
+}
@@ -0,0 +1,374 @@
+/// \file Benchmarks of the hot kernels, see Bench.h.
+
+#include "Bench.h"
+#include "Banks.h"
+#include "Device.h"
+#include "Effects.h"
+#include "FlacEncoder.h"
+#include "Frames.h"
+#include "Pads.h"
+#include "Resampler.h"
+#include "SampleBuffer.h"
+#include "Stretcher.h"
+#include "TempoDetector.h"
+
+#include <cmath>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  constexpr int Rate = 48000;
+
+  /// Something between a pure tone and noise so that FLAC has some work.
+  vector<int32_t> testSignal(long frames, int channels, int bits)
+  {
+    vector<int32_t> result(frames * channels);
+    uint32_t noise = 1;
+    double amplitude = (1 << (bits - 2));
+    for (long i = 0; i < frames; ++i) {
+      noise = noise * 1664525u + 1013904223u;
+      double tone = amplitude * sin(2 * M_PI * 440 * i / Rate);
+      for (int c = 0; c < channels; ++c) {
+        result[i * channels + c] = int32_t(tone) + int32_t(noise >> (40 - bits));
+      }
+    }
+    return result;
+  }
+}
+
+/// Recorder: selecting 2 channels out of the 10 the X1800 gives us.
+PS_BENCH(extractChannels)
+{
+  constexpr long frames = Rate / 10; // what the recorder reads at once
+  constexpr int inChannels = 10;
+  const int channels[] = {8, 9};
+
+  for (int bits: {16, 24, 32}) {
+    vector<uint8_t> in(frames * inChannels * storageBytes(bits), 0x5a);
+    vector<int32_t> out(frames * 2);
+    bench::measure("extractChannels", fmt::format("bits={},in=10,out=2", bits),
+        frames, [&] {
+          extractChannels(in.data(), inChannels, bits, channels, 2,
+              out.data(), frames);
+          bench::keep(out);
+        });
+  }
+}
+
+/// Recorder stems: the 10 channels of the X1800 into 5 stereo stems, or
+/// all of them into one.
+PS_BENCH(splitChannels)
+{
+  constexpr long frames = Rate / 10;
+  constexpr int inChannels = 10;
+
+  for (int bits: {16, 24, 32}) {
+    for (int groupSize: {2, inChannels}) {
+      vector<uint8_t> in(frames * inChannels * storageBytes(bits), 0x5a);
+      vector<vector<int32_t>> outs(inChannels / groupSize,
+          vector<int32_t>(frames * groupSize));
+      vector<int32_t*> ptrs;
+      for (auto& out: outs) {
+        ptrs.push_back(out.data());
+      }
+      bench::measure("splitChannels",
+          fmt::format("bits={},in=10,group={}", bits, groupSize),
+          frames, [&] {
+            splitChannels(in.data(), inChannels, bits, groupSize,
+                ptrs.data(), frames);
+            bench::keep(outs);
+          });
+    }
+  }
+}
+
+/// FLAC encoding of one second of stereo 24 bit, discarding the output.
+/// items are frames, divide by the rate for the realtime factor.
+PS_BENCH(flacEncode)
+{
+  auto signal = testSignal(Rate, 2, 24);
+
+  FlacSettings settings;
+  settings.Rate = Rate;
+
+  for (int level = 0; level <= 8; ++level) {
+    size_t bytes = 0;
+    settings.Level = level;
+    bench::measure("flacEncode", fmt::format("level={}", level), Rate, [&] {
+      FlacPtr enc(FLAC__stream_encoder_new());
+      configure(enc.get(), settings);
+      FLAC__stream_encoder_init_stream(enc.get(),
+          [](const FLAC__StreamEncoder*, const FLAC__byte[], size_t size,
+             uint32_t, uint32_t, void* data)
+          {
+            *static_cast<size_t*>(data) += size;
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+          },
+          nullptr, nullptr, nullptr, &bytes);
+      FLAC__stream_encoder_process_interleaved(enc.get(), signal.data(), Rate);
+      FLAC__stream_encoder_finish(enc.get());
+    });
+  }
+}
+
+/// Same with the encoder of the recorder when using several threads, 10
+/// seconds at a time for the workers to have something to do.
+PS_BENCH(flacEncodeParallel)
+{
+  constexpr long frames = Rate * 10;
+  auto signal = testSignal(frames, 2, 24);
+
+  FlacSettings settings;
+  settings.Rate = Rate;
+  // Nothing to reserve or flush on /dev/null.
+  FileWriter::Options options;
+  options.Preallocate = 0;
+  options.SyncEvery = 0;
+
+  for (int threads: {1, 2, 4}) {
+    settings.Threads = threads;
+    bench::measure("flacEncodeParallel", fmt::format("level=5,threads={}", threads),
+        frames, [&] {
+          ParallelFlacEncoder enc("/dev/null", settings, options);
+          // as the recorder gives it, 100ms at a time
+          for (long i = 0; i < frames; i += Rate / 10) {
+            enc.process(signal.data() + i * 2, Rate / 10);
+          }
+          enc.finish();
+        });
+  }
+}
+
+/// Resampling, streaming as the recorder does it, 100ms at a time. Items
+/// are input frames of one channel: ns_per_iteration / items is the cost
+/// per channel and frame.
+PS_BENCH(resample)
+{
+  constexpr long frames = Rate / 10;
+  for (auto quality: {ResampleQuality::Fast, ResampleQuality::Medium,
+                      ResampleQuality::Best})
+  {
+    for (auto [in, out]: {pair{44100, 48000}, pair{48000, 44100}}) {
+      for (int channels: {1, 2}) {
+        vector<float> input(frames * channels);
+        for (long i = 0; i < frames * channels; ++i) {
+          input[i] = sin(i * 0.01f);
+        }
+        Resampler resampler(in, out, channels, quality, frames);
+        vector<float> output(resampler.maxOutFrames(frames) * channels);
+        bench::measure("resample",
+            fmt::format("quality={},from={},to={},channels={}",
+                toString(quality), in, out, channels),
+            frames * channels, [&] {
+              resampler.process(input.data(), frames, output.data());
+              bench::keep(output);
+            });
+      }
+    }
+  }
+}
+
+/// Turning the state of all pads into ALSA events, what Pads::step and
+/// Device::sendNotes do without the actual sending.
+PS_BENCH(padNotes)
+{
+  vector<atom::Note> notes;
+  vector<snd_seq_event> events;
+  PadState state{ .Mode = atom::PadMode::On, .Color = {0x7f, 0x20, 0x00} };
+
+  bench::measure("padNotes", "pads=16", atom::NumPads, [&] {
+    notes.clear();
+    events.clear();
+    atom::forAllPads([&](atom::Pad p) { state.toNotes(p, notes); });
+    for (auto& n: notes) {
+      events.emplace_back();
+      memset(&events.back(), 0, sizeof(snd_seq_event));
+      convertNote(n, events.back());
+    }
+    bench::keep(events);
+  });
+}
+
+/// Parsing a samples file with many banks.
+PS_BENCH(parseBanks)
+{
+  for (int bankCount: {10, 200}) {
+    string ini;
+    int lines = 0;
+    for (int b = 1; b <= bankCount; ++b) {
+      for (int p = 1; p <= atom::NumPads; ++p) {
+        ini += fmt::format("[Bank{}.Pad{}]\nName=Sample {} {}\n"
+            "File=/home/pi/FX/bank {}/sample {}.wav\nColor=#7f{:02x}00\n\n",
+            b, p, b, p, b, p, p * 8);
+        lines += 5;
+      }
+    }
+
+    bench::measure("parseBanks", fmt::format("banks={}", bankCount), lines, [&] {
+      auto banks = parseBanks(ini, "bench");
+      bench::keep(banks);
+    });
+  }
+}
+
+/// Player: mixing a period of 10ms from `voices` samples, then writing it
+/// for an S24 card as Player::mix and writeOut do. Items are voices times
+/// ms of audio, items_per_second / 1000 is the number of voices mixed per
+/// ms of CPU, i.e. how many could play at once on a single core.
+PS_BENCH(mixVoices)
+{
+  constexpr long frames = Rate / 100;
+  constexpr int outChannels = 4;
+  const int channels[2] = {2, 3};
+  auto signal = testSignal(Rate, 2, 24);
+  vector<float> interleaved(signal.size());
+  for (size_t i = 0; i < signal.size(); ++i) {
+    interleaved[i] = signal[i] / float(1 << 23);
+  }
+  vector<float> gains(frames, 0.5f);
+
+  for (auto precision: {SamplePrecision::Int16, SamplePrecision::Float}) {
+    auto sample = SampleBuffer::fromInterleaved(
+        precision, interleaved.data(), 2, Rate);
+    for (int voices: {8, 32}) {
+      for (bool ramped: {false, true}) {
+        vector<float> mix(frames * 2);
+        vector<uint8_t> out(frames * outChannels * 4);
+        auto write = writeFramesFor(24);
+        long position = 0;
+        bench::measure("mixVoices",
+            fmt::format("precision={},voices={},envelope={}",
+                precision == SamplePrecision::Int16 ? "16" : "float",
+                voices, ramped),
+            voices * frames / (Rate / 1000.), [&] {
+              fill(mix.begin(), mix.end(), 0.f);
+              for (int v = 0; v < voices; ++v) {
+                // Each voice somewhere else in the sample.
+                long from = (position + v * 997) % (Rate - frames);
+                if (ramped) {
+                  sample.mixInto(mix.data(), mix.data() + frames, from, frames,
+                      gains.data());
+                }
+                else {
+                  sample.mixInto(mix.data(), mix.data() + frames, from, frames);
+                }
+              }
+              const float* planes[2] = {mix.data(), mix.data() + frames};
+              write(planes, channels, 2, frames, outChannels, out.data());
+              position = (position + frames) % Rate;
+              bench::keep(out);
+            });
+      }
+    }
+  }
+}
+
+/// Player: mixing a pitched voice, as Player::mix does with samples played
+/// at another pitch. Items are ms of audio, to compare with mixVoices.
+PS_BENCH(mixPitched)
+{
+  constexpr long frames = Rate / 100;
+  auto signal = testSignal(Rate, 2, 24);
+  vector<float> interleaved(signal.size());
+  for (size_t i = 0; i < signal.size(); ++i) {
+    interleaved[i] = signal[i] / float(1 << 23);
+  }
+  for (auto precision: {SamplePrecision::Int16, SamplePrecision::Float}) {
+    auto sample = SampleBuffer::fromInterleaved(
+        precision, interleaved.data(), 2, Rate);
+    for (int semitones: {-7, 5}) {
+      const double step = exp2(semitones / 12.);
+      vector<float> mix(frames * 2);
+      double position = 0;
+      bench::measure("mixPitched",
+          fmt::format("precision={},semitones={}",
+              precision == SamplePrecision::Int16 ? "16" : "float", semitones),
+          frames / (Rate / 1000.), [&] {
+            fill(mix.begin(), mix.end(), 0.f);
+            sample.mixResampled(mix.data(), mix.data() + frames, position,
+                step, frames, nullptr);
+            position += frames * step;
+            if (position + frames * step >= Rate) {
+              position = 0;
+            }
+            bench::keep(mix);
+          });
+    }
+  }
+}
+
+/// Stretcher: a second of stereo time-stretched, as done in the background
+/// when the tempo changes. Items are ms of the sample.
+PS_BENCH(timeStretch)
+{
+  auto signal = testSignal(Rate, 2, 16);
+  vector<float> interleaved(signal.size());
+  for (size_t i = 0; i < signal.size(); ++i) {
+    interleaved[i] = signal[i] / float(1 << 15);
+  }
+  auto sample = SampleBuffer::fromInterleaved(
+      SamplePrecision::Int16, interleaved.data(), 2, Rate);
+  for (double factor: {0.9, 1.1}) {
+    bench::measure("timeStretch", fmt::format("factor={}", factor), 1000, [&] {
+      auto stretched = timeStretch(sample, factor, Rate);
+      bench::keep(stretched);
+    });
+  }
+}
+
+/// Player: the effects on a period of 10ms, with the knobs moving every
+/// period so that the ramps are measured too. Items are ms of audio,
+/// 1000 / items_per_second is the share of a core the chain takes.
+PS_BENCH(effects)
+{
+  constexpr long frames = Rate / 100;
+  auto signal = testSignal(Rate, 2, 24);
+  vector<float> left(Rate), right(Rate);
+  for (long i = 0; i < Rate; ++i) {
+    left[i] = signal[2 * i] / float(1 << 23);
+    right[i] = signal[2 * i + 1] / float(1 << 23);
+  }
+
+  for (auto chain: {"filter", "delay", "both"}) {
+    Effects effects(Rate, 120);
+    const bool filter = chain != "delay"s;
+    const bool delay = chain != "filter"s;
+    effects.set(Effects::Filter, filter ? -0.5f : 0.f);
+    effects.set(Effects::Resonance, 0.5f);
+    effects.set(Effects::DelayAmount, delay ? 0.5f : 0.f);
+    vector<float> l(frames), r(frames);
+    long position = 0;
+    int notch = 1;
+    bench::measure("effects", fmt::format("chain={}", chain),
+        frames / (Rate / 1000.), [&] {
+          copy_n(left.begin() + position, frames, l.begin());
+          copy_n(right.begin() + position, frames, r.begin());
+          if (filter) {
+            effects.turn(Effects::Filter, notch = -notch);
+          }
+          effects.process(l.data(), r.data(), frames);
+          position = (position + frames) % (Rate - frames);
+          bench::keep(l);
+          bench::keep(r);
+        });
+  }
+}
+
+/// Recorder: finding the tempo of the input, fed 100ms at a time as the
+/// capture thread reads it. Items are seconds of audio, 1 / items_per_second
+/// is the share of a core the analysis takes.
+PS_BENCH(detectTempo)
+{
+  constexpr long chunk = Rate / 10;
+  auto signal = testSignal(Rate * 10, 2, 24);
+  TempoDetector detector(Rate, 24, nullptr);
+  auto time = c::steady_clock::now();
+  long position = 0;
+  bench::measure("detectTempo", "rate=48000", double(chunk) / Rate, [&] {
+    time += c::milliseconds(100);
+    detector.analyze(signal.data() + position * 2, 2, chunk, time);
+    position = (position + chunk) % (Rate * 10);
+  });
+}
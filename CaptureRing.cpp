@@ -0,0 +1,73 @@
+#include "CaptureRing.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+using namespace ps;
+using namespace std;
+
+CaptureRing::CaptureRing(int channels, long capacityFrames, long maxWriteFrames)
+  : _channels(channels)
+  , _capacity(capacityFrames)
+  , _maxWrite(maxWriteFrames)
+  , _size(capacityFrames + maxWriteFrames)
+    // value initialized, i.e. the pages are touched now rather than on the
+    // capture thread.
+  , _samples(_size * channels)
+{ }
+
+void CaptureRing::write(const int32_t* samples, long frames)
+{
+  PS_TRACE_SCOPE("CaptureRing::write");
+  uint64_t written = _written.load(memory_order_relaxed);
+  // Readers only allow for that much being written at once.
+  for (long done = 0; done < frames; done += _maxWrite) {
+    const long count = min(frames - done, _maxWrite);
+    const int32_t* from = samples + done * _channels;
+    long pos = written % _size;
+    long first = min(count, _size - pos);
+    copy(from, from + first * _channels, _samples.data() + pos * _channels);
+    copy(from + first * _channels, from + count * _channels, _samples.data());
+
+    written += count;
+    _written.store(written, memory_order_release);
+  }
+}
+
+long CaptureRing::copyLast(long frames, vector<int32_t>& out) const
+{
+  const uint64_t end = written();
+  uint64_t start = end - min<uint64_t>({uint64_t(frames), uint64_t(_capacity), end});
+  return copyFrom(start, end - start, out);
+}
+
+long CaptureRing::copyFrom(uint64_t& start, long frames, vector<int32_t>& out) const
+{
+  const uint64_t end = written();
+  if (start + _capacity < end) {
+    start = end - _capacity;
+  }
+  frames = min<uint64_t>(frames, end - start);
+
+  out.resize(frames * _channels);
+  long pos = start % _size;
+  long first = min(frames, _size - pos);
+  copy(_samples.data() + pos * _channels,
+       _samples.data() + (pos + first) * _channels,
+       out.data());
+  copy(_samples.data(), _samples.data() + (frames - first) * _channels,
+       out.data() + first * _channels);
+
+  // Anything the writer reached while we were copying is garbage, as is
+  // what the write in progress may be overwriting.
+  atomic_thread_fence(memory_order_acquire);
+  const uint64_t now = written();
+  if (now + _maxWrite > start + _size) {
+    long lost = min<uint64_t>(frames, now + _maxWrite - _size - start);
+    out.erase(out.begin(), out.begin() + lost * _channels);
+    start += lost;
+    frames -= lost;
+  }
+  start += frames;
+  return frames;
+}
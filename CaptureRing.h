@@ -0,0 +1,53 @@
+#pragma once
+
+/// \file The last seconds of captured audio, kept in memory.
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace ps
+{
+  /// Fixed size ring of interleaved frames, written by the capture thread
+  /// and read from any thread without locking.
+  ///
+  /// Everything is allocated by the constructor. Readers copy what they
+  /// need and then check that the writer did not come around in the
+  /// meantime, frames that were overwritten during the copy are dropped.
+  /// Those a write may be in the middle of are counted as overwritten too,
+  /// the ring holds one write more than can be read so that a full read is
+  /// never torn.
+  class CaptureRing
+  {
+  public:
+    /// `capacityFrames` can be read back, written at most `maxWriteFrames`
+    /// at a time.
+    CaptureRing(int channels, long capacityFrames, long maxWriteFrames);
+    CaptureRing(const CaptureRing&) = delete;
+
+    /// Capture thread only.
+    void write(const int32_t* samples, long frames);
+
+    /// Replace `out` with the last `frames` frames, or less if not that much
+    /// was captured yet. Returns the number of frames copied.
+    long copyLast(long frames, std::vector<int32_t>& out) const;
+    /// Same for up to `frames` frames from `start` (see `written`), which is
+    /// moved past them. Frames overwritten before they could be copied are
+    /// skipped, e.g. by a reader that fell behind.
+    long copyFrom(uint64_t& start, long frames, std::vector<int32_t>& out) const;
+
+    long capacity() const { return _capacity; }
+    int channels() const { return _channels; }
+
+    /// Frames written since the start, the last `capacity` can be read.
+    uint64_t written() const { return _written.load(std::memory_order_acquire); }
+
+  private:
+    int _channels;
+    long _capacity;
+    long _maxWrite;
+    long _size; // of the ring, a write more than the capacity
+    std::vector<int32_t> _samples;
+    std::atomic<uint64_t> _written = 0;
+  };
+}
@@ -1,5 +1,6 @@
 #include "Device.h"
 #include "Alsa.h"
+#include "Trace.h"
 
 #include <iostream>
 #include <thread>
@@ -19,33 +20,6 @@ namespace
   {
     return type == SND_SEQ_EVENT_NOTEON;
   }
-
-  snd_seq_addr_t findPort(snd_seq_t& seq, const string& portName)
-  {
-    snd_seq_client_info_t* cinfo = nullptr;
-    snd_seq_client_info_alloca(&cinfo);
-
-    snd_seq_port_info_t* pinfo = nullptr;
-    snd_seq_port_info_alloca(&pinfo);
-
-    snd_seq_client_info_set_client(cinfo, -1);
-    while (snd_seq_query_next_client(&seq, cinfo) >= 0) {
-      int client = snd_seq_client_info_get_client(cinfo);
-
-      snd_seq_port_info_set_client(pinfo, client);
-      snd_seq_port_info_set_port(pinfo, -1);
-      while (snd_seq_query_next_port(&seq, pinfo) >= 0) {
-        if (snd_seq_port_info_get_name(pinfo) == portName) {
-          return snd_seq_addr_t{
-            (uint8_t)snd_seq_port_info_get_client(pinfo),
-            (uint8_t)snd_seq_port_info_get_port(pinfo)
-          };
-        }
-      }
-    }
-
-    throw Exception("Could not find midi port {}", portName);
-  }
 }
 
 void ps::convertNote(atom::Note note, snd_seq_event& out)
@@ -82,7 +56,7 @@ Device::Device(const char* devicePortName)
   _hostPort = err;
   cerr << "Our port: [app]: " << _hostPort << '\n';
 
-  _deviceAddress = findPort(*_seq, devicePortName);
+  _deviceAddress = findSeqPort(*_seq, devicePortName);
   err = snd_seq_connect_from(_seq, _hostPort,
       _deviceAddress.client, _deviceAddress.port);
   if (err < 0) {
@@ -137,12 +111,9 @@ void Device::sendNotes(const vector<Note>& notes)
   for (auto& n: notes) {
     memset(&note, 0, sizeof(note));
     snd_seq_ev_set_direct(&note);
-    note.type = n.OnOff ? SND_SEQ_EVENT_NOTEON : SND_SEQ_EVENT_NOTEOFF;
     note.source.port = _hostPort;
     note.dest = _deviceAddress;
-    note.data.note.channel = n.Channel;
-    note.data.note.note = n.Note;
-    note.data.note.velocity = n.Velocity;
+    convertNote(n, note);
 
     int err = snd_seq_event_output_direct(_seq, &note);
     if (err < 0) {
@@ -180,6 +151,8 @@ bool Device::poll()
     throw DeviceFailure("Failed to get next event in poll");
   }
 
+  PS_TRACE_SCOPE("Device::poll");
+
   snd_seq_event_t* event = nullptr;
   do {
     // Note : should always have something since poll succeeded.
@@ -14,9 +14,6 @@
 
 namespace ps
 {
-  /// Fill-in an ALSA struct from our internal representation.
-  void convertNote(atom::Note, snd_seq_ev_note& out);
-
   /// Helper for erroring out fast.
   class DeviceInitError : public Exception
   {
@@ -31,6 +28,8 @@ namespace ps
     using Exception::Exception;
   };
 
+  /// Fill-in the type and note of an ALSA event from our internal
+  /// representation.
   void convertNote(atom::Note note, snd_seq_event& out);
 
   /// Talk to an Atom device, gives callbacks to a synth if given
@@ -0,0 +1,274 @@
+#include "Effects.h"
+#include "Simd.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  // Below half a notch of the knob the filter is off.
+  constexpr float FilterOff = 1.f / 64;
+  // Of the echoes, at full amount.
+  constexpr float MaxFeedback = 0.7f;
+  // Note lengths of the delay, in whole notes.
+  constexpr float Notes[] = {
+    1.f / 16, 1.f / 8, 3.f / 16, 1.f / 4, 3.f / 8, 1.f / 2, 3.f / 4, 1.f};
+  constexpr int NoteCount = sizeof(Notes) / sizeof(Notes[0]);
+
+  /// Left and right in the lanes of one vector (a d register on the Pi).
+  using Stereo = float __attribute__((vector_size(2 * sizeof(float))));
+
+  /// Cutoff of the filter for a knob position, exponential so that each
+  /// notch sounds the same.
+  float cutoff(float position, int rate)
+  {
+    const float hz = position < 0 ?
+        20000.f * pow(40.f / 20000.f, -position) :
+        20.f * pow(10000.f / 20.f, position);
+    return min(hz, 0.45f * rate);
+  }
+
+  simd::Floats iota()
+  {
+    simd::Floats result;
+    for (int i = 0; i < simd::Lanes; ++i) {
+      result[i] = i;
+    }
+    return result;
+  }
+}
+
+const array<Effects::ParamInfo, Effects::ParamCount> Effects::Params = {{
+  {.Name = "filter", .Min = -1, .Max = 1, .Default = 0, .Step = 1.f / 32},
+  {.Name = "resonance", .Min = 0, .Max = 1, .Default = 0.2f, .Step = 1.f / 32},
+  {.Name = "delay time", .Min = 0, .Max = 1, .Default = 3.f / (NoteCount - 1),
+    .Step = 1.f / (NoteCount - 1)},
+  {.Name = "delay", .Min = 0, .Max = 1, .Default = 0, .Step = 1.f / 32},
+}};
+
+Effects::Effects(int rate, float tempo)
+  : _rate(rate)
+  , _tempo(tempo)
+{
+  for (int p = 0; p < ParamCount; ++p) {
+    _targets[p] = Params[p].Default;
+    _current[p] = Params[p].Default;
+  }
+  for (auto& ring: _ring) {
+    ring.resize(size_t(MaxDelaySeconds) * rate);
+  }
+  _delayFresh = _ring[0].size();
+}
+
+void Effects::set(Param p, float value)
+{
+  _targets[p].store(
+      clamp(value, Params[p].Min, Params[p].Max), memory_order_relaxed);
+}
+
+float Effects::turn(Param p, int notches)
+{
+  set(p, get(p) + notches * Params[p].Step);
+  return get(p);
+}
+
+void Effects::setTempo(float bpm)
+{
+  if (bpm > 0) {
+    _tempo.store(bpm, memory_order_relaxed);
+  }
+}
+
+long Effects::delayFrames(float time) const
+{
+  const int note = clamp(int(lround(time * (NoteCount - 1))), 0, NoteCount - 1);
+  const float beat = 60.f / _tempo.load(memory_order_relaxed);
+  return min(long(Notes[note] * 4 * beat * _rate), long(_ring[0].size()) - 1);
+}
+
+void Effects::process(float* left, float* right, long frames)
+{
+  array<float, ParamCount> targets;
+  for (int p = 0; p < ParamCount; ++p) {
+    targets[p] = _targets[p].load(memory_order_relaxed);
+  }
+  const bool filtering =
+      abs(_current[Filter]) >= FilterOff or abs(targets[Filter]) >= FilterOff;
+  const bool delaying =
+      _current[DelayAmount] > 0 or targets[DelayAmount] > 0 or
+      _delayFresh < long(_ring[0].size());
+  if (not filtering and not delaying) {
+    _current = targets;
+    return;
+  }
+
+  PS_TRACE_SCOPE("Effects::process");
+  if (filtering) {
+    // Going from low pass to high pass at once would click, this block only
+    // opens the filter, the next one starts the other side.
+    float position = targets[Filter];
+    if (_current[Filter] * position < 0) {
+      position = 0;
+    }
+    filter(left, right, frames, position, targets[Resonance]);
+    _current[Filter] = position;
+  }
+  else {
+    _low[0] = _low[1] = _band[0] = _band[1] = 0;
+    _current[Filter] = targets[Filter];
+  }
+  _current[Resonance] = targets[Resonance];
+
+  if (delaying) {
+    delay(left, right, frames,
+        max(delayFrames(targets[DelayTime]), frames), targets[DelayAmount]);
+  }
+  _current[DelayTime] = targets[DelayTime];
+  _current[DelayAmount] = targets[DelayAmount];
+}
+
+void Effects::filter(
+    float* left, float* right, long frames, float position, float resonance)
+{
+  // Both ends of the block, the coefficients are ramped in between.
+  float from = _current[Filter];
+  const bool high = from > 0 or (from == 0 and position > 0);
+  // Turning on or off crossfades with the dry signal over the block, from
+  // or to wide open. The state left by the other side is no use then.
+  const float dryFrom = abs(from) < FilterOff ? 1 : 0;
+  const float dryTo = abs(position) < FilterOff ? 1 : 0;
+  if (dryFrom == 1) {
+    from = high ? FilterOff : -FilterOff;
+    _low[0] = _low[1] = _band[0] = _band[1] = 0;
+  }
+  if (dryTo == 1) {
+    position = high ? FilterOff : -FilterOff;
+  }
+  auto coefficient = [this](float position) {
+    return tan(float(M_PI) * cutoff(position, _rate) / _rate);
+  };
+  auto damping = [](float resonance) {
+    return float(M_SQRT2) * pow(0.07f, resonance); // Q from 0.7 to 10
+  };
+  float g = coefficient(from);
+  float k = damping(_current[Resonance]);
+  const float gStep = (coefficient(position) - g) / frames;
+  const float kStep = (damping(resonance) - k) / frames;
+  float dry = dryFrom;
+  const float dryStep = (dryTo - dryFrom) / frames;
+
+  Stereo low = {_low[0], _low[1]};
+  Stereo band = {_band[0], _band[1]};
+  for (long i = 0; i < frames; ++i) {
+    const float h = 1.f / (1.f + g * (g + k));
+    const Stereo in = {left[i], right[i]};
+    const Stereo hp = (in - (k + g) * band - low) * h;
+    const Stereo v1 = g * hp;
+    const Stereo bp = v1 + band;
+    band = bp + v1;
+    const Stereo v2 = g * bp;
+    const Stereo lp = v2 + low;
+    low = lp + v2;
+    const Stereo wet = high ? hp : lp;
+    const Stereo out = wet + (in - wet) * dry;
+    left[i] = out[0];
+    right[i] = out[1];
+    g += gStep;
+    k += kStep;
+    dry += dryStep;
+  }
+  _low[0] = low[0];
+  _low[1] = low[1];
+  _band[0] = band[0];
+  _band[1] = band[1];
+}
+
+void Effects::delay(
+    float* left, float* right, long frames, long length, float amount)
+{
+  const long size = _ring[0].size();
+  const float from = _current[DelayAmount];
+  if (from == 0 and amount == 0) {
+    // The echoes were cut, they do not come back when turned on again. The
+    // rings are seconds long, clearing them at once could miss the period:
+    // silence is written as the echoes would be, and as much again behind
+    // what was written.
+    const long behind = clamp(size - _delayFresh - frames, 0l, frames);
+    clearRings(_write, frames);
+    clearRings((_write - _delayFresh - behind + 2 * size) % size, behind);
+    _write = (_write + frames) % size;
+    _delayFresh = min(size, _delayFresh + frames + behind);
+    return;
+  }
+  // Turned on again before the rings were clear, what is about to be read
+  // of what is left is cleared first.
+  auto clearStale = [&](long back) {
+    const long stale = min(frames, back - _delayFresh);
+    if (stale > 0) {
+      clearRings((_write - back + size) % size, stale);
+    }
+  };
+  clearStale(length);
+  clearStale(_delayFrames > 0 ? _delayFrames : length);
+
+  // A new delay time crossfades from the echoes at the previous one over
+  // the block. Both are at least a block long, what is read never overlaps
+  // what is written.
+  const long previous = _delayFrames > 0 ? _delayFrames : length;
+  _delayFrames = length;
+  const float perFrame = 1.f / frames;
+  const simd::Floats lanes = iota();
+  float* outs[2] = {left, right};
+
+  long done = 0;
+  while (done < frames) {
+    const long w = (_write + done) % size;
+    const long r = (w - length + size) % size;
+    const long r0 = (w - previous + size) % size;
+    const long count = min({frames - done, size - w, size - r, size - r0});
+    for (int c = 0; c < 2; ++c) {
+      float* ring = _ring[c].data();
+      float* out = outs[c] + done;
+      // Both the amount and the crossfade ramp over the block.
+      auto kernel = [&](auto t, auto in, auto before, auto after) {
+        auto gain = from + (amount - from) * t;
+        auto echo = before + (after - before) * t;
+        return std::pair(in + gain * echo, in + MaxFeedback * gain * echo);
+      };
+      long i = 0;
+      for (; i + simd::Lanes <= count; i += simd::Lanes) {
+        const simd::Floats t =
+            (simd::broadcast(done + i) + lanes) * simd::broadcast(perFrame);
+        auto [y, fed] = kernel(t, simd::load(out + i),
+            simd::load(ring + r0 + i), simd::load(ring + r + i));
+        simd::store(ring + w + i, fed);
+        simd::store(out + i, y);
+      }
+      for (; i < count; ++i) {
+        const float t = (done + i) * perFrame;
+        auto [y, fed] = kernel(t, out[i], ring[r0 + i], ring[r + i]);
+        ring[w + i] = fed;
+        out[i] = y;
+      }
+    }
+    done += count;
+  }
+  _write = (_write + frames) % size;
+  // Faded out, all that is in the rings is to be cleared.
+  _delayFresh = amount > 0 ? min(size, _delayFresh + frames) : 0;
+}
+
+void Effects::clearRings(long from, long count)
+{
+  const long size = _ring[0].size();
+  const long first = min(count, size - from);
+  for (auto& ring: _ring) {
+    fill_n(ring.begin() + from, first, 0.f);
+    fill_n(ring.begin(), count - first, 0.f);
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+/// \file Insert effects on the main output of the player, played with the
+/// knobs of the ATOM.
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace ps
+{
+  /// A DJ style filter (low pass one way, high pass the other) followed by a
+  /// delay synced to the tempo, on planar stereo blocks.
+  ///
+  /// Parameters can be set from any thread, the playing thread reads them
+  /// once per block and ramps to them over the block so that turning a knob
+  /// does not click. Everything is allocated by the constructor.
+  class Effects
+  {
+  public:
+    enum Param
+    {
+      /// -1 for the lowest low pass, 1 for the highest high pass, 0 is off.
+      Filter,
+      /// 0 to 1, from flat to ringing.
+      Resonance,
+      /// 0 to 1, picks a note length from a 16th to a whole note.
+      DelayTime,
+      /// 0 to 1, both how loud the echoes are and how long they last. 0 is
+      /// off.
+      DelayAmount,
+      ParamCount
+    };
+
+    struct ParamInfo
+    {
+      const char* Name;
+      float Min;
+      float Max;
+      float Default;
+      float Step; // per notch of a knob
+    };
+    static const std::array<ParamInfo, ParamCount> Params;
+
+    /// The longest delay, longer notes are cut to it at slow tempos.
+    static constexpr int MaxDelaySeconds = 3;
+
+    Effects(int rate, float tempo);
+    Effects(const Effects&) = delete;
+
+    /// Any thread.
+    float get(Param p) const { return _targets[p].load(std::memory_order_relaxed); }
+    /// Any thread, clamped to the range of the parameter.
+    void set(Param, float value);
+    /// Moves the parameter by `notches` of a knob, returns the new value.
+    float turn(Param, int notches);
+    /// Any thread, in beats per minute, for the delay.
+    void setTempo(float bpm);
+    /// Any thread, as last set.
+    float tempo() const { return _tempo.load(std::memory_order_relaxed); }
+
+    /// Playing thread only, in place.
+    void process(float* left, float* right, long frames);
+
+  private:
+    /// Zero delay feedback state variable filter, both channels at once.
+    void filter(float* left, float* right, long frames, float position,
+        float resonance);
+    /// Echoes `length` frames back, crossfaded from the previous length if
+    /// it changed.
+    void delay(float* left, float* right, long frames, long length,
+        float amount);
+    /// Zeroes `count` frames of the rings from `from`, around their end.
+    void clearRings(long from, long count);
+    long delayFrames(float time) const;
+
+    const int _rate;
+    std::array<std::atomic<float>, ParamCount> _targets;
+    std::atomic<float> _tempo;
+
+    // --------- members below must be accessed in the thread only ---------- //
+    std::array<float, ParamCount> _current; // where the last block ended
+    float _low[2] = {0, 0};  // filter state per channel
+    float _band[2] = {0, 0};
+    std::vector<float> _ring[2]; // delay lines, per channel
+    long _write = 0;             // in the rings
+    long _delayFrames = 0;       // of the last block
+    // The last frames written to the rings, those before are left from
+    // before the delay was cut and read as silence. All of them when clean.
+    long _delayFresh = 0;
+    // ---------------------------------------------------------------------- //
+  };
+}
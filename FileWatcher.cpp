@@ -0,0 +1,127 @@
+#include "FileWatcher.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace ps;
+using namespace std;
+namespace c = std::chrono;
+namespace fs = std::filesystem;
+
+namespace
+{
+  auto logger = Log("WATCH");
+
+  /// Editors write in several steps, waiting for them to be done.
+  constexpr auto Quiet = c::milliseconds(300);
+
+  fs::path normalize(const fs::path& path)
+  {
+    return fs::absolute(path).lexically_normal();
+  }
+}
+
+FileWatcher::FileWatcher(Callback onChange)
+  : _onChange(move(onChange))
+{
+  _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (_fd < 0) {
+    logger.throw_("Could not initialize inotify: {}", strerror(errno));
+  }
+  _thread = thread([this] { run(); });
+}
+
+FileWatcher::~FileWatcher()
+{
+  _stop = true;
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+  close(_fd);
+}
+
+void FileWatcher::watch(const vector<fs::path>& files)
+{
+  set<fs::path> directories;
+  set<fs::path> normalized;
+  for (auto& file: files) {
+    auto path = normalize(file);
+    directories.insert(path.parent_path());
+    normalized.insert(move(path));
+  }
+
+  lock_guard lock(_mutex);
+  _files = move(normalized);
+  for (auto it = _directories.begin(); it != _directories.end();) {
+    if (directories.erase(it->second) == 0) {
+      inotify_rm_watch(_fd, it->first);
+      it = _directories.erase(it);
+    }
+    else {
+      ++it; // still watched
+    }
+  }
+  for (auto& directory: directories) {
+    int wd = inotify_add_watch(_fd, directory.c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+    if (wd < 0) {
+      logger.warn("Not watching {}: {}", directory, strerror(errno));
+      continue;
+    }
+    _directories[wd] = directory;
+  }
+}
+
+void FileWatcher::run()
+{
+  trace::setThreadName("watch");
+
+  // Aligned as inotify_event requires.
+  alignas(inotify_event) char buffer[4096];
+  set<fs::path> changed;
+  c::steady_clock::time_point lastEvent;
+
+  while (not _stop) {
+    pollfd fds = {.fd = _fd, .events = POLLIN, .revents = 0};
+    int res = poll(&fds, 1, 100 /*ms*/);
+    if (res < 0 and errno != EINTR) {
+      logger.error("Stopping to watch files, poll failed: {}", strerror(errno));
+      return;
+    }
+
+    ssize_t length;
+    while ((length = read(_fd, buffer, sizeof(buffer))) > 0) {
+      lock_guard lock(_mutex);
+      for (char* p = buffer; p < buffer + length;) {
+        auto event = reinterpret_cast<inotify_event*>(p);
+        p += sizeof(inotify_event) + event->len;
+
+        auto directory = _directories.find(event->wd);
+        if (directory == _directories.end() or event->len == 0) {
+          continue;
+        }
+        auto path = directory->second / event->name;
+        if (_files.count(path) != 0) {
+          changed.insert(move(path));
+          lastEvent = c::steady_clock::now();
+        }
+      }
+    }
+
+    if (not changed.empty() and c::steady_clock::now() - lastEvent > Quiet) {
+      vector<fs::path> files(changed.begin(), changed.end());
+      changed.clear();
+      try {
+        _onChange(files);
+      }
+      catch (const exception& ex) {
+        logger.error("Failed to handle changes to {}: {}", files[0], ex.what());
+      }
+    }
+  }
+}
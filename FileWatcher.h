@@ -0,0 +1,50 @@
+#pragma once
+
+/// \file Notifications when files change on disk.
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  /// Watches a set of files with inotify, from its own thread.
+  ///
+  /// Directories are watched rather than the files themselves so that
+  /// editors saving to a temporary file and renaming it are noticed too.
+  /// Events are gathered until things are quiet for a moment, `onChange`
+  /// is then called once with every file that changed.
+  class FileWatcher
+  {
+  public:
+    using Callback =
+        std::function<void(const std::vector<std::filesystem::path>&)>;
+
+    explicit FileWatcher(Callback onChange);
+    FileWatcher(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    /// Replace the files watched, can be called from `onChange`.
+    void watch(const std::vector<std::filesystem::path>& files);
+
+  private:
+    void run();
+
+    Callback _onChange;
+    int _fd = -1;
+    std::atomic<bool> _stop = false;
+
+    std::mutex _mutex;
+    // ---------- members below must be accessed under the mutex ------------ //
+    std::map<int, std::filesystem::path> _directories; // per watch descriptor
+    std::set<std::filesystem::path> _files;
+    // ---------------------------------------------------------------------- //
+
+    std::thread _thread;
+  };
+}
@@ -0,0 +1,263 @@
+#include "FileWriter.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("FILE");
+
+  /// Enough for O_DIRECT on anything we may write to.
+  constexpr size_t Alignment = 4096;
+
+  void pwriteAll(
+      int fd, const uint8_t* data, size_t size, uint64_t offset,
+      const string& fileName)
+  {
+    while (size > 0) {
+      auto res = ::pwrite(fd, data, size, offset);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        logger.throw_("Failed to write to {}: {}", fileName, strerror(errno));
+      }
+      data += res;
+      size -= res;
+      offset += res;
+    }
+  }
+}
+
+FileWriter::FileWriter(const string& fileName, const Options& options)
+  : _fileName(fileName)
+  , _options(options)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  _fd = ::open(fileName.c_str(), flags | (_options.Direct ? O_DIRECT : 0), 0644);
+  if (_fd < 0 and _options.Direct and errno == EINVAL) {
+    logger.warn("O_DIRECT is not supported for {}, using the page cache",
+        fileName);
+    _options.Direct = false;
+    _fd = ::open(fileName.c_str(), flags, 0644);
+  }
+  if (_fd < 0) {
+    logger.throw_("Could not open {} for writing: {}", fileName, strerror(errno));
+  }
+
+  for (Buffer* buffer: {&_fill, &_spare}) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, Alignment, BufferSize) != 0) {
+      ::close(_fd);
+      logger.throw_("Out of memory allocating write buffers");
+    }
+    buffer->reset(static_cast<uint8_t*>(memory));
+  }
+
+  _thread = thread([this] { run(); });
+}
+
+FileWriter::~FileWriter()
+{
+  try {
+    close();
+  }
+  catch (const exception& ex) {
+    logger.error("{}", ex.what());
+  }
+}
+
+void FileWriter::write(const void* data, size_t size)
+{
+  auto bytes = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    size_t count = min(size, BufferSize - _fillSize);
+    memcpy(_fill.get() + _fillSize, bytes, count);
+    _fillSize += count;
+    bytes += count;
+    size -= count;
+    if (_fillSize == BufferSize) {
+      submit();
+    }
+  }
+}
+
+void FileWriter::submit()
+{
+  {
+    unique_lock lock(_mutex);
+    // Only waits if the disk is slower than we produce data, 1MB is many
+    // seconds of audio.
+    _cond.wait(lock, [this] { return _pending == nullptr; });
+    if (not _error.empty()) {
+      logger.throw_("{}", _error);
+    }
+    _pending = move(_fill);
+    _pendingOffset = _submitted;
+    _fill = move(_spare);
+  }
+  _cond.notify_all();
+  _submitted += BufferSize;
+  _fillSize = 0;
+}
+
+void FileWriter::wait()
+{
+  unique_lock lock(_mutex);
+  _cond.wait(lock, [this] { return _pending == nullptr; });
+  if (not _error.empty()) {
+    logger.throw_("{}", _error);
+  }
+}
+
+void FileWriter::dropDirect()
+{
+  // Unaligned writes are not possible with O_DIRECT, those only happen at
+  // the end of a recording.
+  if (_options.Direct) {
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+    _options.Direct = false;
+  }
+}
+
+void FileWriter::writeAt(uint64_t offset, const void* data, size_t size)
+{
+  if (offset + size > this->size()) {
+    logger.throw_("Writing past the end of {}", _fileName);
+  }
+
+  auto bytes = static_cast<const uint8_t*>(data);
+  if (offset < _submitted) {
+    wait(); // for the thread to be done with that part of the file
+    dropDirect();
+    size_t count = min<uint64_t>(size, _submitted - offset);
+    pwriteAll(_fd, bytes, count, offset, _fileName);
+    bytes += count;
+    size -= count;
+    offset += count;
+  }
+  // Whatever is still in the buffer is patched there.
+  if (size > 0) {
+    memcpy(_fill.get() + (offset - _submitted), bytes, size);
+  }
+}
+
+void FileWriter::close()
+{
+  if (_fd < 0) {
+    return;
+  }
+
+  {
+    lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _cond.notify_all();
+  _thread.join();
+
+  int fd = _fd;
+  _fd = -1;
+  try {
+    if (not _error.empty()) {
+      logger.throw_("{}", _error);
+    }
+    dropDirect();
+    pwriteAll(fd, _fill.get(), _fillSize, _submitted, _fileName);
+  }
+  catch (...) {
+    ::close(fd);
+    throw;
+  }
+  _submitted += _fillSize;
+  _fillSize = 0;
+
+  if (_allocated > _submitted) {
+    // Give back what was reserved past the end.
+    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        _submitted, _allocated - _submitted);
+  }
+  if (::close(fd) != 0) {
+    logger.throw_("Failed to close {}: {}", _fileName, strerror(errno));
+  }
+}
+
+void FileWriter::run()
+{
+  trace::setThreadName("write");
+  while (true) {
+    const uint8_t* data = nullptr;
+    uint64_t offset = 0;
+    {
+      unique_lock lock(_mutex);
+      _cond.wait(lock, [this] { return _stop or _pending != nullptr; });
+      if (_pending == nullptr) {
+        return; // stopping
+      }
+      data = _pending.get();
+      offset = _pendingOffset;
+    }
+
+    string error;
+    try {
+      writeBlock(data, BufferSize, offset);
+    }
+    catch (const exception& ex) {
+      error = ex.what();
+    }
+
+    {
+      lock_guard lock(_mutex);
+      if (_error.empty()) {
+        _error = move(error);
+      }
+      _spare = move(_pending);
+    }
+    _cond.notify_all();
+  }
+}
+
+void FileWriter::writeBlock(const uint8_t* data, size_t size, uint64_t offset)
+{
+  PS_TRACE_SCOPE("FileWriter::writeBlock");
+  const uint64_t end = offset + size;
+
+  if (_options.Preallocate > 0 and end > _allocated) {
+    // KEEP_SIZE so that the file looks right if we never get to close it.
+    if (fallocate(_fd, FALLOC_FL_KEEP_SIZE, _allocated, _options.Preallocate) == 0) {
+      _allocated += _options.Preallocate;
+    }
+    else {
+      logger.warn("Cannot preallocate {} ({}), disabling it", _fileName,
+          strerror(errno));
+      _options.Preallocate = 0;
+    }
+  }
+
+  pwriteAll(_fd, data, size, offset, _fileName);
+
+  if (_options.SyncEvery > 0 and not _options.Direct and
+      end - _syncStarted >= _options.SyncEvery)
+  {
+    // The previous range had a whole SyncEvery worth of time to be written,
+    // waiting on it is usually free and bounds the dirty pages to about
+    // 2 * SyncEvery. Recordings are not read back, so drop them from the
+    // cache as well.
+    if (_syncStarted > _syncDone) {
+      sync_file_range(_fd, _syncDone, _syncStarted - _syncDone,
+          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+          SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(_fd, _syncDone, _syncStarted - _syncDone,
+          POSIX_FADV_DONTNEED);
+      _syncDone = _syncStarted;
+    }
+    sync_file_range(_fd, _syncStarted, end - _syncStarted, SYNC_FILE_RANGE_WRITE);
+    _syncStarted = end;
+  }
+}
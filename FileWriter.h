@@ -0,0 +1,98 @@
+#pragma once
+
+/// \file Write files in big blocks, for recordings.
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace ps
+{
+  /// Buffers writes and hands them to the kernel `BufferSize` bytes at a
+  /// time from a background thread, which SD cards like much better than
+  /// many small writes, and which keeps slow writes off the caller's thread.
+  ///
+  /// Buffers are aligned and written at aligned offsets so that O_DIRECT can
+  /// be used. The file is preallocated ahead of the writes and writeback is
+  /// started regularly so that dirty pages never pile up into a long flush.
+  ///
+  /// Throws on errors, errors of the background thread are thrown by the
+  /// next call.
+  class FileWriter
+  {
+  public:
+    static constexpr size_t BufferSize = 1 << 20;
+
+    struct Options
+    {
+      /// Space reserved with fallocate ahead of the writes, 0 to disable.
+      uint64_t Preallocate = 64 << 20;
+      /// Bypass the page cache (O_DIRECT).
+      bool Direct = false;
+      /// Start writeback every that many bytes, and wait for the previous
+      /// range to be on disk. 0 to leave it to the kernel.
+      uint64_t SyncEvery = 4 << 20;
+    };
+
+    FileWriter(const std::string& fileName, const Options& options);
+    FileWriter(const FileWriter&) = delete;
+    /// Flushes and closes, errors are only logged.
+    ~FileWriter();
+
+    void write(const void* data, size_t size);
+
+    /// Overwrite bytes already written (headers), `offset` + `size` must not
+    /// be past what was given to write.
+    void writeAt(uint64_t offset, const void* data, size_t size);
+
+    /// Bytes given to write so far.
+    uint64_t size() const { return _submitted + _fillSize; }
+
+    /// Write what is buffered and close the file.
+    void close();
+
+    const std::string& fileName() const { return _fileName; }
+
+  private:
+    struct FreeDeleter
+    {
+      void operator()(uint8_t* p) { free(p); }
+    };
+    using Buffer = std::unique_ptr<uint8_t, FreeDeleter>;
+
+    void submit();
+    void wait();
+    void run();
+    void writeBlock(const uint8_t* data, size_t size, uint64_t offset);
+    void dropDirect();
+
+    std::string _fileName;
+    Options _options;
+    int _fd = -1;
+
+    // Used by the calling thread only.
+    Buffer _fill;
+    size_t _fillSize = 0;
+    uint64_t _submitted = 0;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    // ---------- members below must be accessed under the mutex ------------ //
+    Buffer _pending; // given to the thread, moved to _spare once written
+    Buffer _spare;
+    uint64_t _pendingOffset = 0;
+    std::string _error;
+    bool _stop = false;
+    // ---------------------------------------------------------------------- //
+
+    // Used by the background thread only (or once it is idle).
+    uint64_t _allocated = 0;
+    uint64_t _syncStarted = 0; // writeback was started up to there
+    uint64_t _syncDone = 0;    // and is known complete up to there
+  };
+}
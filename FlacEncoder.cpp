@@ -0,0 +1,443 @@
+#include "FlacEncoder.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+using namespace ps;
+using namespace std;
+namespace c = std::chrono;
+
+namespace
+{
+  auto logger = Log("FLAC");
+
+  /// Blocks per chunk given to a worker. Large enough to amortize the
+  /// encoder setup, small enough to not keep too much audio in flight.
+  constexpr long BlocksPerChunk = 16;
+
+  /// Size of "fLaC", the metadata block header and STREAMINFO.
+  constexpr long HeaderSize = 4 + 4 + 34;
+
+  template <class T, T Poly>
+  constexpr array<T, 256> crcTable()
+  {
+    array<T, 256> table = {};
+    constexpr int shift = sizeof(T) * 8 - 8;
+    constexpr T top = T(1) << (sizeof(T) * 8 - 1);
+    for (unsigned i = 0; i < 256; ++i) {
+      T crc = T(i << shift);
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & top) ? T((crc << 1) ^ Poly) : T(crc << 1);
+      }
+      table[i] = crc;
+    }
+    return table;
+  }
+
+  // Polynomials from the FLAC format specification.
+  constexpr auto crc8Table  = crcTable<uint8_t,  0x07>();
+  constexpr auto crc16Table = crcTable<uint16_t, 0x8005>();
+
+  uint8_t crc8(const uint8_t* data, size_t size)
+  {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+      crc = crc8Table[crc ^ data[i]];
+    }
+    return crc;
+  }
+
+  uint16_t crc16(const uint8_t* data, size_t size)
+  {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+      crc = uint16_t(crc << 8) ^ crc16Table[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+  }
+
+  /// FLAC codes frame numbers like UTF-8, extended to 31 bits.
+  void appendUtf8(vector<uint8_t>& out, uint32_t value)
+  {
+    if (value < 0x80) {
+      out.push_back(uint8_t(value));
+      return;
+    }
+    int extra = value < 0x800     ? 1 :
+                value < 0x10000   ? 2 :
+                value < 0x200000  ? 3 :
+                value < 0x4000000 ? 4 : 5;
+    uint8_t lead = uint8_t(0xff00 >> (extra + 1));
+    out.push_back(lead | uint8_t(value >> (6 * extra)));
+    for (int i = extra - 1; i >= 0; --i) {
+      out.push_back(0x80 | ((value >> (6 * i)) & 0x3f));
+    }
+  }
+
+  size_t utf8Size(uint8_t lead)
+  {
+    size_t size = 0;
+    while (size < 8 and (lead & (0x80 >> size))) {
+      ++size;
+    }
+    return max<size_t>(size, 1);
+  }
+
+  /// Copy the frame `in` to `out`, giving it the frame number `number`.
+  /// See https://xiph.org/flac/format.html#frame_header
+  void renumberFrame(
+      const uint8_t* in, size_t size, uint32_t number, vector<uint8_t>& out)
+  {
+    out.clear();
+    // sync code, blocking strategy, block size & sample rate codes, channels &
+    // sample size.
+    out.insert(end(out), in, in + 4);
+    appendUtf8(out, number);
+
+    size_t pos = 4 + utf8Size(in[4]);
+    size_t optional = 0;
+    int blocksizeCode = in[2] >> 4;
+    int rateCode = in[2] & 0xf;
+    if (blocksizeCode == 6) optional += 1;
+    if (blocksizeCode == 7) optional += 2;
+    if (rateCode == 12) optional += 1;
+    if (rateCode == 13 or rateCode == 14) optional += 2;
+    out.insert(end(out), in + pos, in + pos + optional);
+    pos += optional;
+    out.push_back(crc8(out.data(), out.size()));
+    ++pos; // old crc-8
+
+    // subframes, without the old crc-16
+    out.insert(end(out), in + pos, in + size - 2);
+    uint16_t crc = crc16(out.data(), out.size());
+    out.push_back(uint8_t(crc >> 8));
+    out.push_back(uint8_t(crc));
+  }
+
+  /// Packs values MSB first, as all FLAC metadata.
+  struct BitWriter
+  {
+    uint8_t* Out;
+    int Bit = 0;
+
+    void put(uint64_t value, int bits)
+    {
+      for (int i = bits - 1; i >= 0; --i, ++Bit) {
+        if ((value >> i) & 1) {
+          Out[Bit / 8] |= uint8_t(0x80 >> (Bit % 8));
+        }
+      }
+    }
+  };
+}
+
+void ps::configure(FLAC__StreamEncoder* enc, const FlacSettings& settings)
+{
+  FLAC__stream_encoder_set_channels(enc, settings.Channels);
+  FLAC__stream_encoder_set_bits_per_sample(enc, settings.Bits);
+  FLAC__stream_encoder_set_sample_rate(enc, settings.Rate);
+  // The level sets many other values, so it goes first.
+  FLAC__stream_encoder_set_compression_level(enc, settings.Level);
+  if (settings.Blocksize > 0) {
+    FLAC__stream_encoder_set_blocksize(enc, settings.Blocksize);
+    // Players are fine with bigger blocks but libFLAC refuses to init.
+    FLAC__stream_encoder_set_streamable_subset(enc,
+        settings.Blocksize <= 4608 or settings.Rate > 48000);
+  }
+  if (not settings.Apodization.empty()) {
+    FLAC__stream_encoder_set_apodization(enc, settings.Apodization.c_str());
+  }
+}
+
+ParallelFlacEncoder::ParallelFlacEncoder(
+    const string& fileName, const FlacSettings& settings,
+    const FileWriter::Options& options)
+  : _settings(settings)
+    // Same as what libFLAC picks for each level.
+  , _blocksize(settings.Blocksize > 0 ? settings.Blocksize :
+               settings.Level <= 2 ? 1152 : 4096)
+  , _chunkFrames(_blocksize * BlocksPerChunk)
+{
+  _settings.Blocksize = _blocksize;
+  _settings.Threads = max(1, _settings.Threads);
+
+  _file = make_unique<FileWriter>(fileName, options);
+  // Filled on finish, when we know the size of everything.
+  array<uint8_t, HeaderSize> header = {};
+  _file->write(header.data(), header.size());
+
+  // Two chunks per worker so that one can be filled while the other is
+  // encoded, one more for the chunk being filled by process.
+  for (int i = 0; i < _settings.Threads * 2 + 1; ++i) {
+    auto chunk = make_unique<Chunk>();
+    chunk->Samples.resize(_chunkFrames * _settings.Channels);
+    // FLAC can be a bit bigger than the input for noise, frames have headers.
+    chunk->Encoded.reserve(_chunkFrames * _settings.Channels * 4);
+    chunk->FrameSizes.reserve(BlocksPerChunk);
+    _free.push_back(chunk.get());
+    _chunks.push_back(move(chunk));
+  }
+
+  for (int i = 0; i < _settings.Threads; ++i) {
+    _workers.emplace_back([this] { work(); });
+  }
+}
+
+ParallelFlacEncoder::~ParallelFlacEncoder()
+{
+  try {
+    finish();
+  }
+  catch (const exception& ex) {
+    logger.error("Failed to finish encoding: {}", ex.what());
+  }
+}
+
+void ParallelFlacEncoder::process(const int32_t* samples, long frames)
+{
+  const int channels = _settings.Channels;
+  while (frames > 0) {
+    if (_current == nullptr) {
+      unique_lock lock(_mutex);
+      if (_free.empty()) {
+        ++_waits;
+        _cond.wait(lock, [this] { return not _free.empty(); });
+      }
+      _current = _free.back();
+      _free.pop_back();
+      _current->Frames = 0;
+    }
+
+    long count = min(frames, _chunkFrames - _current->Frames);
+    copy(samples, samples + count * channels,
+         _current->Samples.data() + _current->Frames * channels);
+    _current->Frames += count;
+    samples += count * channels;
+    frames -= count;
+
+    if (_current->Frames == _chunkFrames) {
+      submit();
+    }
+  }
+}
+
+void ParallelFlacEncoder::submit()
+{
+  _current->Index = _nextIndex++;
+  {
+    lock_guard lock(_mutex);
+    _todo.push_back(_current);
+  }
+  _current = nullptr;
+  _cond.notify_all();
+}
+
+void ParallelFlacEncoder::finish()
+{
+  if (_file == nullptr) {
+    return;
+  }
+
+  if (_current != nullptr) {
+    if (_current->Frames > 0) {
+      submit();
+    }
+    else {
+      lock_guard lock(_mutex);
+      _free.push_back(_current);
+      _current = nullptr;
+    }
+  }
+
+  {
+    unique_lock lock(_mutex);
+    _cond.wait(lock, [this] { return _nextToWrite == _nextIndex; });
+    _stop = true;
+  }
+  _cond.notify_all();
+  for (auto& worker: _workers) {
+    worker.join();
+  }
+  _workers.clear();
+
+  if (_waits > 0) {
+    logger.warn("Waited {} times for the encoders, they are not keeping up. "
+        "Use more threads or a lower compression level.", _waits);
+  }
+
+  writeStreamInfo();
+  bool closeError = false;
+  try {
+    _file->close();
+  }
+  catch (const exception& ex) {
+    logger.error("{}", ex.what());
+    closeError = true;
+  }
+  _file.reset();
+  if (_writeError or closeError) {
+    logger.throw_("Errors while writing the FLAC file, it is likely "
+        "incomplete");
+  }
+}
+
+c::nanoseconds ParallelFlacEncoder::encodeTime()
+{
+  lock_guard lock(_mutex);
+  return _encodeTime;
+}
+
+void ParallelFlacEncoder::work()
+{
+  trace::setThreadName("flac");
+  FlacPtr enc(FLAC__stream_encoder_new());
+
+  while (true) {
+    Chunk* chunk = nullptr;
+    {
+      unique_lock lock(_mutex);
+      _cond.wait(lock, [this] { return _stop or not _todo.empty(); });
+      if (_todo.empty()) {
+        return; // stopping
+      }
+      chunk = _todo.front();
+      _todo.pop_front();
+    }
+
+    encode(enc.get(), *chunk);
+    writeInOrder(chunk);
+  }
+}
+
+void ParallelFlacEncoder::encode(FLAC__StreamEncoder* enc, Chunk& chunk)
+{
+  PS_TRACE_SCOPE("FLAC encode");
+  auto start = c::steady_clock::now();
+
+  chunk.Encoded.clear();
+  chunk.FrameSizes.clear();
+
+  // Settings are reset by finish, so this is done every time.
+  configure(enc, _settings);
+  FLAC__stream_encoder_set_do_md5(enc, false);
+
+  auto res = FLAC__stream_encoder_init_stream(enc,
+      [](const FLAC__StreamEncoder*, const FLAC__byte buffer[], size_t bytes,
+         uint32_t samples, uint32_t currentFrame, void* data)
+      {
+        auto& chunk = *static_cast<Chunk*>(data);
+        if (samples == 0) {
+          return FLAC__STREAM_ENCODER_WRITE_STATUS_OK; // metadata, ours is global
+        }
+        chunk.Encoded.insert(end(chunk.Encoded), buffer, buffer + bytes);
+        // a frame may come in several writes
+        if (chunk.FrameSizes.size() <= currentFrame) {
+          chunk.FrameSizes.resize(currentFrame + 1, 0);
+        }
+        chunk.FrameSizes[currentFrame] += bytes;
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+      },
+      nullptr, nullptr, nullptr, &chunk);
+  if (res != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+    logger.error("Could not initialize FLAC encoder ({}), dropping {} frames",
+        (int)res, chunk.Frames);
+    chunk.Encoded.clear();
+    chunk.FrameSizes.clear();
+  }
+  else {
+    FLAC__stream_encoder_process_interleaved(enc, chunk.Samples.data(),
+        chunk.Frames);
+    FLAC__stream_encoder_finish(enc);
+  }
+
+  auto elapsed = c::steady_clock::now() - start;
+  lock_guard lock(_mutex);
+  _encodeTime += elapsed;
+}
+
+void ParallelFlacEncoder::writeInOrder(Chunk* chunk)
+{
+  {
+    lock_guard lock(_mutex);
+    _done.push_back(chunk);
+  }
+
+  // Whoever holds the write lock writes everything that is ready, every
+  // worker checks after pushing so nothing is left behind.
+  lock_guard writeLock(_writeMutex);
+  while (true) {
+    Chunk* next = nullptr;
+    {
+      lock_guard lock(_mutex);
+      auto it = find_if(begin(_done), end(_done),
+          [this](Chunk* c) { return c->Index == _nextToWrite; });
+      if (it == end(_done)) {
+        return;
+      }
+      next = *it;
+      _done.erase(it);
+    }
+
+    write(*next);
+
+    {
+      lock_guard lock(_mutex);
+      ++_nextToWrite;
+      _free.push_back(next);
+    }
+    _cond.notify_all();
+  }
+}
+
+void ParallelFlacEncoder::write(const Chunk& chunk)
+{
+  const uint8_t* frame = chunk.Encoded.data();
+  for (uint32_t size: chunk.FrameSizes) {
+    renumberFrame(frame, size, _frameNumber, _frameBuf);
+    try {
+      _file->write(_frameBuf.data(), _frameBuf.size());
+    }
+    catch (const exception& ex) {
+      if (not _writeError) {
+        logger.error("{}", ex.what());
+      }
+      _writeError = true;
+    }
+    uint32_t written = _frameBuf.size();
+    _minFrameSize = _frameNumber == 0 ? written : min(_minFrameSize, written);
+    _maxFrameSize = max(_maxFrameSize, written);
+    ++_frameNumber;
+    frame += size;
+  }
+  _totalSamples += chunk.FrameSizes.empty() ? 0 : chunk.Frames;
+}
+
+void ParallelFlacEncoder::writeStreamInfo()
+{
+  // https://xiph.org/flac/format.html#metadata_block_streaminfo
+  array<uint8_t, HeaderSize> header = {'f', 'L', 'a', 'C'};
+  BitWriter bits{header.data() + 4};
+  bits.put(1, 1);  // last metadata block
+  bits.put(0, 7);  // STREAMINFO
+  bits.put(34, 24);
+  bits.put(_blocksize, 16); // min block size
+  bits.put(_blocksize, 16); // max block size
+  bits.put(_minFrameSize, 24);
+  bits.put(_maxFrameSize, 24);
+  bits.put(_settings.Rate, 20);
+  bits.put(_settings.Channels - 1, 3);
+  bits.put(_settings.Bits - 1, 5);
+  bits.put(_totalSamples, 36);
+  // MD5 left to 0, i.e. unknown.
+
+  try {
+    _file->writeAt(0, header.data(), header.size());
+  }
+  catch (const exception& ex) {
+    logger.error("{}", ex.what());
+    _writeError = true;
+  }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+/// \file FLAC encoding settings and a FLAC encoder using several threads.
+
+#include "FileWriter.h"
+
+#include <FLAC/stream_encoder.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  struct FlacDeleter
+  {
+    void operator()(FLAC__StreamEncoder* enc)
+    {
+      if (enc) {
+        FLAC__stream_encoder_delete(enc);
+      }
+    }
+  };
+  using FlacPtr = std::unique_ptr<FLAC__StreamEncoder, FlacDeleter>;
+
+  struct FlacSettings
+  {
+    /// 0 (fastest) to 8 (smallest), libFLAC defaults to 5.
+    int Level = 5;
+    /// Frames per FLAC block, 0 to let libFLAC pick per level.
+    int Blocksize = 0;
+    /// libFLAC apodization string (eg "tukey(0.5)"), empty for the default.
+    std::string Apodization;
+    /// 0 to encode on the calling thread, otherwise the number of workers.
+    int Threads = 0;
+
+    int Channels = 2;
+    int Bits = 24;
+    int Rate = 48000;
+  };
+
+  /// Apply settings to an encoder that is not initialized yet.
+  void configure(FLAC__StreamEncoder*, const FlacSettings&);
+
+  /// Encodes a FLAC file with a pool of workers.
+  ///
+  /// Audio is cut in chunks of a fixed number of FLAC blocks, each chunk is
+  /// encoded by an independent libFLAC encoder. Chunks are then written in
+  /// order, with the frame numbers in the headers rewritten (and their CRCs
+  /// recomputed) so that the output is a single valid stream. STREAMINFO is
+  /// written when finishing, the MD5 is left unset.
+  ///
+  /// `process` only copies into preallocated buffers, it only waits if all
+  /// workers are busy and every buffer is used.
+  class ParallelFlacEncoder
+  {
+  public:
+    ParallelFlacEncoder(
+        const std::string& fileName, const FlacSettings&,
+        const FileWriter::Options& = {});
+    ParallelFlacEncoder(const ParallelFlacEncoder&) = delete;
+    ~ParallelFlacEncoder();
+
+    /// Interleaved samples, `frames` frames of `Channels` channels.
+    void process(const int32_t* samples, long frames);
+
+    /// Encode what is left, wait for the workers and close the file.
+    void finish();
+
+    /// Sum of the time spent in libFLAC across all workers, complete once
+    /// finish returned.
+    std::chrono::nanoseconds encodeTime();
+
+  private:
+    struct Chunk
+    {
+      long Index = 0;
+      long Frames = 0;
+      std::vector<int32_t> Samples;
+      std::vector<uint8_t> Encoded;
+      /// Size of each FLAC frame in Encoded, in order.
+      std::vector<uint32_t> FrameSizes;
+    };
+
+    void work();
+    void encode(FLAC__StreamEncoder*, Chunk&);
+    void writeInOrder(Chunk*);
+    void write(const Chunk&);
+    void writeStreamInfo();
+    void submit();
+
+    FlacSettings _settings;
+    int _blocksize;
+    long _chunkFrames;
+    std::unique_ptr<FileWriter> _file; // reset once finished
+
+    std::vector<std::unique_ptr<Chunk>> _chunks;
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    // ---------- members below must be accessed under the mutex ------------ //
+    std::vector<Chunk*> _free;
+    std::deque<Chunk*> _todo;
+    std::vector<Chunk*> _done; // encoded but waiting on a previous chunk
+    long _nextToWrite = 0;
+    bool _stop = false;
+    std::chrono::nanoseconds _encodeTime{};
+    // ---------------------------------------------------------------------- //
+
+    // Only one worker writes at a time, the members below are used under
+    // this mutex (or once the workers are joined).
+    std::mutex _writeMutex;
+    std::vector<uint8_t> _frameBuf;
+    uint64_t _frameNumber = 0; // next FLAC frame number in the output
+    uint64_t _totalSamples = 0;
+    uint32_t _minFrameSize = 0;
+    uint32_t _maxFrameSize = 0;
+    bool _writeError = false;
+
+    // Only used by the thread calling process.
+    Chunk* _current = nullptr;
+    long _nextIndex = 0;
+    long _waits = 0;
+  };
+}
@@ -0,0 +1,169 @@
+#include "Frames.h"
+#include "Simd.h"
+#include "fmt.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace ps;
+
+namespace
+{
+  /// One sample of the card: 16 bits, or 24 significant bits in 4 bytes
+  /// (the lowest byte is 0 for S32).
+  template <int Bits>
+  void writeFrames(
+      const float* const* planes, const int* channels, int planeCount,
+      long nFrames, int outChannelCount, uint8_t* out)
+  {
+    constexpr int Bytes = Bits == 16 ? 2 : 4;
+    constexpr float Scale = Bits == 16 ? 32767.f : 8388607.f;
+    const long frameBytes = long(Bytes) * outChannelCount;
+
+    auto store = [](uint8_t* to, int32_t value) {
+      if constexpr (Bits == 16) {
+        int16_t s = value;
+        memcpy(to, &s, 2);
+      }
+      else {
+        if constexpr (Bits == 32) {
+          value = int32_t(uint32_t(value) << 8);
+        }
+        memcpy(to, &value, 4);
+      }
+    };
+
+    const simd::Floats low = simd::broadcast(-1.f);
+    const simd::Floats high = simd::broadcast(1.f);
+    const simd::Floats scale = simd::broadcast(Scale);
+    for (int p = 0; p < planeCount; ++p) {
+      const float* in = planes[p];
+      uint8_t* to = out + channels[p] * Bytes;
+      long f = 0;
+      for (; f + simd::Lanes <= nFrames; f += simd::Lanes) {
+        auto values = simd::round(simd::clamp(simd::load(in + f), low, high) * scale);
+        for (int i = 0; i < simd::Lanes; ++i) {
+          store(to + (f + i) * frameBytes, values[i]);
+        }
+      }
+      for (; f < nFrames; ++f) {
+        const float v = in[f] < -1.f ? -1.f : in[f] > 1.f ? 1.f : in[f];
+        store(to + f * frameBytes, lrintf(v * Scale));
+      }
+    }
+  }
+
+  template <class StorageT, class ConvertFuncT>
+  void extract(
+      const uint8_t* in, int inChannelCount,
+      const int* channels, int outChannelCount,
+      int32_t* out, long nFrames, ConvertFuncT&& convert)
+  {
+    const long inStride = inChannelCount * sizeof(StorageT);
+    for (long i = 0; i < nFrames; ++i) {
+      const uint8_t* frame = in + i * inStride;
+      for (int j = 0; j < outChannelCount; ++j) {
+        StorageT value;
+        // memcpy since the alignment of the read buffer is not guaranteed,
+        // this compiles to a plain load.
+        memcpy(&value, frame + channels[j] * sizeof(StorageT), sizeof(value));
+        *out++ = convert(value);
+      }
+    }
+  }
+
+  /// `GroupSize` 0 is given at runtime, stereo gets its own loop with a
+  /// constant inner count that the compiler unrolls.
+  template <class StorageT, int GroupSize, class ConvertFuncT>
+  void split(
+      const uint8_t* in, int inChannelCount, int groupSize,
+      int32_t* const* outs, long nFrames, ConvertFuncT&& convert)
+  {
+    const int size = GroupSize > 0 ? GroupSize : groupSize;
+    const int groups = inChannelCount / size;
+    for (long i = 0; i < nFrames; ++i) {
+      const uint8_t* frame = in + i * inChannelCount * sizeof(StorageT);
+      for (int g = 0; g < groups; ++g) {
+        int32_t* out = outs[g] + i * size;
+        for (int j = 0; j < size; ++j) {
+          StorageT value;
+          memcpy(&value, frame + (g * size + j) * sizeof(StorageT),
+              sizeof(value));
+          out[j] = convert(value);
+        }
+      }
+    }
+  }
+
+  template <class StorageT, class ConvertFuncT>
+  void splitGroups(
+      const uint8_t* in, int inChannelCount, int groupSize,
+      int32_t* const* outs, long nFrames, ConvertFuncT&& convert)
+  {
+    if (groupSize == 2) {
+      split<StorageT, 2>(in, inChannelCount, 2, outs, nFrames, convert);
+    }
+    else {
+      split<StorageT, 0>(in, inChannelCount, groupSize, outs, nFrames, convert);
+    }
+  }
+}
+
+void ps::extractChannels(
+    const uint8_t* in, int inChannelCount, int bits,
+    const int* channels, int outChannelCount,
+    int32_t* out, long nFrames)
+{
+  // Pick the loop once per buffer rather than branching per sample.
+  switch (bits) {
+    case 16:
+      extract<int16_t>(in, inChannelCount, channels, outChannelCount,
+          out, nFrames, [](int16_t v) { return int32_t(v); });
+      return;
+    case 24:
+      // Low 3 bytes are used, sign extend from bit 23.
+      extract<uint32_t>(in, inChannelCount, channels, outChannelCount,
+          out, nFrames, [](uint32_t v) { return int32_t(v << 8) >> 8; });
+      return;
+    case 32:
+      extract<int32_t>(in, inChannelCount, channels, outChannelCount,
+          out, nFrames, [](int32_t v) { return v >> 8; });
+      return;
+  }
+  throw Exception("Unsupported number of bits per sample: {}", bits);
+}
+
+void ps::splitChannels(
+    const uint8_t* in, int inChannelCount, int bits, int groupSize,
+    int32_t* const* outs, long nFrames)
+{
+  if (groupSize <= 0 or inChannelCount % groupSize != 0) {
+    throw Exception("Cannot split {} channels in groups of {}",
+        inChannelCount, groupSize);
+  }
+  switch (bits) {
+    case 16:
+      splitGroups<int16_t>(in, inChannelCount, groupSize, outs, nFrames,
+          [](int16_t v) { return int32_t(v); });
+      return;
+    case 24:
+      splitGroups<uint32_t>(in, inChannelCount, groupSize, outs, nFrames,
+          [](uint32_t v) { return int32_t(v << 8) >> 8; });
+      return;
+    case 32:
+      splitGroups<int32_t>(in, inChannelCount, groupSize, outs, nFrames,
+          [](int32_t v) { return v >> 8; });
+      return;
+  }
+  throw Exception("Unsupported number of bits per sample: {}", bits);
+}
+
+WriteFrames ps::writeFramesFor(int bits)
+{
+  switch (bits) {
+    case 16: return &writeFrames<16>;
+    case 24: return &writeFrames<24>;
+    case 32: return &writeFrames<32>;
+  }
+  throw Exception("Unsupported number of bits per sample: {}", bits);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/// \file Kernels working on interleaved audio frames as ALSA gives them.
+
+#include <cstdint>
+
+namespace ps
+{
+  /// Bytes used by one sample of `sampleBits` in an ALSA buffer, S24_LE is
+  /// padded to 4 bytes.
+  inline int storageBytes(int sampleBits)
+  {
+    if (sampleBits == 24) {
+      return 4; // padding to int32_t
+    }
+    return sampleBits / 8;
+  }
+
+  /// Pick `outChannelCount` channels (the indices in `channels`) out of
+  /// frames of `inChannelCount` channels of signed little endian samples of
+  /// `bits` bits, and write them interleaved to `out`.
+  /// Output values are sign extended and keep at most 24 significant bits,
+  /// which is what FLAC takes (32 bit input loses its lowest byte).
+  void extractChannels(
+      const uint8_t* in, int inChannelCount, int bits,
+      const int* channels, int outChannelCount,
+      int32_t* out, long nFrames);
+
+  /// Split frames of `inChannelCount` channels into groups of `groupSize`
+  /// consecutive channels (i.e. stems), group `g` is written interleaved to
+  /// `outs[g]`. Values are converted as extractChannels does, in a single
+  /// pass over `in`. `inChannelCount` must be a multiple of `groupSize`.
+  void splitChannels(
+      const uint8_t* in, int inChannelCount, int bits, int groupSize,
+      int32_t* const* outs, long nFrames);
+
+  /// Write `planeCount` planes of values in [-1, 1], plane `i` to channel
+  /// `channels[i]` of interleaved frames of `outChannelCount` channels, as
+  /// the card takes them. Values out of range saturate. Other channels are
+  /// left as is.
+  using WriteFrames = void (*)(
+      const float* const* planes, const int* channels, int planeCount,
+      long nFrames, int outChannelCount, uint8_t* out);
+
+  /// The kernel for samples of `bits` (16, 24 padded to 4 bytes, or 32),
+  /// picked once rather than testing the format for every sample.
+  WriteFrames writeFramesFor(int bits);
+}
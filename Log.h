@@ -119,7 +119,8 @@ namespace ps
   {
     auto formatted = fmt::format(format, std::forward<Args>(args)... );
     return ::ps::details::LogTimer(
-      [&](std::chrono::milliseconds ms) {
+      // The timer outlives this function, it needs its own copy.
+      [this, formatted = std::move(formatted)](std::chrono::milliseconds ms) {
           std::cout << _prefix << _levelStrings[Info]
               << " run took " << ms.count() << "ms for " << formatted << '\n';
       }
@@ -0,0 +1,336 @@
+#include "MidiClock.h"
+#include "Alsa.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("CLOCK");
+
+  // Of the loop once locked, per tick: how much the phase and the period
+  // follow the ticks received. Low enough to smooth the jitter of USB.
+  constexpr double Alpha = 0.1;
+  constexpr double Beta = 0.005;
+  // Published once that many ticks were filtered.
+  constexpr long LockTicks = MidiClock::TicksPerBeat;
+  // 30 to 300 BPM.
+  constexpr double MinTickSeconds = 60. / (300 * MidiClock::TicksPerBeat);
+  constexpr double MaxTickSeconds = 60. / (30 * MidiClock::TicksPerBeat);
+  constexpr double StallSeconds = 0.5;
+
+  // Ticks are scheduled that far ahead, a new tempo is sent within that.
+  constexpr auto Lookahead = c::milliseconds(50);
+  constexpr int PollMs = 5;
+  // Of the queue timer, the kernel caps it to 6250.
+  constexpr unsigned TimerHz = 4000;
+
+  /// The system timer ticks every few ms on most kernels, too coarse for a
+  /// clock. False when the high resolution one is not there.
+  bool useHighResolutionTimer(snd_seq_t* seq, int queue)
+  {
+    snd_timer_id_t* id = nullptr;
+    snd_timer_id_alloca(&id);
+    snd_timer_id_set_class(id, SND_TIMER_CLASS_GLOBAL);
+    snd_timer_id_set_sclass(id, SND_TIMER_SCLASS_NONE);
+    snd_timer_id_set_card(id, -1);
+    snd_timer_id_set_device(id, SND_TIMER_GLOBAL_HRTIMER);
+    snd_timer_id_set_subdevice(id, 0);
+
+    snd_seq_queue_timer_t* timer = nullptr;
+    snd_seq_queue_timer_alloca(&timer);
+    if (snd_seq_get_queue_timer(seq, queue, timer) < 0) {
+      return false;
+    }
+    snd_seq_queue_timer_set_type(timer, SND_SEQ_TIMER_ALSA);
+    snd_seq_queue_timer_set_id(timer, id);
+    snd_seq_queue_timer_set_resolution(timer, TimerHz);
+    return snd_seq_set_queue_timer(seq, queue, timer) >= 0;
+  }
+}
+
+ArgMap MidiClock::args()
+{
+  return {
+    { "midi-clock-in"s, {
+      .Doc = "A midi port to follow the clock of, e.g. a DJ mixer or a DAW. "
+      "Pads are quantized to it unless a tempo is tapped.",
+      .Value = "",
+    } },
+    { "midi-clock-out"s, {
+      .Doc = "A midi port to send a clock to, at the tempo tapped, followed "
+      "or detected. It starts on a bar.",
+      .Value = "",
+    } }
+  };
+}
+
+MidiClock::MidiClock(const ArgMap& args)
+  : _epoch(c::steady_clock::now())
+{
+  const auto& in = *args.find("midi-clock-in")->second.Value;
+  const auto& out = *args.find("midi-clock-out")->second.Value;
+  if (in.empty() and out.empty()) {
+    return;
+  }
+
+  // A client of its own, the one of the Device is polled by the main loop.
+  if (snd_seq_open(&_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0) {
+    logger.throw_("Failed to open the sequencer for the MIDI clock");
+  }
+  try {
+    snd_seq_set_client_name(_seq, "pisample-clock");
+    _port = snd_seq_create_simple_port(_seq, "clock",
+        SND_SEQ_PORT_CAP_READ |
+        SND_SEQ_PORT_CAP_SUBS_READ |
+        SND_SEQ_PORT_CAP_WRITE |
+        SND_SEQ_PORT_CAP_SUBS_WRITE,
+        SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+        SND_SEQ_PORT_TYPE_APPLICATION);
+    if (_port < 0) {
+      logger.throw_("Failed to create the port of the MIDI clock");
+    }
+
+    if (not in.empty()) {
+      auto address = findSeqPort(*_seq, in);
+      if (snd_seq_connect_from(_seq, _port, address.client, address.port) < 0) {
+        logger.throw_("Failed to follow the MIDI clock of '{}'", in);
+      }
+      _fds.resize(snd_seq_poll_descriptors_count(_seq, POLLIN));
+      snd_seq_poll_descriptors(_seq, _fds.data(), _fds.size(), POLLIN);
+    }
+
+    if (not out.empty()) {
+      auto address = findSeqPort(*_seq, out);
+      if (snd_seq_connect_to(_seq, _port, address.client, address.port) < 0) {
+        logger.throw_("Failed to send the MIDI clock to '{}'", out);
+      }
+      _queue = snd_seq_alloc_named_queue(_seq, "pisample-clock");
+      if (_queue < 0) {
+        logger.throw_("Failed to allocate a queue for the MIDI clock");
+      }
+      if (not useHighResolutionTimer(_seq, _queue)) {
+        logger.warn("No high resolution timer (snd-hrtimer), the MIDI clock "
+            "sent is only as precise as the system timer");
+      }
+      snd_seq_start_queue(_seq, _queue, nullptr);
+      snd_seq_drain_output(_seq);
+    }
+  }
+  catch (...) {
+    snd_seq_close(_seq);
+    throw;
+  }
+
+  logger.info("MIDI clock in: '{}', out: '{}'", in, out);
+  _thread = thread([this] { run(); });
+}
+
+MidiClock::~MidiClock()
+{
+  _stop = true;
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+  if (not _seq) {
+    return;
+  }
+  if (_started) {
+    // Right away, what is still scheduled goes with the queue.
+    snd_seq_event_t event;
+    snd_seq_ev_clear(&event);
+    event.type = SND_SEQ_EVENT_STOP;
+    snd_seq_ev_set_source(&event, _port);
+    snd_seq_ev_set_subs(&event);
+    snd_seq_ev_set_direct(&event);
+    snd_seq_event_output_direct(_seq, &event);
+  }
+  if (_queue >= 0) {
+    snd_seq_free_queue(_seq, _queue);
+  }
+  snd_seq_close(_seq);
+}
+
+Beat MidiClock::beat() const
+{
+  lock_guard lock(_mutex);
+  return _received;
+}
+
+void MidiClock::send(const Beat& beat)
+{
+  lock_guard lock(_mutex);
+  _toSend = beat;
+}
+
+double MidiClock::seconds(c::steady_clock::time_point time) const
+{
+  return c::duration<double>(time - _epoch).count();
+}
+
+void MidiClock::run()
+{
+  trace::setThreadName("midi-clock");
+  while (not _stop) {
+    // Wakes up with the ticks received, and often enough to send ahead.
+    int active = ::poll(_fds.data(), _fds.size(), PollMs);
+    const auto now = c::steady_clock::now();
+    if (active > 0) {
+      snd_seq_event_t* event = nullptr;
+      while (snd_seq_event_input(_seq, &event) >= 0 and event) {
+        receive(*event, now);
+      }
+    }
+    if (_tickPeriod > 0 and seconds(now) - _lastTick > StallSeconds) {
+      logger.info("The MIDI clock followed stopped");
+      unlock();
+    }
+    if (_queue >= 0) {
+      sendAhead(now);
+    }
+  }
+}
+
+void MidiClock::receive(
+    const snd_seq_event_t& event, c::steady_clock::time_point time)
+{
+  // Songs stopped keep their clock ticking, so do the positions here. Those
+  // continued are given their position first.
+  switch (event.type) {
+    case SND_SEQ_EVENT_START:
+      _position = -1; // the next tick is the first
+      break;
+    case SND_SEQ_EVENT_SONGPOS: // in 16th notes
+      _position = long(event.data.control.value) * TicksPerBeat / 4 - 1;
+      break;
+    case SND_SEQ_EVENT_CLOCK:
+      tick(seconds(time));
+      break;
+  }
+}
+
+void MidiClock::tick(double time)
+{
+  ++_position;
+  const double previous = _lastTick;
+  _lastTick = time;
+  if (_tickPeriod == 0) {
+    const double interval = time - previous;
+    if (previous >= 0 and interval >= MinTickSeconds and
+        interval <= MaxTickSeconds)
+    {
+      _tickPeriod = interval;
+      _tickTime = time;
+      _filtered = 2;
+    }
+    return;
+  }
+
+  const double predicted = _tickTime + _tickPeriod;
+  const double error = time - predicted;
+  if (abs(error) > _tickPeriod / 2) {
+    unlock(); // ticks were missed, or the tempo jumped
+    return;
+  }
+  // A least squares fit of the ticks so far at first, then a fading memory
+  // that smooths the jitter yet follows a pitch fader.
+  const double n = ++_filtered;
+  const double alpha = max(Alpha, 2 * (2 * n - 1) / (n * (n + 1)));
+  const double beta = max(Beta, 6 / (n * (n + 1)));
+  _tickTime = predicted + alpha * error;
+  _tickPeriod = clamp(_tickPeriod + beta * error, MinTickSeconds, MaxTickSeconds);
+  if (_filtered < LockTicks) {
+    return;
+  }
+
+  const long inBeat = _position % TicksPerBeat;
+  const double last = _tickTime - inBeat * _tickPeriod;
+  Beat beat{
+    .Last = _epoch + c::duration_cast<c::steady_clock::duration>(
+        c::duration<double>(last)),
+    .Period = c::microseconds(llround(_tickPeriod * TicksPerBeat * 1e6)),
+    .BeatInBar = int(_position / TicksPerBeat % Beat::BeatsPerBar),
+  };
+  {
+    lock_guard lock(_mutex);
+    _received = beat;
+  }
+  if (abs(beat.bpm() - _loggedBpm) >= 1) {
+    _loggedBpm = beat.bpm();
+    logger.info("Following the MIDI clock at {:.1f} BPM", _loggedBpm);
+  }
+}
+
+void MidiClock::unlock()
+{
+  _tickPeriod = 0;
+  _filtered = 0;
+  _loggedBpm = 0;
+  lock_guard lock(_mutex);
+  _received = {};
+}
+
+void MidiClock::sendAhead(c::steady_clock::time_point now)
+{
+  Beat beat;
+  {
+    lock_guard lock(_mutex);
+    beat = _toSend;
+  }
+  if (not beat) {
+    if (_started) {
+      _started = false;
+      output(SND_SEQ_EVENT_STOP, _nextTick, now); // after the last tick
+      snd_seq_drain_output(_seq);
+      logger.info("Stopped sending the MIDI clock");
+    }
+    return;
+  }
+
+  const auto horizon = now + Lookahead;
+  if (not _started) {
+    // Those following start their song on the first tick after START.
+    const auto bar = beat.next(now, Beat::BeatsPerBar);
+    if (bar > horizon) {
+      return;
+    }
+    output(SND_SEQ_EVENT_START, bar, now);
+    _started = true;
+    _nextTick = bar;
+    logger.info("Sending the MIDI clock at {:.1f} BPM", beat.bpm());
+  }
+  // On the grid of the beat, which may move a little from call to call.
+  const auto tick = c::duration<double>(beat.Period) / TicksPerBeat;
+  while (_nextTick <= horizon) {
+    output(SND_SEQ_EVENT_CLOCK, _nextTick, now);
+    const double ticks = (_nextTick + tick / 2 - beat.Last) / tick;
+    _nextTick = beat.Last +
+        c::duration_cast<c::steady_clock::duration>(ceil(ticks) * tick);
+  }
+  snd_seq_drain_output(_seq);
+}
+
+void MidiClock::output(snd_seq_event_type type,
+    c::steady_clock::time_point time, c::steady_clock::time_point now)
+{
+  snd_seq_event_t event;
+  snd_seq_ev_clear(&event);
+  event.type = type;
+  snd_seq_ev_set_source(&event, _port);
+  snd_seq_ev_set_subs(&event);
+  // Relative to the time of the queue, so that its clock and ours never
+  // have to agree.
+  const auto delay = c::duration_cast<c::nanoseconds>(
+      max(time - now, c::steady_clock::duration::zero())).count();
+  snd_seq_real_time_t at{
+    .tv_sec = unsigned(delay / 1'000'000'000),
+    .tv_nsec = unsigned(delay % 1'000'000'000),
+  };
+  snd_seq_ev_schedule_real(&event, _queue, 1 /*relative*/, &at);
+  snd_seq_event_output(_seq, &event);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/// \file MIDI clock in and out, on the ALSA sequencer.
+
+#include "Arguments.h"
+#include "Tempo.h"
+
+#include <alsa/asoundlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  namespace c = std::chrono;
+
+  /// Follows the MIDI clock of a port (24 ticks per beat), e.g. of a DJ
+  /// mixer or a DAW, and sends one to another port at the tempo it is given.
+  ///
+  /// Both happen on a thread with a sequencer client of their own, so that
+  /// the main loop never delays them. The jitter of the ticks received is
+  /// smoothed by a phase locked loop into a Beat, which the player turns
+  /// into frames. The ticks sent are scheduled ahead on a sequencer queue,
+  /// the kernel sends each on time.
+  class MidiClock
+  {
+  public:
+    static constexpr int TicksPerBeat = 24;
+
+    static ArgMap args();
+
+    /// Does nothing unless given a port to follow or to send to.
+    explicit MidiClock(const ArgMap&);
+    MidiClock(const MidiClock&) = delete;
+    ~MidiClock();
+
+    /// Of the clock followed, none until it is steady or once it stopped
+    /// ticking. Any thread.
+    Beat beat() const;
+
+    /// The tempo to send, none to stop the clock. It starts on the next bar.
+    /// Any thread.
+    void send(const Beat&);
+
+  private:
+    void run();
+    /// A tick, a start or a song position received at `time`.
+    void receive(const snd_seq_event_t&, c::steady_clock::time_point time);
+    void tick(double time);
+    /// Forget the clock followed, it stopped or jumped.
+    void unlock();
+    /// Schedules what is to be sent until a little after `now`.
+    void sendAhead(c::steady_clock::time_point now);
+    /// On the queue, sent at `time`.
+    void output(snd_seq_event_type type, c::steady_clock::time_point time,
+        c::steady_clock::time_point now);
+    double seconds(c::steady_clock::time_point time) const;
+
+    const c::steady_clock::time_point _epoch;
+    snd_seq_t* _seq = nullptr;
+    int _port = -1;
+    int _queue = -1; // only when sending
+    std::vector<pollfd> _fds; // only when following
+    std::atomic<bool> _stop = false;
+
+    mutable std::mutex _mutex;
+    // ---------- members below must be accessed under the mutex ------------ //
+    Beat _received;
+    Beat _toSend;
+    // ---------------------------------------------------------------------- //
+
+    // --------- members below must be accessed in the thread only ---------- //
+    // Following, times in seconds since _epoch.
+    long _position = -1;     // of the last tick, in the song
+    double _lastTick = -1;   // as received
+    double _tickTime = 0;    // filtered
+    double _tickPeriod = 0;  // 0 until locked
+    long _filtered = 0;      // ticks since locked
+    double _loggedBpm = 0;
+    // Sending.
+    bool _started = false;
+    c::steady_clock::time_point _nextTick;
+    // ---------------------------------------------------------------------- //
+
+    std::thread _thread;
+  };
+}
@@ -1,5 +1,6 @@
 #include "Pads.h"
 #include "Device.h"
+#include "Trace.h"
 
 #include <deque>
 #include <cstring>
@@ -139,6 +140,8 @@ void Pads::step()
     return;
   }
 
+  PS_TRACE_SCOPE("Pads::step");
+
   auto now = c::system_clock::now();
   vector<Note> notes;
 
@@ -1,7 +1,10 @@
 #include "PiSample.h"
-#include "Strings.h"
+#include "BankImage.h"
+#include "Banks.h"
 #include "Log.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <utility>
 #include <stdexcept>
@@ -12,164 +15,274 @@ using namespace std;
 
 namespace {
   auto logger = Log("UI");
+
+  // A hit that late after a beat plays right away rather than on the next
+  // one, it was meant for this one.
+  constexpr auto LateHit = c::milliseconds(30);
+
+  filesystem::path imagePath(const ArgMap& args)
+  {
+    filesystem::path image = *args.find("bank-image")->second.Value;
+    if (image.empty()) {
+      image = *args.find("samples")->second.Value;
+      image.replace_extension(".bank");
+    }
+    return image;
+  }
+
+  filesystem::path patternsPath(const ArgMap& args)
+  {
+    filesystem::path patterns = *args.find("samples")->second.Value;
+    return patterns.replace_extension(".patterns");
+  }
 }
 
-void PiSample::finalizeSample(optional<Sample>& sample, std::filesystem::path file)
+optional<PiSample::FileStamp> PiSample::FileStamp::of(
+    const filesystem::path& path)
 {
-  auto& s = sample.value();
-  s.PlayerIndex = _player.load(file);
-  if (s.PlayerIndex < 0) {
-    logger.warn("Ignoring sample {} - player could not load it", s.Name);
-    sample = nullopt;
+  error_code error;
+  auto time = filesystem::last_write_time(path, error);
+  if (error) {
+    return nullopt; // decoding it will tell why
   }
+  auto size = filesystem::file_size(path, error);
+  return FileStamp{.Path = path, .Time = time, .Size = size};
 }
 
-void PiSample::loadBanks(string_view fileName)
+PiSample::Reload PiSample::reloadBanks()
 {
-  ifstream in(static_cast<string>(fileName));
-  if (not in) {
+  error_code error;
+  if (not filesystem::is_regular_file(_samplesFile, error)) {
     logger.throw_("Could not open sample files '{}' for reading. You can "
-        "pass an empty file if you do not wish to load any.", fileName);
+        "pass an empty file if you do not wish to load any.", _samplesFile);
   }
 
-  optional<Sample>* currentSample = nullptr;
+  auto table = readBanks(_samplesFile);
+  auto& configs = table.Banks;
+  if (configs.size() > Player::MaxBanks) {
+    logger.throw_("{} has {} banks, at most {} are supported", _samplesFile,
+        configs.size(), Player::MaxBanks);
+  }
 
-  vector<string_view> parts;
-  string rawLine;
-  int index = 0;
-  string currentFile;
-  int sampleCount = 0;
-  int currentBank = 0;
+  Reload result;
+  result.Files.push_back(_samplesFile);
+  result.Banks.resize(configs.size());
+  result.Plans.resize(configs.size());
+  vector<array<optional<FileStamp>, 16>> stamps(configs.size());
 
-  while (getline(in, rawLine)) {
-    ++index;
-    string_view line = trim(rawLine);
-    if (line.empty() || line[0] == '#') {
-      continue;
+  int sampleCount = 0;
+  int changedCount = 0;
+  for (unsigned b = 0; b < configs.size(); ++b) {
+    // The loader decodes banks when they are needed, only the files that
+    // changed are decoded again in banks already loaded.
+    auto& plan = result.Plans[b];
+    plan.Paths.resize(configs[b].size());
+    plan.Keep.resize(configs[b].size());
+    for (unsigned p = 0; p < configs[b].size(); ++p) {
+      const auto& config = configs[b][p];
+      bool before = b < _stamps.size() and _stamps[b][p].has_value();
+      if (not config.has_value()) {
+        plan.Keep[p] = not before;
+        continue;
+      }
+      plan.Paths[p] = config->File;
+      result.Files.push_back(config->File);
+      stamps[b][p] = FileStamp::of(config->File);
+      plan.Keep[p] = before and stamps[b][p].has_value() and
+          *_stamps[b][p] == *stamps[b][p];
+      changedCount += not plan.Keep[p];
+      ++sampleCount;
+
+      result.Banks[b][p] = Sample{
+        .Name = string(config->Name),
+        .PlayerIndex = int(p),
+        .Color = config->Color,
+        .Play = routed(config->Play, config->Output)
+      };
     }
+  }
 
-    try { // to append some common info to any exception encountered.
-      if (line[0] == '[') {
-        if (currentSample != nullptr) {
-          finalizeSample(*currentSample, currentFile);
-        }
-
-        // new sample
-        if (line.back() != ']') {
-          logger.throw_("Malformed line: missing closing ']'");
-        }
-        line = line.substr(1, line.size() - 2);
-
-        split(parts, line, '.');
-        if (parts.size() != 2 or
-            parts[0].substr(0, 4) != "Bank" or
-            parts[1].substr(0, 3) != "Pad")
-        {
-          logger.throw_("[Malformed line: Must be [BankX.PadY]");
-        }
-
-        parts[0] = parts[0].substr(4); // remove "Bank"
-        parts[1] = parts[1].substr(3); // remove "Pad"
+  // Only now that nothing can throw anymore.
+  _stamps = move(stamps);
 
-        int bankNo = -1;
-        try {
-          bankNo = svtoi(parts[0]);
-          if (bankNo < 1) {
-            throw out_of_range(">0");
-          }
-        }
-        catch (...) {
-          logger.throw_("Could not convert {} to a valid bank number (> 0)",
-              parts[0]);
-        }
-        if (bankNo != currentBank and bankNo != currentBank + 1) {
-          logger.throw_("Bank is {} but last was {} - expecting the same "
-            "value or {}. Banks must be given in order in the file.",
-            bankNo, currentBank, currentBank + 1);
-        }
-        currentBank = bankNo;
-        if (_banks.size() < static_cast<unsigned>(bankNo)) {
-          _banks.resize(bankNo);
-          // filled with unset Sample for pads.
-        }
+  if (sampleCount == 0) {
+    logger.info("No samples found in samples line {}", _samplesFile);
+  }
+  else {
+    logger.info("Found {} banks and {} samples in {}, {} new or changed",
+        configs.size(), sampleCount, _samplesFile, changedCount);
+  }
+  return result;
+}
 
-        int padNo = -1;
-        try {
-          padNo = svtoi(parts[1]);
-          if (padNo < 1 or padNo > 16) {
-            throw out_of_range(">0 && <17");
-          }
-        }
-        catch (...) {
-          logger.throw_("Could not convert {} to a valid pad number "
-              "(1-16)", parts[1]);
-        }
+optional<PiSample::Reload> PiSample::loadImage(
+    const filesystem::path& path, bool verify)
+{
+  error_code error;
+  if (not filesystem::exists(path, error)) {
+    return nullopt;
+  }
+  try {
+    optional<BankImage> image;
+    PS_LOG_TIME(logger, "mapping {}", path) {
+      image.emplace(path, _player.rate(), verify);
+    };
+    if (not image->upToDate(_samplesFile)) {
+      logger.info("{} changed since {} was compiled, not using it",
+          _samplesFile, path);
+      return nullopt;
+    }
 
-        if (_banks.back()[padNo - 1].has_value()) {
-          logger.throw_("Bank{}.Pad{} is present twice in the config",
-              bankNo, padNo);
+    Reload result;
+    result.Files.push_back(_samplesFile);
+    result.Banks.resize(image->bankCount());
+    result.Plans.resize(image->bankCount());
+    _stamps.assign(image->bankCount(), {});
+    for (int b = 0; b < image->bankCount(); ++b) {
+      result.Loaded.push_back(image->bank(b));
+      auto& plan = result.Plans[b];
+      plan.Paths.resize(atom::NumPads);
+      plan.Keep.assign(atom::NumPads, true);
+      for (int p = 0; p < atom::NumPads; ++p) {
+        auto& config = image->config(b)[p];
+        if (not config.has_value()) {
+          continue;
         }
-        currentSample = & _banks.back()[padNo - 1];
-        *currentSample = Sample(); // may be reset later in case on an error.
-        ++sampleCount;
+        plan.Paths[p] = config->File;
+        result.Files.push_back(config->File);
+        // As it was when compiled, a file changed since then is only
+        // noticed once it changes again.
+        _stamps[b][p] = FileStamp{
+          .Path = config->File, .Time = config->FileTime, .Size = config->FileSize};
+        result.Banks[b][p] = Sample{
+          .Name = string(config->Name),
+          .PlayerIndex = p,
+          .Color = config->Color,
+          .Play = routed(config->Play, config->Output)
+        };
       }
+    }
+    logger.info("Loaded {} banks from {}", image->bankCount(), path);
+    return result;
+  }
+  catch (const exception& ex) {
+    logger.warn("Not using {} ({})", path, ex.what());
+    _stamps.clear();
+  }
+  return nullopt;
+}
 
-      else {
-        if (currentSample == nullptr) {
-          logger.throw_("A property key=value was given before "
-              "[BankY.PadY]");
-        }
-        split(parts, line, '=');
-        if (parts.size() != 2 or parts[0].empty() or parts[1].empty()) {
-          logger.throw_("Expecting key=value but found {}. No '=' "
-              "allowed in the value.", line);
-        }
-
-        // TODO: check for repeated keys.
-        if (parts[0] == "Name") {
-          currentSample->value().Name = parts[1];
-        }
-        else if (parts[0] == "File") {
-          currentFile = parts[1];
-        }
-        else if (parts[0] == "Color") {
-          if (parts[1][0] != '#') { // note we checked it’s not empty above
-            logger.throw_("At line {} expecting an hex color formatted as "
-                "'#123456'", index);
-          }
-          currentSample->value().Color = atom::Color::fromString(parts[1]);
-        }
+void PiSample::compileBanks(const ArgMap& args, Player& player)
+{
+  filesystem::path samplesFile = *args.find("samples")->second.Value;
+  auto table = readBanks(samplesFile);
+  vector<shared_ptr<const SampleBank>> banks;
+  for (auto& config: table.Banks) {
+    vector<filesystem::path> paths(config.size());
+    for (unsigned p = 0; p < config.size(); ++p) {
+      if (config[p].has_value()) {
+        paths[p] = config[p]->File;
       }
     }
-    catch (const exception& ex) {
-      logger.throw_("samples file {}, line {}: {}", fileName, index, ex.what());
-    }
+    banks.push_back(player.makeBank(paths));
   }
+  BankImage::write(imagePath(args), samplesFile, table.Banks, banks,
+      player.rate());
+}
 
-  if (currentSample == nullptr) {
-    logger.info("No samples found in samples line {}", fileName);
-    return;
+PlaySettings PiSample::routed(PlaySettings play, string_view output) const
+{
+  if (not output.empty()) {
+    play.Output = _player.output(output);
+    if (play.Output < 0) {
+      logger.warn("No output {} in audio-out-outputs, playing on the main one",
+          output);
+      play.Output = 0;
+    }
   }
+  return play;
+}
 
-  finalizeSample(*currentSample, currentFile);
-
-  logger.info("Loaded {} banks and {} samples, read {} lines in {}",
-      currentBank, sampleCount, index, fileName);
+Sequencer::Sounds PiSample::sounds(int bank) const
+{
+  Sequencer::Sounds result;
+  if (bank >= int(_banks.size())) {
+    return result;
+  }
+  for (unsigned p = 0; p < result.size(); ++p) {
+    if (auto& sample = _banks[bank][p]) {
+      result[p] = Sequencer::Sound{
+        .Sample = sample->PlayerIndex,
+        .Play = sample->Play,
+        .Color = sample->Color,
+      };
+    }
+  }
+  return result;
 }
 
+void PiSample::apply(Reload&& reload)
+{
+  _banks = move(reload.Banks);
+  if (_currentBank >= int(_banks.size())) {
+    _currentBank = 0;
+    _loader->setCurrent(_currentBank);
+  }
+  _sequencer.setBank(_currentBank, sounds(_currentBank));
+  stretch(_currentBank);
+  if (PadsAccess::isAccessing()) {
+    onAccess(); // colors or samples may have changed
+  }
+}
 
 PiSample::PiSample(
   const unordered_map<string, Argument>& args,
   Device& device,
   Pads& pads,
   Recorder& recorder,
-  Player& player)
+  Player& player,
+  MidiClock& clock)
   : PadsAccess(pads)
   , _device(device)
   , _recorder(recorder)
   , _player(player)
+  , _clock(clock)
+  , _samplesFile(*args.find("samples")->second.Value)
+  , _sequencer(device, pads, player, patternsPath(args))
 {
-  loadBanks(*args.find("samples")->second.Value);
+  BankLoader::Options options{
+    .Budget = size_t(stoul(*args.find("bank-memory-mb")->second.Value)) << 20,
+    .Lookahead = stoi(*args.find("bank-lookahead")->second.Value),
+  };
+  _loader = make_unique<BankLoader>(_player, options, [this](int bank, int pad) {
+    lock_guard lock(_reloadMutex);
+    _readyPads.emplace_back(bank, pad);
+  });
+  _stretcher = make_unique<Stretcher>(_player,
+      size_t(stoul(*args.find("stretch-memory-mb")->second.Value)) << 20);
+
+  auto image = loadImage(
+      imagePath(args), *args.find("verify-bank-image")->second.Value == "true");
+  auto reload = image ? move(*image) : reloadBanks();
+  auto files = move(reload.Files);
+  _loader->update(move(reload.Plans));
+  for (size_t b = 0; b < reload.Loaded.size(); ++b) {
+    _loader->preload(b, move(reload.Loaded[b]));
+  }
+  _loader->setCurrent(_currentBank);
+  apply(move(reload));
+
+  if (*args.find("no-sample-reload")->second.Value != "true") {
+    _watcher = make_unique<FileWatcher>([this](auto&) {
+      auto reload = reloadBanks();
+      _watcher->watch(reload.Files);
+      _loader->update(move(reload.Plans));
+
+      lock_guard lock(_reloadMutex);
+      _pendingReload = move(reload);
+    });
+    _watcher->watch(files);
+  }
 
   _currentView = 1;
   cycleView(false); // activate ourselves as the pads accessor.
@@ -177,12 +290,47 @@ PiSample::PiSample(
 
 PiSample::~PiSample()
 {
+  if (_clickOn) {
+    _device.sendControl(atom::switchButton(atom::Buttons::Click, false));
+  }
   _device.sendControl(atom::switchButton(atom::Buttons::Stop, false));
   _device.sendControl(atom::switchButton(atom::Buttons::Shift, false));
 }
 
 void PiSample::event(atom::Note n)
 {
+  bool inRecorder = _currentView == (int)Views::Recorder and
+                    _viewAnimTimeout == _viewAnimTimeout.max();
+  if (inRecorder and n.OnOff) {
+    _recorder.padPressed(atom::Pad(n.Note), _shiftPressed);
+    return;
+  }
+  bool inPlayer = _currentView == (int)Views::Player and
+                  _viewAnimTimeout == _viewAnimTimeout.max();
+  if (inPlayer and n.OnOff) {
+    _sequencer.padPressed(atom::Pad(n.Note), _shiftPressed);
+    return;
+  }
+  bool inSampler = _currentView == (int)Views::Sampler and
+                   _viewAnimTimeout == _viewAnimTimeout.max();
+  const int pad = n.Note - int(atom::Pad::One);
+  if (inSampler and pad >= 0 and pad < atom::NumPads and
+      _currentBank < int(_banks.size()))
+  {
+    auto& sample = _banks[_currentBank][pad];
+    if (sample.has_value() and n.OnOff) {
+      auto at = startOf(sample->Play);
+      _player.play(_currentBank, sample->PlayerIndex, sample->Play, at);
+      _lastPad = pad;
+      _sequencer.hit(pad,
+          at != c::steady_clock::time_point{} ? at : c::steady_clock::now());
+    }
+    else if (sample.has_value()) {
+      _player.release(_currentBank, sample->PlayerIndex);
+    }
+    return;
+  }
+
   cout << "Note " << (n.OnOff ? "on" : "off")
        << ", channel: " << (int)n.Channel
        << ", note: " << (int)n.Note
@@ -192,6 +340,23 @@ void PiSample::event(atom::Note n)
 
 void PiSample::event(atom::Control c)
 {
+  // The knobs play the effects of the player, one parameter each.
+  const int knob = c.Param - int(Knobs::One);
+  if (knob >= 0 and knob < Effects::ParamCount) {
+    // Relative, 1 for a notch left and 65 for a notch right, more when
+    // turned fast.
+    const int notches = c.Value >= 64 ? c.Value - 64 : -int(c.Value);
+    // With Shift, the first one is the pitch of the last pad hit instead.
+    if (_shiftPressed and knob == 0) {
+      turnPitch(notches);
+      return;
+    }
+    const auto param = Effects::Param(knob);
+    const float value = _player.effects().turn(param, notches);
+    logger.debug("{} {:.2f}", Effects::Params[param].Name, value);
+    return;
+  }
+
   switch (static_cast<Buttons>(c.Param)) {
     case Buttons::Record:
       if (c.Value == 0x00) {
@@ -203,6 +368,36 @@ void PiSample::event(atom::Control c)
       _device.sendControl(switchButton(Buttons::Shift, _shiftPressed));
       _device.sendControl(switchButton(Buttons::Stop, _shiftPressed));
       break;
+    case Buttons::Click:
+      if (c.Value == 0) {
+        break;
+      }
+      if (_shiftPressed) {
+        _tap.clear();
+        logger.info("Tap tempo cleared");
+        break;
+      }
+      _tap.tap(c::steady_clock::now());
+      if (_tap.beat()) {
+        logger.debug("Tapped {:.1f} BPM", _tap.beat().bpm());
+      }
+      break;
+    case Buttons::Play:
+      if (c.Value == 0) {
+        break;
+      }
+      if (_shiftPressed) {
+        _sequencer.toggleRecording(currentBeat());
+      }
+      else {
+        _sequencer.toggle(currentBeat());
+      }
+      break;
+    case Buttons::Select:
+      if (c.Value != 0 and _currentView == (int)Views::Player) {
+        _sequencer.clear(_shiftPressed);
+      }
+      break;
     case Buttons::Stop:
       if (_shiftPressed) {
         _willShutdown = true;
@@ -218,6 +413,16 @@ void PiSample::event(atom::Control c)
         cycleView(false);
       }
       break;
+    case Buttons::Left:
+      if (c.Value == 0) { // release
+        changeBank(-1);
+      }
+      break;
+    case Buttons::Right:
+      if (c.Value == 0) { // release
+        changeBank(1);
+      }
+      break;
 
     default:
       cout << "Control: "
@@ -249,8 +454,172 @@ void PiSample::cycleView(bool next)
   _viewAnimTimeout = c::milliseconds(500) + c::system_clock::now();
 }
 
+void PiSample::changeBank(int delta)
+{
+  if (_currentView != (int)Views::Sampler or _banks.empty()) {
+    return;
+  }
+  int bank = clamp(_currentBank + delta, 0, int(_banks.size()) - 1);
+  if (bank == _currentBank) {
+    return;
+  }
+  _currentBank = bank;
+  _lastPad = -1;
+  _loader->setCurrent(bank);
+  _sequencer.setBank(bank, sounds(bank));
+  stretch(bank);
+  logger.info("Bank {}", bank + 1);
+  if (PadsAccess::isAccessing()) {
+    pads().reset();
+    onAccess();
+  }
+}
+
+Beat PiSample::currentBeat() const
+{
+  if (_tap.beat()) {
+    return _tap.beat();
+  }
+  if (auto beat = _clock.beat()) {
+    return beat;
+  }
+  if (auto tempo = _recorder.tempo()) {
+    return tempo->beat();
+  }
+  return {};
+}
+
+c::steady_clock::time_point PiSample::startOf(const PlaySettings& settings) const
+{
+  if (settings.Quantize == QuantizeMode::Off) {
+    return {};
+  }
+  auto beat = currentBeat();
+  if (not beat) {
+    return {};
+  }
+  // The player starts those already past right away.
+  return beat.next(c::steady_clock::now() - LateHit,
+      settings.Quantize == QuantizeMode::Bar ? Beat::BeatsPerBar : 1);
+}
+
+void PiSample::showBeat()
+{
+  auto beat = currentBeat();
+  _clock.send(beat);
+  bool on = false;
+  if (beat) {
+    if (beat.bpm() != _bpm) {
+      _bpm = beat.bpm();
+      _player.effects().setTempo(_bpm);
+    }
+    // Not for every wobble of a tempo followed, each one is stretched again.
+    if (round(_bpm * 10) / 10 != _stretchBpm) {
+      _stretchBpm = round(_bpm * 10) / 10;
+      stretch(_currentBank);
+    }
+    // Lit over the first quarter of each beat.
+    auto sinceBeat = (c::steady_clock::now() - beat.Last) % beat.Period;
+    if (sinceBeat < sinceBeat.zero()) {
+      sinceBeat += beat.Period;
+    }
+    on = sinceBeat < beat.Period / 4;
+  }
+  if (on != _clickOn) {
+    _clickOn = on;
+    _device.sendControl(atom::switchButton(atom::Buttons::Click, on));
+  }
+}
+
+void PiSample::stretch(int bank)
+{
+  auto source = _loader->bank(bank);
+  if (bank >= int(_banks.size()) or not source) {
+    return;
+  }
+  for (int p = 0; p < atom::NumPads; ++p) {
+    auto& sample = _banks[bank][p];
+    if (not sample.has_value() or sample->Play.Bpm <= 0 or
+        not _loader->ready(bank, p))
+    {
+      continue;
+    }
+    // At its own tempo while there is none. Pitched samples are read
+    // faster or slower, stretched as much the other way they keep it.
+    const double bpm = _stretchBpm > 0 ? _stretchBpm : sample->Play.Bpm;
+    _stretcher->stretch(bank, sample->PlayerIndex, source,
+        sample->Play.Bpm / bpm * exp2(sample->Play.Pitch / 12.));
+  }
+}
+
+void PiSample::checkLoop(int bank, int pad) const
+{
+  if (bank >= int(_banks.size()) or pad >= atom::NumPads or
+      not _banks[bank][pad].has_value())
+  {
+    return;
+  }
+  const auto& play = _banks[bank][pad]->Play;
+  auto source = _loader->bank(bank);
+  const int index = _banks[bank][pad]->PlayerIndex;
+  if (play.Mode != PlayMode::Loop or play.LoopEnd < 0 or not source or
+      index >= int(source->Samples.size()))
+  {
+    return;
+  }
+  // Only known once decoded, the file was checked for the rest.
+  const long frames = source->Samples[index].frames();
+  if (play.LoopEnd > frames) {
+    logger.error("{}: LoopEnd of Bank{}.Pad{} is {}, past the end of its "
+        "sample at {} frames, the loop ends with the sample", _samplesFile,
+        bank + 1, pad + 1, play.LoopEnd, frames);
+  }
+}
+
+void PiSample::turnPitch(int notches)
+{
+  if (_lastPad < 0 or _currentBank >= int(_banks.size()) or
+      not _banks[_currentBank][_lastPad].has_value())
+  {
+    return;
+  }
+  auto& play = _banks[_currentBank][_lastPad]->Play;
+  play.Pitch = clamp(play.Pitch + notches, -PlaySettings::MaxPitch,
+      PlaySettings::MaxPitch);
+  logger.info("Pad {} pitched {:+} semitones", _lastPad + 1, play.Pitch);
+  _sequencer.setBank(_currentBank, sounds(_currentBank));
+  stretch(_currentBank);
+}
+
 void PiSample::poll()
 {
+  showBeat();
+  _sequencer.poll(currentBeat());
+
+  vector<pair<int, int>> readyPads;
+  {
+    unique_lock lock(_reloadMutex);
+    readyPads = move(_readyPads);
+    _readyPads.clear();
+    if (_pendingReload) {
+      auto reload = move(*_pendingReload);
+      _pendingReload.reset();
+      lock.unlock();
+      apply(move(reload));
+    }
+  }
+
+  // Those decoded again changed, and can be stretched once decoded.
+  bool restretch = false;
+  for (auto [bank, pad]: readyPads) {
+    _stretcher->forget(bank, pad);
+    restretch |= bank == _currentBank;
+    checkLoop(bank, pad);
+  }
+  if (restretch) {
+    stretch(_currentBank);
+  }
+
   if (_viewAnimTimeout < c::system_clock::now()) {
     _viewAnimTimeout = _viewAnimTimeout.max();
     _views[_currentView]->receiveAccess();
@@ -263,6 +632,14 @@ void PiSample::poll()
   if (_banks.size() == 0) {
     return;
   }
+
+  // A bank that was not loaded yet lights up as its samples are decoded.
+  bool redraw = any_of(readyPads.begin(), readyPads.end(),
+      [this](auto& ready) { return ready.first == _currentBank; });
+  if (redraw) {
+    pads().reset(); // the animation of an empty bank
+    onAccess();
+  }
 }
 
 void PiSample::onAccess()
@@ -272,13 +649,11 @@ void PiSample::onAccess()
     pads().startPlaying(caterpillar(), true);
     return;
   }
-  std::cout << "access" << std::endl;
 
   bool allOff = true;
   for (unsigned i = 0; i < _banks[_currentBank].size(); ++i) {
     auto& p = _banks[_currentBank][i];
-    if (p.has_value()) {
-      std::cout << "coin " << i << std::endl;
+    if (p.has_value() and _loader->ready(_currentBank, i)) {
       pads().setPad(
         atom::Pad::One + i,
         atom::PadMode::On,
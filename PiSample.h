@@ -1,12 +1,20 @@
 #pragma once
 
 #include "Alsa.h"
+#include "BankLoader.h"
 #include "Device.h"
+#include "FileWatcher.h"
+#include "MidiClock.h"
 #include "PadsAccess.h"
 #include "Player.h"
 #include "Recorder.h"
+#include "Sequencer.h"
+#include "Stretcher.h"
+#include "Tempo.h"
 
 #include <filesystem>
+#include <memory>
+#include <mutex>
 
 namespace ps
 {
@@ -19,8 +27,47 @@ public:
   {
     return {
       { "samples", {
-        .Doc = "An .ini with the list of samples and pages",
+        .Doc = "An .ini with the list of samples and pages. The patterns of "
+        "the sequencer are saved next to it, with a .patterns extension.",
         .Value = std::nullopt,
+      } },
+      { "no-sample-reload", {
+        .Doc = "Do not watch the samples file and the samples for changes",
+        .Value = "false",
+        .Flag = true,
+      } },
+      { "bank-image", {
+        .Doc = "Samples compiled by --compile-banks, used instead of the "
+        "samples file while it is up to date. Empty for the samples file with "
+        "a .bank extension.",
+        .Value = "",
+      } },
+      { "compile-banks", {
+        .Doc = "Decode the samples file for the card into the bank image, "
+        "then exit",
+        .Value = "false",
+        .Flag = true,
+      } },
+      { "verify-bank-image", {
+        .Doc = "Also check the audio of the bank image, which reads it all",
+        .Value = "false",
+        .Flag = true,
+      } },
+      { "bank-memory-mb", {
+        .Doc = "Decoded samples kept in memory, the least recently played "
+        "banks are dropped beyond that. 0 for no limit.",
+        .Value = "256",
+      } },
+      { "bank-lookahead", {
+        .Doc = "Banks decoded ahead on each side of the current one, so that "
+        "paging to them is instant",
+        .Value = "1",
+      } },
+      { "stretch-memory-mb", {
+        .Doc = "Samples time-stretched to the tempo (see Bpm in the samples "
+        "file) kept in memory, per ratio so that tempos already played are "
+        "instant. 0 for no limit.",
+        .Value = "64",
       } }
     };
   }
@@ -30,11 +77,15 @@ public:
     Device& device,
     Pads& pads,
     Recorder& recorder,
-    Player& player);
+    Player& player,
+    MidiClock& clock);
 
   /// Tell other components to shutdown
   ~PiSample();
 
+  /// --compile-banks, `player` decodes the samples for its card.
+  static void compileBanks(const ArgMap& args, Player& player);
+
   bool shutdown() const { return _willShutdown; }
 
   /// Manage background task or any animation that may be running
@@ -45,8 +96,9 @@ private:
   struct Sample
   {
     std::string Name;
-    int PlayerIndex = -1;
+    int PlayerIndex = -1; // in the player bank of the same index
     atom::Color Color;
+    PlaySettings Play;
   };
 
   enum class Views
@@ -71,24 +123,84 @@ private:
   void event(atom::Control c) override;
 
   void cycleView(bool next);
+  void changeBank(int delta);
+
+  /// Tapped on the Click button, else of the MIDI clock followed, else
+  /// detected on the input, if any.
+  Beat currentBeat() const;
+  /// When a hit of a pad that plays with `settings` starts, to give to the
+  /// player. Default (now) without a tempo or quantization.
+  c::steady_clock::time_point startOf(const PlaySettings& settings) const;
+  /// The Click button blinks on the beat, the delay, the MIDI clock sent and
+  /// the samples with a tempo follow it.
+  void showBeat();
+  /// Samples of `bank` with a tempo, stretched to the one playing and to
+  /// their pitch, which would change it.
+  void stretch(int bank);
+  /// Of the last pad hit in the Sampler view, from its next hit on and
+  /// until the samples file is read again.
+  void turnPitch(int notches);
+  /// Reports a LoopEnd past the end of the sample of `pad`, once decoded.
+  void checkLoop(int bank, int pad) const;
+
+  /// A "page" of samples - i.e. 16 pads worth off.
+  using Bank = std::array<std::optional<Sample>, 16>;
+
+  /// What a sample was read from, files are only decoded again when this
+  /// changes.
+  struct FileStamp
+  {
+    std::filesystem::path Path;
+    std::filesystem::file_time_type Time;
+    uintmax_t Size = 0;
 
-  void finalizeSample(std::optional<Sample>& sample, std::filesystem::path file);
-  void loadBanks(std::string_view filename);
+    /// nullopt when the file cannot be read.
+    static std::optional<FileStamp> of(const std::filesystem::path&);
+
+    bool operator==(const FileStamp& other) const
+    {
+      return Path == other.Path and Time == other.Time and Size == other.Size;
+    }
+  };
+
+  /// The samples file as parsed, and what the loader makes of it. When built
+  /// by the watching thread, the plans are given to the loader right away
+  /// and the rest is applied by `poll`.
+  struct Reload
+  {
+    std::vector<Bank> Banks;
+    std::vector<BankLoader::Plan> Plans;
+    std::vector<std::shared_ptr<const SampleBank>> Loaded; // from an image
+    std::vector<std::filesystem::path> Files; // to watch
+  };
+
+  /// Parse the samples file and tell which files changed since the last
+  /// call, nothing is decoded. Throws on errors, nothing is changed then.
+  Reload reloadBanks();
+  /// Same from a bank image, nullopt when it cannot be used.
+  std::optional<Reload> loadImage(const std::filesystem::path&, bool verify);
+  /// With the output of the player named `output`, the main one when empty
+  /// or unknown.
+  PlaySettings routed(PlaySettings, std::string_view output) const;
+  void apply(Reload&&);
+  /// What the pads of `bank` play, for the sequencer.
+  Sequencer::Sounds sounds(int bank) const;
 
   void onAccess() override;
 
   Device& _device;
   Recorder& _recorder;
   Player&  _player;
-
-  /// A "page" of samples - i.e. 16 pads worth off.
-  using Bank = std::array<std::optional<Sample>, 16>;
+  MidiClock& _clock;
+  std::filesystem::path _samplesFile;
 
   std::vector<Bank> _banks;
   int _currentBank = 0;
 
+  Sequencer _sequencer;
+
   std::array<PadsAccess*, (unsigned)Views::LastView> _views = {
-    this, &_recorder, &_player
+    this, &_sequencer, &_recorder
   };
   int _currentView;
   // When the display is changed to another component, we first give an indication
@@ -101,6 +213,28 @@ private:
   bool _shiftPressed = false;
   bool _stopPressed = false;
   bool _willShutdown = false;
+
+  TapTempo _tap;
+  double _bpm = 0; // as last given to the effects
+  double _stretchBpm = 0; // to 0.1 BPM, as last stretched to
+  int _lastPad = -1; // hit in the Sampler view
+  bool _clickOn = false;
+
+  // ------- members below are only used by reloadBanks, one at a time ------ //
+  std::vector<std::array<std::optional<FileStamp>, 16>> _stamps;
+  // ---------------------------------------------------------------------- //
+
+  std::mutex _reloadMutex;
+  // ---------- members below must be accessed under the mutex ------------ //
+  std::optional<Reload> _pendingReload;
+  std::vector<std::pair<int, int>> _readyPads; // bank and pad, to light up
+  // ---------------------------------------------------------------------- //
+
+  std::unique_ptr<BankLoader> _loader;
+  std::unique_ptr<Stretcher> _stretcher;
+
+  // Last, so that it stops before anything it uses is destroyed.
+  std::unique_ptr<FileWatcher> _watcher;
 };
 
 }
\ No newline at end of file
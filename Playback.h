@@ -0,0 +1,121 @@
+#pragma once
+
+/// \file How a pad plays its sample, as given in the samples file.
+
+#include <string_view>
+
+namespace ps
+{
+  enum class PlayMode
+  {
+    /// Plays to the end, whatever happens to the pad.
+    OneShot,
+    /// Stops when the pad is released.
+    Gate,
+    /// Loops until the pad is hit again.
+    Loop,
+  };
+
+  /// What hitting a pad that is still playing does, except in PlayMode::Loop.
+  enum class RetriggerMode
+  {
+    /// Plays again from the start, the previous voice fades out.
+    Restart,
+    /// Plays again on top of the previous voice.
+    Overlap,
+    /// Does nothing until the previous voice is done.
+    Ignore,
+  };
+
+  /// Where a pad hit starts, given a tempo (see PiSample). Without one, or
+  /// when Off, it starts right away.
+  enum class QuantizeMode
+  {
+    Off,
+    /// On the next beat.
+    Beat,
+    /// On the next first beat of a bar.
+    Bar,
+  };
+
+  struct PlaySettings
+  {
+    /// Of Pitch, either way.
+    static constexpr int MaxPitch = 24;
+
+    PlayMode Mode = PlayMode::OneShot;
+    // Frames at the rate of the card, the same as the file's unless it was
+    // resampled. LoopEnd is exclusive, -1 for the end of the sample.
+    long LoopStart = 0;
+    long LoopEnd = -1;
+    /// Pads of the same group (> 0) cut each other.
+    int Choke = 0;
+    RetriggerMode Retrigger = RetriggerMode::Overlap;
+    // Of the fade in when starting, and of the fade out when stopped.
+    int AttackMs = 0;
+    int ReleaseMs = 5;
+    /// Stereo output of the player, see Player::output.
+    int Output = 0;
+    /// Not used by the player itself, which is given when to start.
+    QuantizeMode Quantize = QuantizeMode::Off;
+    /// In semitones, the sample is read faster or slower.
+    int Pitch = 0;
+    /// Of the sample, 0 for none. Samples with a tempo are time-stretched to
+    /// the one playing, at the same pitch (see Stretcher).
+    double Bpm = 0;
+  };
+
+  /// "oneshot", "gate" or "loop", nothing otherwise.
+  inline bool parsePlayMode(std::string_view str, PlayMode& mode)
+  {
+    if (str == "oneshot") {
+      mode = PlayMode::OneShot;
+    }
+    else if (str == "gate") {
+      mode = PlayMode::Gate;
+    }
+    else if (str == "loop") {
+      mode = PlayMode::Loop;
+    }
+    else {
+      return false;
+    }
+    return true;
+  }
+
+  /// "restart", "overlap" or "ignore", nothing otherwise.
+  inline bool parseRetrigger(std::string_view str, RetriggerMode& retrigger)
+  {
+    if (str == "restart") {
+      retrigger = RetriggerMode::Restart;
+    }
+    else if (str == "overlap") {
+      retrigger = RetriggerMode::Overlap;
+    }
+    else if (str == "ignore") {
+      retrigger = RetriggerMode::Ignore;
+    }
+    else {
+      return false;
+    }
+    return true;
+  }
+
+  /// "off", "beat" or "bar", nothing otherwise.
+  inline bool parseQuantize(std::string_view str, QuantizeMode& quantize)
+  {
+    if (str == "off") {
+      quantize = QuantizeMode::Off;
+    }
+    else if (str == "beat") {
+      quantize = QuantizeMode::Beat;
+    }
+    else if (str == "bar") {
+      quantize = QuantizeMode::Bar;
+    }
+    else {
+      return false;
+    }
+    return true;
+  }
+}
\ No newline at end of file
@@ -1,6 +1,13 @@
 #include "Player.h"
+#include "Frames.h"
 #include "Log.h"
+#include "Resampler.h"
 #include "ffmpeg.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 using namespace ps;
 using namespace std;
@@ -12,6 +19,11 @@ namespace
 {
   auto logger = Log("PLAY");
 
+  // Plays waiting for their frame, those beyond are dropped. Two bars of a
+  // full pattern of the sequencer (2 * 16 steps * 16 pads) fit, with as
+  // much room for pads hit on the beat.
+  constexpr size_t MaxScheduled = 1024;
+
   array<int, 2> parseChannels(const string& str)
   {
     auto it = str.find(',');
@@ -23,6 +35,41 @@ namespace
     result[1] = stoi(str.substr(it + 1));
     return result;
   }
+
+  /// "cue=8,9 fx=2,3"
+  vector<pair<string, array<int, 2>>> parseOutputs(const string& str)
+  {
+    vector<pair<string, array<int, 2>>> result;
+    size_t start = 0;
+    while ((start = str.find_first_not_of(' ', start)) != string::npos) {
+      auto end = str.find(' ', start);
+      string output = str.substr(start, end - start);
+      auto equal = output.find('=');
+      if (equal == string::npos or equal == 0) {
+        throw Exception("Invalid " AUDIO_OUT "outputs '{}', expecting "
+            "name=left,right", output);
+      }
+      result.emplace_back(
+          output.substr(0, equal), parseChannels(output.substr(equal + 1)));
+      start = end;
+    }
+    return result;
+  }
+
+  optional<SamplePrecision> parsePrecision(const string& str)
+  {
+    if (str == "auto") {
+      return nullopt;
+    }
+    if (str == "16") {
+      return SamplePrecision::Int16;
+    }
+    if (str == "float") {
+      return SamplePrecision::Float;
+    }
+    throw Exception("Invalid " AUDIO_OUT "sample-precision '{}', expecting "
+        "auto, 16 or float", str);
+  }
 }
 
 ArgMap Player::args()
@@ -36,9 +83,29 @@ ArgMap Player::args()
       .Doc = "The channels to replay sound on (stereo).",
       .Value = "0,1"
     } },
+    { AUDIO_OUT "outputs"s, {
+      .Doc = "More stereo outputs that pads can be routed to with Output= in "
+      "the samples file, as name=left,right separated by spaces, e.g. "
+      "'cue=8,9'. The main output is " AUDIO_OUT "channels.",
+      .Value = ""
+    } },
+    { AUDIO_OUT "tempo"s, {
+      .Doc = "Tempo in BPM the delay of the effects is synced to.",
+      .Value = "120"
+    } },
     { AUDIO_OUT "channel-count"s, {
       .Doc = "The total number of channels on the device if it cannot be guessed",
       .Value = "-1"
+    } },
+    { AUDIO_OUT "resample-quality"s, {
+      .Doc = "fast, medium or best. Samples are converted to the rate of the "
+      "card when loaded.",
+      .Value = "best"
+    } },
+    { AUDIO_OUT "sample-precision"s, {
+      .Doc = "How samples are kept in memory: 16, float, or auto to use 16 "
+      "bits for 16 bit sources only.",
+      .Value = "auto"
     } }
   };
 }
@@ -46,16 +113,69 @@ ArgMap Player::args()
 Player::Player(const ArgMap& args, Pads& pads)
   : PadsAccess(pads)
   , _interface(* args.find(AUDIO_OUT "card")->second.Value)
+  , _resampleQuality(parseResampleQuality(
+        * args.find(AUDIO_OUT "resample-quality")->second.Value))
+  , _precision(parsePrecision(
+        * args.find(AUDIO_OUT "sample-precision")->second.Value))
   , _outputChannelCount(stoi(* args.find(AUDIO_OUT "channel-count")->second.Value))
   , _channels(parseChannels(* args.find(AUDIO_OUT "channels")->second.Value))
+  , _outputs(parseOutputs(* args.find(AUDIO_OUT "outputs")->second.Value))
   , _out(_interface, SND_PCM_STREAM_PLAYBACK, _outputChannelCount, _channels)
+  , _writeFrames(writeFramesFor(_out.Format.Bits))
+  , _effects(_out.Format.Rate, stof(* args.find(AUDIO_OUT "tempo")->second.Value))
 {
   if (_outputChannelCount == -1) {
     _outputChannelCount = _out.Format.Channels;
   }
+  _outputs.insert(_outputs.begin(), {"main", _channels});
+  vector<bool> used(_outputChannelCount);
+  for (auto& [name, channels]: _outputs) {
+    for (int channel: channels) {
+      if (channel < 0 or channel >= _outputChannelCount or used[channel]) {
+        throw Exception("Channel {} of output {} is out of the {} channels of "
+            "the card or used by another output", channel, name,
+            _outputChannelCount);
+      }
+      used[channel] = true;
+    }
+  }
+
+  snd_pcm_uframes_t bufferSize = 0;
+  snd_pcm_uframes_t periodSize = 0;
+  if (snd_pcm_get_params(_out.Ptr, &bufferSize, &periodSize) < 0 or
+      periodSize == 0)
+  {
+    periodSize = _out.Format.Rate / 100;
+  }
+  _periodFrames = periodSize;
+  // Short enough to keep up with fast playing, long enough not to click.
+  _fadeFrames = _out.Format.Rate / 200;
+
+  // Everything the playing thread uses is allocated here.
+  _samples.resize(MaxSamples);
+  _banks.resize(MaxBanks);
+  _stretched.resize(MaxBanks * atom::NumPads);
+  _commands.reserve(64);
+  _received.reserve(64);
+  _scheduled.reserve(MaxScheduled);
+  _mix.resize(_periodFrames * 2 * _outputs.size());
+  for (size_t o = 0; o < _outputs.size(); ++o) {
+    for (int side = 0; side < 2; ++side) {
+      _planes.push_back(_mix.data() + (2 * o + side) * _periodFrames);
+      _routes.push_back(_outputs[o].second[side]);
+    }
+  }
+  _gains.resize(_periodFrames);
+  for (int i = 0; i <= RampSize; ++i) {
+    _rise[i] = 0.5f - 0.5f * cos(float(M_PI) * i / RampSize);
+    _fall[RampSize - i] = _rise[i];
+  }
+  _outBuf.resize(
+      _periodFrames * _outputChannelCount * storageBytes(_out.Format.Bits));
 
   logger.info("Will output sounds at rate={}, bits={}, total available "
-      "channels {}", _out.Format.Rate, _out.Format.Bits, _outputChannelCount);
+      "channels {}, period {} frames, {} outputs", _out.Format.Rate,
+      _out.Format.Bits, _outputChannelCount, _periodFrames, _outputs.size());
 
   _thread = thread([this]{ run(); });
 }
@@ -70,26 +190,769 @@ Player::~Player()
 
 void Player::run()
 {
+  trace::setThreadName("play");
   while (!_stop) {
-    this_thread::sleep_for(c::milliseconds(1));
+    // Wakes up once a period can be written.
+    int res = snd_pcm_wait(_out.Ptr, 100 /*ms*/);
+    if (res == 0) {
+      continue;
+    }
+    snd_pcm_sframes_t avail = res < 0 ? res : snd_pcm_avail_update(_out.Ptr);
+    if (avail < 0) {
+      if (_writeErrors++ == 0) {
+        logger.warn("First playback error: {} ({})", AlsaErr{avail}, avail);
+      }
+      if (snd_pcm_recover(_out.Ptr, avail, true /*silent*/) < 0) {
+        logger.error("Failed to recover after playback error, stopping...");
+        return;
+      }
+      continue;
+    }
+    if (avail < _periodFrames) {
+      continue;
+    }
+
+    // What is written now is heard once the card played what it holds.
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(_out.Ptr, &delay) < 0) {
+      delay = 0;
+    }
+    _heardAt = c::steady_clock::now() +
+        c::microseconds(int64_t(delay) * 1'000'000 / _out.Format.Rate);
+
+    receive();
+    startDue(_periodFrames);
+    {
+      PS_TRACE_SCOPE("Player::mix");
+      mix(_periodFrames);
+    }
+    _effects.process(_mix.data(), _mix.data() + _periodFrames, _periodFrames);
+    writeOut(_periodFrames);
+    _frame += _periodFrames;
   }
 }
 
-int Player::load(FrameFormat, std::vector<uint8_t>&& /*bytes*/)
+void Player::receive()
 {
-  return -1;
+  if (not _updated.load(memory_order_acquire) and not _retiring) {
+    return;
+  }
+  // Never wait on load, we will get it next period.
+  unique_lock lock(_mutex, try_to_lock);
+  if (not lock.owns_lock()) {
+    return;
+  }
+  _updated = false;
+  _retiring = false;
+
+  // Voices on what is swapped out fade out on it rather than stop with a
+  // click, it is kept until they are done.
+  for (auto& [index, data]: _nextSamples) {
+    if (index == Retiring) {
+      index = retiredOn(data) ? Retiring : Swapped;
+    }
+    if (index < 0) {
+      _retiring |= index == Retiring;
+      continue;
+    }
+    swap(_samples[index], data);
+    for (auto& voice: _voices) {
+      if (voice.Bank < 0 and voice.Sample == index and voice.Retired.empty()) {
+        retire(voice, data, data.frames());
+      }
+    }
+    index = retiredOn(data) ? Retiring : Swapped;
+    _retiring |= index == Retiring;
+  }
+  // The bank is visible as a whole from this period on.
+  for (auto& [index, bank]: _nextBanks) {
+    if (index == Retiring) {
+      index = retiredOn(*bank) ? Retiring : Swapped;
+    }
+    if (index < 0) {
+      _retiring |= index == Retiring;
+      continue;
+    }
+    swap(_banks[index], bank);
+    const auto& current = _banks[index];
+    for (auto& voice: _voices) {
+      if (voice.Bank == index and voice.Sample >= 0 and
+          voice.Retired.empty() and bank and
+          voice.Sample < int(bank->Samples.size()) and
+          (not current or voice.Sample >= int(current->Unchanged.size()) or
+           not current->Unchanged[voice.Sample]))
+      {
+        const auto& original = bank->Samples[voice.Sample];
+        const auto* stretched = this->stretched(voice);
+        retire(voice, stretched ? *stretched : original, original.frames());
+      }
+    }
+    index = bank and retiredOn(*bank) ? Retiring : Swapped;
+    _retiring |= index == Retiring;
+  }
+  for (auto& [slot, stretched]: _nextStretched) {
+    if (slot == Retiring) {
+      slot = retiredOn(*stretched) ? Retiring : Swapped;
+    }
+    if (slot < 0) {
+      _retiring |= slot == Retiring;
+      continue;
+    }
+    // Voices on it go on from the same place, e.g. as the tempo moves.
+    const int bank = slot / atom::NumPads;
+    const int sample = slot % atom::NumPads;
+    const SampleBuffer* original = _banks[bank] and
+        sample < int(_banks[bank]->Samples.size()) ?
+        &_banks[bank]->Samples[sample] : nullptr;
+    const SampleBuffer* before = _stretched[slot] ? _stretched[slot].get() : original;
+    const SampleBuffer* after = stretched ? stretched.get() : original;
+    swap(_stretched[slot], stretched);
+    for (auto& voice: _voices) {
+      if (voice.Sample == sample and voice.Bank == bank and
+          voice.Retired.empty() and voice.Settings.Bpm > 0 and before and
+          after and before->frames() > 0)
+      {
+        const double position = (voice.Position + voice.Fraction) *
+            after->frames() / before->frames();
+        voice.Position = long(position);
+        voice.Fraction = voice.Step == 1 ? 0 : position - voice.Position;
+      }
+    }
+    slot = stretched and retiredOn(*stretched) ? Retiring : Swapped;
+    _retiring |= slot == Retiring;
+  }
+  // Both keep their capacity, nothing is allocated nor freed.
+  _received.swap(_commands);
+  lock.unlock();
+
+  for (auto& command: _received) {
+    switch (command.Type) {
+      case Command::Play: {
+        // From the start of the next period, negative when late.
+        const int64_t offset = command.At == c::steady_clock::time_point{} ?
+            0 : c::duration_cast<c::microseconds>(
+                command.At - _heardAt).count() * _out.Format.Rate / 1'000'000;
+        if (offset >= _periodFrames) {
+          if (_scheduled.size() >= MaxScheduled) {
+            // Better not heard than heard early, off the beat.
+            if (_droppedPlays++ == 0) {
+              logger.warn("More than {} plays scheduled, dropping those "
+                  "beyond", MaxScheduled);
+            }
+            break;
+          }
+          command.Frame = _frame + offset;
+          _scheduled.push_back(command);
+          break;
+        }
+        start(command, clamp<int64_t>(offset, 0, _periodFrames - 1));
+        break;
+      }
+      case Command::Release:
+        // A gate play released before it started is over.
+        _scheduled.erase(
+            remove_if(begin(_scheduled), end(_scheduled), [&](auto& play) {
+              return play.Bank == command.Bank and
+                  play.Sample == command.Sample and
+                  play.Settings.Mode == PlayMode::Gate;
+            }),
+            end(_scheduled));
+        for (auto& voice: _voices) {
+          if (voice.plays(command.Bank, command.Sample) and
+              voice.Settings.Mode == PlayMode::Gate)
+          {
+            fadeOut(voice);
+          }
+        }
+        break;
+      case Command::Stop:
+        _scheduled.erase(
+            remove_if(begin(_scheduled), end(_scheduled), [&](auto& play) {
+              return command.Sample < 0 or
+                  (play.Sample == command.Sample and play.Bank == command.Bank);
+            }),
+            end(_scheduled));
+        for (auto& voice: _voices) {
+          if (voice.active() and (command.Sample < 0 or
+              (voice.Sample == command.Sample and voice.Bank == command.Bank)))
+          {
+            fadeOut(voice);
+          }
+        }
+        break;
+      case Command::Cancel:
+        _scheduled.erase(
+            remove_if(begin(_scheduled), end(_scheduled), [&](auto& play) {
+              return play.Sample == command.Sample and
+                  play.Bank == command.Bank;
+            }),
+            end(_scheduled));
+        break;
+    }
+  }
+  _received.clear();
+}
+
+void Player::startDue(long frames)
+{
+  for (size_t i = 0; i < _scheduled.size();) {
+    auto& command = _scheduled[i];
+    if (command.Frame >= _frame + frames) {
+      ++i;
+      continue;
+    }
+    start(command, long(max(command.Frame, _frame) - _frame));
+    // The order does not matter, each knows its frame.
+    command = _scheduled.back();
+    _scheduled.pop_back();
+  }
+}
+
+void Player::start(const Command& command, long delay)
+{
+  if (command.Bank >= 0 and
+      (not _banks[command.Bank] or
+       command.Sample >= int(_banks[command.Bank]->Samples.size())))
+  {
+    return; // bank not received (yet)
+  }
+  const auto& settings = command.Settings;
+  const bool playing = any_of(begin(_voices), end(_voices),
+      [&](auto& v) { return v.plays(command.Bank, command.Sample); });
+  if (playing) {
+    // Hitting a looping pad again stops it.
+    if (settings.Mode == PlayMode::Loop or
+        settings.Retrigger == RetriggerMode::Restart)
+    {
+      for (auto& voice: _voices) {
+        if (voice.plays(command.Bank, command.Sample)) {
+          fadeOut(voice, settings.Mode == PlayMode::Loop ? -1 : _fadeFrames);
+        }
+      }
+    }
+    if (settings.Mode == PlayMode::Loop or
+        settings.Retrigger == RetriggerMode::Ignore)
+    {
+      return;
+    }
+  }
+  int active = 0;
+  Voice* oldest = nullptr;
+  for (auto& voice: _voices) {
+    if (not voice.active()) {
+      continue;
+    }
+    if (settings.Choke > 0 and voice.Settings.Choke == settings.Choke) {
+      fadeOut(voice, _fadeFrames);
+      continue;
+    }
+    ++active;
+    if (not oldest or voice.Started < oldest->Started) {
+      oldest = &voice;
+    }
+  }
+  if (active >= MaxVoices) {
+    fadeOut(*oldest, _fadeFrames);
+  }
+
+  // A free voice, or the one closest to the end of its fade.
+  Voice* free = nullptr;
+  auto left = [](const Voice& v) { return v.Gain.Length - v.Gain.Frame; };
+  for (auto& voice: _voices) {
+    if (voice.Sample < 0) {
+      free = &voice;
+      break;
+    }
+    if (not voice.active() and (not free or left(voice) < left(*free))) {
+      free = &voice;
+    }
+  }
+  const long attack = long(settings.AttackMs) * _out.Format.Rate / 1000;
+  *free = Voice{
+    .Sample = command.Sample,
+    .Bank = command.Bank,
+    .Position = 0,
+    .Step = exp2(settings.Pitch / 12.),
+    .Settings = settings,
+    .Started = ++_voiceClock,
+    .Gain = {
+      .Stage = attack > 0 ? Envelope::Attack : Envelope::Sustain,
+      .Frame = 0,
+      .Length = attack,
+    },
+    .Delay = delay,
+  };
+  auto& output = free->Settings.Output;
+  if (output < 0 or output >= int(_outputs.size())) {
+    output = 0;
+  }
+}
+
+void Player::fadeOut(Voice& voice, long frames)
+{
+  auto& envelope = voice.Gain;
+  if (envelope.Stage == Envelope::Release) {
+    return;
+  }
+  if (frames < 0) {
+    frames = long(voice.Settings.ReleaseMs) * _out.Format.Rate / 1000;
+  }
+  frames = max(frames, 1l);
+  // From the gain reached so far, the ramps mirror each other.
+  const double reached = envelope.Stage == Envelope::Attack ?
+      double(envelope.Frame) / envelope.Length : 1.;
+  envelope = Envelope{
+    .Stage = Envelope::Release,
+    .Frame = long((1. - reached) * frames),
+    .Length = frames,
+  };
+}
+
+void Player::envelopeGains(const Envelope& envelope, long count)
+{
+  const float* ramp =
+      envelope.Stage == Envelope::Attack ? _rise.data() : _fall.data();
+  const float scale = float(RampSize) / envelope.Length;
+  float* gains = _gains.data();
+  for (long i = 0; i < count; ++i) {
+    const float x = (envelope.Frame + i) * scale;
+    const int k = min(int(x), RampSize - 1);
+    const float t = x - k;
+    gains[i] = ramp[k] + t * (ramp[k + 1] - ramp[k]);
+  }
+}
+
+void Player::mix(long frames)
+{
+  fill(begin(_mix), end(_mix), 0.f);
+  for (auto& voice: _voices) {
+    if (voice.Sample < 0) {
+      continue;
+    }
+    float* left = _mix.data() + 2 * voice.Settings.Output * _periodFrames;
+    float* right = left + _periodFrames;
+    const SampleBuffer* source = &voice.Retired;
+    double scale = voice.RetiredScale;
+    if (source->empty()) {
+      const auto& original = voice.Bank < 0 ?
+          _samples[voice.Sample] : _banks[voice.Bank]->Samples[voice.Sample];
+      if (original.empty()) {
+        voice.Sample = -1; // nothing loaded there
+        continue;
+      }
+      const auto* stretched = this->stretched(voice);
+      source = stretched ? stretched : &original;
+      scale = double(source->frames()) / original.frames();
+    }
+    const auto& data = *source;
+    // Loop points out of the sample fall back to the whole sample. They are
+    // of the original, moved along when stretched, those rounded down to
+    // nothing to loop fall back too.
+    const bool loops = voice.Settings.Mode == PlayMode::Loop;
+    long end = data.frames();
+    long loopStart = 0;
+    if (loops) {
+      const long loopEnd = long(voice.Settings.LoopEnd * scale);
+      if (loopEnd > 0) {
+        end = min(end, loopEnd);
+      }
+      if (long(voice.Settings.LoopStart * scale) < end) {
+        loopStart = max(0l, long(voice.Settings.LoopStart * scale));
+      }
+    }
+    // Pitched voices are resampled as they are mixed, a little slower.
+    const bool pitched = voice.Step != 1;
+    auto add = [&](long at, long count, const float* gains) {
+      if (pitched) {
+        data.mixResampled(left + at, right + at,
+            voice.Position + voice.Fraction, voice.Step, count, gains);
+      }
+      else if (gains) {
+        data.mixInto(left + at, right + at, voice.Position, count, gains);
+      }
+      else {
+        data.mixInto(left + at, right + at, voice.Position, count);
+      }
+    };
+
+    // Split where the envelope changes stage, so that a voice in sustain
+    // is mixed as is and others multiply by a table, never testing per frame.
+    // A voice just started may only begin further in the period.
+    long done = voice.Delay;
+    voice.Delay = 0;
+    // Passes in a row that mixed nothing. One is the end of the loop read,
+    // two are a loop with nothing in it, never ending.
+    int stalled = 0;
+    while (done < frames and voice.Sample >= 0) {
+      // Frames mixed until the end is read.
+      long count = min(frames - done, pitched ?
+          long(ceil((end - voice.Position - voice.Fraction) / voice.Step)) :
+          end - voice.Position);
+      count = max(count, 0l);
+      auto& envelope = voice.Gain;
+      if (envelope.Stage == Envelope::Sustain) {
+        add(done, count, nullptr);
+      }
+      else {
+        PS_TRACE_SCOPE("Player::envelope");
+        count = min(count, envelope.Length - envelope.Frame);
+        envelopeGains(envelope, count);
+        add(done, count, _gains.data());
+        envelope.Frame += count;
+        if (envelope.Frame >= envelope.Length) {
+          if (envelope.Stage == Envelope::Attack) {
+            envelope = Envelope{};
+          }
+          else {
+            voice.Sample = -1;
+          }
+        }
+      }
+      if (pitched) {
+        const double position = voice.Position + voice.Fraction +
+            count * voice.Step;
+        voice.Position = long(position);
+        voice.Fraction = position - voice.Position;
+      }
+      else {
+        voice.Position += count;
+      }
+      done += count;
+      stalled = count > 0 ? 0 : stalled + 1;
+      if (stalled > 1) {
+        voice.Sample = -1;
+        break;
+      }
+      if (voice.Position >= end) {
+        if (loops) {
+          voice.Position = loopStart;
+        }
+        else {
+          voice.Sample = -1;
+        }
+      }
+    }
+  }
+}
+
+void Player::writeOut(long frames)
+{
+  _writeFrames(_planes.data(), _routes.data(), _planes.size(), frames,
+      _outputChannelCount, _outBuf.data());
+
+  auto res = snd_pcm_writei(_out.Ptr, _outBuf.data(), frames);
+  if (res < 0) {
+    if (_writeErrors++ == 0) {
+      logger.warn("First playback error: {} ({})", AlsaErr{res}, res);
+    }
+    snd_pcm_recover(_out.Ptr, res, true /*silent*/);
+  }
+}
+
+SamplePrecision Player::precision(int bits) const
+{
+  if (_precision) {
+    return *_precision;
+  }
+  return bits <= 16 ? SamplePrecision::Int16 : SamplePrecision::Float;
+}
+
+SampleBuffer Player::prepare(SampleBuffer&& data, int rate) const
+{
+  if (rate == _out.Format.Rate or data.empty()) {
+    return move(data);
+  }
+  PS_LOG_TIME(logger, "resampling {}",
+      fmt::format("from {}Hz to {}Hz", rate, _out.Format.Rate))
+  {
+    auto in = data.interleaved();
+    auto out = resample(in.data(), data.frames(), data.channels(), rate,
+        _out.Format.Rate, _resampleQuality);
+    data = SampleBuffer::fromInterleaved(data.precision(), out.data(),
+        data.channels(), out.size() / data.channels());
+  };
+  return move(data);
+}
+
+int Player::add(SampleBuffer&& data, int replace, int rate)
+{
+  data = prepare(move(data), rate);
+
+  int index = replace;
+  if (index < 0) {
+    if (_count >= MaxSamples) {
+      logger.error("Cannot load more than {} samples", MaxSamples);
+      return -1;
+    }
+    index = _count++;
+  }
+  else if (index >= _count) {
+    logger.throw_("Replacing sample {} which was never loaded", index);
+  }
+
+  {
+    lock_guard lock(_mutex);
+    // What the thread swapped out of its samples, freeing it here.
+    _nextSamples.erase(
+        remove_if(begin(_nextSamples), end(_nextSamples),
+            [](auto& next) { return next.first == Swapped; }),
+        end(_nextSamples));
+    _nextSamples.emplace_back(index, move(data));
+    _updated = true;
+  }
+  return index;
+}
+
+int Player::load(FrameFormat format, std::vector<uint8_t>&& bytes)
+{
+  auto data = convert(format, bytes);
+  bytes = {};
+  return add(move(data), -1, format.Rate);
+}
+
+SampleBuffer Player::convert(
+    FrameFormat format, const std::vector<uint8_t>& bytes) const
+{
+  const int sampleBytes = storageBytes(format.Bits);
+  const long frames = bytes.size() / (sampleBytes * format.Channels);
+  const float scale = 1.f / (1u << (format.Bits - 1));
+  // Mono is kept mono and played on both sides, only the first two
+  // channels are kept otherwise.
+  const int channels = min(format.Channels, 2);
+
+  SampleBuffer data(precision(format.Bits), channels, frames);
+  for (int c = 0; c < channels; ++c) {
+    const uint8_t* in = bytes.data() + c * sampleBytes;
+    const long step = format.Channels * sampleBytes;
+    if (sampleBytes == 2 and data.precision() == SamplePrecision::Int16) {
+      int16_t* out = data.int16(c);
+      for (long f = 0; f < frames; ++f, in += step) {
+        memcpy(out + f, in, 2);
+      }
+      continue;
+    }
+    for (long f = 0; f < frames; ++f, in += step) {
+      int32_t value;
+      if (sampleBytes == 2) {
+        int16_t s;
+        memcpy(&s, in, 2);
+        value = s;
+      }
+      else {
+        memcpy(&value, in, 4);
+        if (format.Bits == 24) {
+          value = int32_t(uint32_t(value) << 8) >> 8;
+        }
+      }
+      if (data.precision() == SamplePrecision::Int16) {
+        // Keeping the 16 most significant bits.
+        data.int16(c)[f] = int16_t(value >> (format.Bits - 16));
+      }
+      else {
+        data.float32(c)[f] = value * scale;
+      }
+    }
+  }
+  return data;
+}
+
+int Player::load(
+    FrameFormat format, const int32_t* samples, long frames, int replace)
+{
+  const float scale = 1.f / (1u << (format.Bits - 1));
+  SampleBuffer data(precision(format.Bits), 2, frames);
+  for (int c = 0; c < 2; ++c) {
+    for (long f = 0; f < frames; ++f) {
+      int32_t value = samples[f * 2 + c];
+      if (data.precision() == SamplePrecision::Int16) {
+        data.int16(c)[f] = int16_t(value >> (format.Bits - 16));
+      }
+      else {
+        data.float32(c)[f] = value * scale;
+      }
+    }
+  }
+  return add(move(data), replace, format.Rate);
+}
+
+SampleBuffer Player::decode(const std::filesystem::path& path) const
+{
+  AudioData data;
+  PS_LOG_TIME(logger, "loading {}", path) { data = readAudioFile(path); };
+
+  const auto& format = data.Format;
+  if (data.Samples.empty()) {
+    logger.throw_("No audio in {}", path);
+  }
+  if (format.Interleaving != Interleaving_t::Yes or
+      format.Repr != Representation_t::Signed or
+      format.Endianness != Endianness_t::Little)
+  {
+    logger.throw_("Only interleaved signed little endian samples are "
+        "supported for now");
+  }
+  // readAudioFile always gives stereo.
+  return prepare(
+      convert(FrameFormat{format.SampleRate, format.BitDepth, 2}, data.Samples),
+      format.SampleRate);
 }
 
 int Player::load(std::filesystem::path path)
 {
   try {
-    AudioData data;
-    PS_LOG_TIME(logger, "loading {}", path) { data = readAudioFile(path); };
-
-    return -1;
+    auto data = decode(path);
+    return add(move(data), -1, _out.Format.Rate);
   }
   catch (const exception& ex) {
     logger.error("Not loading {} ({})", path, ex.what());
   }
   return -1;
 }
+
+unique_ptr<SampleBank> Player::makeBank(
+    const vector<std::filesystem::path>& paths,
+    const SampleBank* previous, const vector<bool>& keep)
+{
+  vector<SampleBuffer> samples(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (paths[i].empty() or (previous and i < keep.size() and keep[i])) {
+      continue;
+    }
+    try {
+      samples[i] = decode(paths[i]);
+    }
+    catch (const exception& ex) {
+      logger.error("Not loading {} ({})", paths[i], ex.what());
+    }
+  }
+  return SampleBank::pack(move(samples), previous, keep);
+}
+
+void Player::setBank(int index, shared_ptr<const SampleBank> bank)
+{
+  if (index < 0 or index >= MaxBanks) {
+    logger.throw_("Bank {} is out of range, at most {} banks", index, MaxBanks);
+  }
+  lock_guard lock(_mutex);
+  // What the thread swapped out of its banks, freeing it here.
+  _nextBanks.erase(
+      remove_if(begin(_nextBanks), end(_nextBanks),
+          [](auto& next) { return next.first == Swapped; }),
+      end(_nextBanks));
+  _nextBanks.emplace_back(index, move(bank));
+  _updated = true;
+}
+
+void Player::setStretched(
+    int bank, int sample, shared_ptr<const SampleBuffer> stretched)
+{
+  if (bank < 0 or bank >= MaxBanks or sample < 0 or sample >= atom::NumPads) {
+    return;
+  }
+  lock_guard lock(_mutex);
+  // What the thread swapped out, freeing it here.
+  _nextStretched.erase(
+      remove_if(begin(_nextStretched), end(_nextStretched),
+          [](auto& next) { return next.first == Swapped; }),
+      end(_nextStretched));
+  _nextStretched.emplace_back(bank * atom::NumPads + sample, move(stretched));
+  _updated = true;
+}
+
+const SampleBuffer* Player::stretched(const Voice& voice) const
+{
+  if (voice.Bank < 0 or voice.Settings.Bpm <= 0 or
+      voice.Sample >= atom::NumPads)
+  {
+    return nullptr;
+  }
+  return _stretched[voice.Bank * atom::NumPads + voice.Sample].get();
+}
+
+void Player::retire(Voice& voice, const SampleBuffer& data, long originalFrames)
+{
+  voice.Retired = data.view();
+  voice.RetiredScale = originalFrames > 0 ?
+      double(data.frames()) / originalFrames : 1.;
+  fadeOut(voice, _fadeFrames);
+}
+
+bool Player::retiredOn(const SampleBuffer& data) const
+{
+  for (auto& voice: _voices) {
+    if (voice.Sample >= 0 and not voice.Retired.empty() and
+        voice.Retired.data() == data.data())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Player::retiredOn(const SampleBank& bank) const
+{
+  for (auto& sample: bank.Samples) {
+    if (not sample.empty() and retiredOn(sample)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int Player::output(string_view name) const
+{
+  for (size_t o = 0; o < _outputs.size(); ++o) {
+    if (_outputs[o].first == name) {
+      return o;
+    }
+  }
+  return -1;
+}
+
+void Player::push(Command command)
+{
+  lock_guard lock(_mutex);
+  _commands.push_back(command);
+  _updated = true;
+}
+
+void Player::play(int index)
+{
+  if (index < 0 or index >= _count) {
+    logger.warn("Not playing unknown sample {}", index);
+    return;
+  }
+  push(Command{.Type = Command::Play, .Sample = index});
+}
+
+void Player::play(int bank, int sample, const PlaySettings& settings,
+    c::steady_clock::time_point at)
+{
+  if (bank < 0 or bank >= MaxBanks or sample < 0) {
+    logger.warn("Not playing unknown sample {} of bank {}", sample, bank);
+    return;
+  }
+  push(Command{
+    .Type = Command::Play, .Sample = sample, .Bank = bank,
+    .Settings = settings, .At = at});
+}
+
+void Player::release(int bank, int sample)
+{
+  push(Command{.Type = Command::Release, .Sample = sample, .Bank = bank});
+}
+
+void Player::stop(int index)
+{
+  push(Command{.Type = Command::Stop, .Sample = index});
+}
+
+void Player::stop(int bank, int sample)
+{
+  push(Command{.Type = Command::Stop, .Sample = sample, .Bank = bank});
+}
+
+void Player::cancel(int bank, int sample)
+{
+  push(Command{.Type = Command::Cancel, .Sample = sample, .Bank = bank});
+}
@@ -2,12 +2,21 @@
 
 #include "Alsa.h"
 #include "Arguments.h"
+#include "Effects.h"
+#include "Frames.h"
 #include "PadsAccess.h"
+#include "Playback.h"
+#include "Resampler.h"
+#include "SampleArena.h"
+#include "SampleBuffer.h"
 
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <filesystem>
+#include <memory>
+#include <optional>
 
 
 namespace ps
@@ -18,51 +27,236 @@ namespace ps
   public:
     static ArgMap args();
 
+    /// Sample indices are below that, the playing thread never grows its
+    /// containers.
+    static constexpr int MaxSamples = 512;
+    /// Samples playing at the same time, the oldest one fades out to make
+    /// room for more.
+    static constexpr int MaxVoices = 32;
+    /// Extra voices for those fading out, so that they do not take the room
+    /// of new ones.
+    static constexpr int FadingVoices = 8;
+    /// Bank indices are below that.
+    static constexpr int MaxBanks = 64;
+
     Player(const ArgMap& args, Pads& pads);
     Player(const Player&) = delete;
     ~Player();
 
-    /// Add a new sample, returns the index used to replay it.
-    /// NOTE: loading a new sample will not happen while anything is playing.
+    /// Add a new sample, returns the index used to replay it. Samples are
+    /// resampled to the rate of the card and kept at 16 bits when that is
+    /// all the source has (see sample-precision).
+    /// Interleaved frames as ALSA gives them (S24_LE padded to 4 bytes).
     /// 0-based return value, i.e. 0 is a valid sample index.
     int load(FrameFormat, std::vector<uint8_t>&& bytes);
     /// Same as above but reads the file from the disk for you as well.
     int load(std::filesystem::path);
+    /// Stereo frames with `Bits` significant bits in each value, as
+    /// extractChannels gives them. Replaces the sample at `replace` if given,
+    /// it is playable within one period either way.
+    int load(FrameFormat, const int32_t* samples, long frames, int replace = -1);
+
+    /// Read and convert a file for this player, throws on errors.
+    /// Can be called from any thread.
+    SampleBuffer decode(const std::filesystem::path&) const;
+
+    /// Read and convert the files for this player, packed in a single arena.
+    /// Samples that fail to load or with an empty path are left empty.
+    /// Those for which `keep` is true are not read again but taken from
+    /// `previous`. Can be called from any thread, e.g. to reload a bank in
+    /// the background.
+    std::unique_ptr<SampleBank> makeBank(
+        const std::vector<std::filesystem::path>&,
+        const SampleBank* previous = nullptr,
+        const std::vector<bool>& keep = {});
+
+    /// Replace bank `index` as a whole (nullptr to remove it), it is
+    /// playable within one period. Voices of the samples that were kept from
+    /// the previous bank keep playing, the others fade out quickly. The
+    /// previous bank is released by a later call, once the playing thread
+    /// let go of it.
+    void setBank(int index, std::shared_ptr<const SampleBank>);
 
     /// Start playing the given sample index as returned per load.
     /// Other samples will keep playing.
     void play(int);
+    /// Same for the sample at `sample` in a bank given to setBank. Starts on
+    /// the frame heard at `at`, when given and not past, e.g. on a beat.
+    void play(int bank, int sample, const PlaySettings& = {},
+        std::chrono::steady_clock::time_point at = {});
+    /// The pad of the sample was released, stops it in PlayMode::Gate.
+    void release(int bank, int sample);
 
-    /// -1 to stop everything
+    /// A time-stretched version of the sample at `sample` in `bank`, played
+    /// instead of it when PlaySettings::Bpm is set. Voices already playing
+    /// go on from the same place in it. nullptr for the sample as is.
+    /// Samples above atom::NumPads are never stretched.
+    void setStretched(int bank, int sample, std::shared_ptr<const SampleBuffer>);
+
+    /// -1 to stop everything, including what is about to start. Voices fade
+    /// out over their release rather than stop dead.
     void stop(int);
+    /// Same for a sample of a bank given to setBank, with its plays yet to
+    /// start.
+    void stop(int bank, int sample);
+    /// Drops the plays of the sample yet to start, what already plays goes
+    /// on.
+    void cancel(int bank, int sample);
+
+    /// Of the card, samples are converted to it.
+    int rate() const { return _out.Format.Rate; }
+
+    /// On the main output, parameters can be set from any thread.
+    Effects& effects() { return _effects; }
+
+    /// Index of an output of audio-out-outputs for PlaySettings::Output, 0
+    /// for the main one (audio-out-channels) and -1 when there is none.
+    int output(std::string_view name) const;
 
   private:
+    struct Command
+    {
+      enum { Play, Release, Stop, Cancel } Type;
+      int Sample;
+      int Bank = -1; // -1 for samples given to load
+      PlaySettings Settings = {};
+      std::chrono::steady_clock::time_point At = {}; // when to be heard
+      uint64_t Frame = 0; // to start at, from At once received
+    };
+
+    /// Gain of a voice, read from the ramp tables while fading.
+    struct Envelope
+    {
+      enum Stage { Attack, Sustain, Release } Stage = Sustain;
+      long Frame = 0;  // in the stage
+      long Length = 0; // of the stage, frames
+    };
+
+    struct Voice
+    {
+      int Sample = -1; // -1 when free
+      int Bank = -1;
+      long Position = 0;
+      // Frames read per frame mixed, and where between two frames, when
+      // pitched.
+      double Step = 1;
+      double Fraction = 0;
+      PlaySettings Settings;
+      uint64_t Started = 0; // the oldest is stolen first
+      Envelope Gain;
+      long Delay = 0; // silent frames before it starts, in the next period
+      // A view of what it read when that was swapped out under it, it fades
+      // out on it. Of the original, `RetiredScale` times as long.
+      SampleBuffer Retired{};
+      double RetiredScale = 1;
+
+      bool active() const
+      {
+        return Sample >= 0 and Gain.Stage != Envelope::Release;
+      }
+      bool plays(int bank, int sample) const
+      {
+        return active() and Bank == bank and Sample == sample;
+      }
+    };
+
+    /// Precision to keep a source of `bits` bits at.
+    SamplePrecision precision(int bits) const;
+    SampleBuffer convert(FrameFormat, const std::vector<uint8_t>& bytes) const;
+    /// Resampled to the output rate if needed.
+    SampleBuffer prepare(SampleBuffer&&, int rate) const;
+    int add(SampleBuffer&&, int replace, int rate);
+    void push(Command);
+
     void run();
+    void receive();
+    /// Voices of the scheduled commands that start in the next `frames`.
+    void startDue(long frames);
+    /// `delay` frames into the next period.
+    void start(const Command&, long delay = 0);
+    /// Over `frames`, or the release of the voice.
+    void fadeOut(Voice&, long frames = -1);
+    /// `count` gains of the envelope into _gains.
+    void envelopeGains(const Envelope&, long count);
+    /// What `voice` plays instead of its sample, null for the sample.
+    const SampleBuffer* stretched(const Voice& voice) const;
+    /// `voice` fades out on `data`, which was swapped out, of a sample of
+    /// `originalFrames`.
+    void retire(Voice& voice, const SampleBuffer& data, long originalFrames);
+    /// Whether a voice still fades out on `data`.
+    bool retiredOn(const SampleBuffer& data) const;
+    bool retiredOn(const SampleBank& bank) const;
+    void mix(long frames);
+    void writeOut(long frames);
 
     std::string _interface;
     std::thread _thread;
     std::atomic<bool> _stop = 0;
 
-    // This tells the playing thread to check for _nextSamples when it is
-    // mismatching the size of _samples. This is used to avoid locking for
-    // long when adding new samples. We can return the sample index
-    // immediately (yes, I like overkill optimizations).
-    std::atomic<int> _count = 0;
+    // Indices given out so far, not necessarily received by the thread yet.
+    // Only used by load.
+    int _count = 0;
+    ResampleQuality _resampleQuality;
+    std::optional<SamplePrecision> _precision; // empty to follow the source
+    // This tells the playing thread to check for _nextSamples and _commands,
+    // so that it does not even try to lock when nothing happens.
+    std::atomic<bool> _updated = false;
+
+    // Of the entries below once swapped: freed by the next caller, or kept
+    // while voices fade out on them.
+    static constexpr int Swapped = -1;
+    static constexpr int Retiring = -2;
 
     std::mutex _mutex;
     // ---------- members below must be accessed under the mutex ------------ //
-    std::vector<std::string> _nextFiles;
-    std::vector<std::vector<uint8_t>> _nextSamples;
+    // The thread swaps the data into _samples, which leaves the old data
+    // here (with the index reset to Swapped, or Retiring) to be freed by
+    // load.
+    std::vector<std::pair<int, SampleBuffer>> _nextSamples;
+    // Same for the banks.
+    std::vector<std::pair<int, std::shared_ptr<const SampleBank>>> _nextBanks;
+    // And for the stretched samples, by bank * atom::NumPads + sample.
+    std::vector<std::pair<int, std::shared_ptr<const SampleBuffer>>> _nextStretched;
+    std::vector<Command> _commands;
     // ---------------------------------------------------------------------- //
 
     // --------- members below must be accessed in the thread only ---------- //
     int _outputChannelCount;
     std::array<int, 2> _channels; // the channels to playback on.
+    // Named stereo outputs, the main one (_channels) first.
+    std::vector<std::pair<std::string, std::array<int, 2>>> _outputs;
     Pcm _out;
+    WriteFrames _writeFrames; // for the format of _out
+    Effects _effects; // its parameters are atomic
+    long _periodFrames = 0;
+    long _fadeFrames = 0; // to steal a voice or cut a choke group
 
-    std::vector<std::vector<uint8_t>> _samples;
-
+    std::vector<SampleBuffer> _samples; // MaxSamples, empty when unused
+    std::vector<std::shared_ptr<const SampleBank>> _banks; // MaxBanks
+    // MaxBanks * atom::NumPads, see setStretched.
+    std::vector<std::shared_ptr<const SampleBuffer>> _stretched;
+    std::vector<Command> _received;   // swapped with _commands
+    // Plays to start on a later frame, in no particular order.
+    std::vector<Command> _scheduled;
+    uint64_t _frame = 0; // the first of the next period, frames mixed so far
+    // When the first frame of the next period will be heard.
+    std::chrono::steady_clock::time_point _heardAt;
+    std::array<Voice, MaxVoices + FadingVoices> _voices;
+    uint64_t _voiceClock = 0;
+    std::vector<float> _mix;          // one period, left then right per output
+    // The routing, planes of _mix and the channel of the card each goes to.
+    std::vector<const float*> _planes;
+    std::vector<int> _routes;
+    std::vector<float> _gains;        // one period, of an envelope
+    // Raised cosine, from 0 to 1 and back, RampSize + 1 points.
+    static constexpr int RampSize = 256;
+    std::array<float, RampSize + 1> _rise;
+    std::array<float, RampSize + 1> _fall;
+    std::vector<uint8_t> _outBuf;     // one period, as the card takes it
+    size_t _writeErrors = 0;
+    size_t _droppedPlays = 0; // scheduled too far ahead, see MaxScheduled
+    bool _retiring = false; // entries are Retiring, checked every period
     // ---------------------------------------------------------------------- //
 
   };
-}
\ No newline at end of file
+}
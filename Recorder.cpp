@@ -1,12 +1,18 @@
 #include "Recorder.h"
 #include "Alsa.h"
+#include "Frames.h"
 #include "Log.h"
+#include "Trace.h"
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <filesystem>
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 using namespace std;
 using namespace ps;
 using namespace atom;
@@ -19,22 +25,58 @@ namespace
 {
   auto logger = Log("REC");
 
+  constexpr Color LiveSampleColor{.r = 0x7f, .g = 0x00, .b = 0x40};
+
   string filenameForTime(const c::system_clock::time_point& time)
   {
     time_t tt = c::system_clock::to_time_t(time);
     tm local = *std::localtime(&tt);
     auto epoch = time.time_since_epoch();
     int64_t millis = c::duration_cast<c::milliseconds>(epoch).count() % 1'000;
-    return fmt::format("{}.{:03}.flac", put_time(&local, "%Y%m%d-%H%M%S"), millis);
+    return fmt::format("{}.{:03}", put_time(&local, "%Y%m%d-%H%M%S"), millis);
   }
 
-  int storageBytes(int sampleBits)
+  FlacSettings flacSettings(const ArgMap& args, const FrameFormat& format)
   {
-    if (sampleBits == 24) {
-      return 4; // padding to int32_t
+    FlacSettings result;
+    result.Level = stoi(* args.find(AUDIO_IN "flac-level")->second.Value);
+    result.Blocksize = stoi(* args.find(AUDIO_IN "flac-blocksize")->second.Value);
+    result.Apodization = * args.find(AUDIO_IN "flac-apodization")->second.Value;
+    result.Threads = stoi(* args.find(AUDIO_IN "flac-threads")->second.Value);
+    // we are receiving N channels but always keep 2, no plans to support mono
+    result.Channels = 2;
+    // We may get more precision in and convert down to 24 bit as FLAC
+    // can’t support more than that.
+    result.Bits = min(24, format.Bits);
+    result.Rate = stoi(* args.find(AUDIO_IN "record-rate")->second.Value);
+    if (result.Rate == 0) {
+      result.Rate = format.Rate;
     }
-    return sampleBits / 8;
-  };
+
+    if (result.Level < 0 or result.Level > 8) {
+      logger.throw_(AUDIO_IN "flac-level must be between 0 and 8");
+    }
+    if (result.Blocksize != 0 and
+        (result.Blocksize < 16 or result.Blocksize > 65535))
+    {
+      logger.throw_(AUDIO_IN "flac-blocksize must be 0 or between 16 and 65535");
+    }
+    if (result.Threads < 0) {
+      logger.throw_(AUDIO_IN "flac-threads must be positive");
+    }
+    return result;
+  }
+
+  FileWriter::Options writerOptions(const ArgMap& args)
+  {
+    FileWriter::Options result;
+    result.Preallocate = uint64_t(stoi(
+        * args.find(AUDIO_IN "preallocate-mb")->second.Value)) << 20;
+    result.Direct = * args.find(AUDIO_IN "direct-io")->second.Value == "true";
+    result.SyncEvery = uint64_t(stoi(
+        * args.find(AUDIO_IN "sync-mb")->second.Value)) << 20;
+    return result;
+  }
 
   array<int, 2> parseChannels(const string& str)
   {
@@ -68,19 +110,111 @@ unordered_map<string, Argument> Recorder::args()
     { AUDIO_IN "record-dir"s, {
       .Doc = "Directory where to save recorded files",
       .Value = "./"
+    } },
+    { AUDIO_IN "format"s, {
+      .Doc = "flac or wav. wav needs much less CPU but a lot more space, files "
+      "above 4GB are written as RF64.",
+      .Value = "flac"
+    } },
+    { AUDIO_IN "transcode"s, {
+      .Doc = "When recording wav, encode a FLAC copy in the background once "
+      "the recording stops. The wav file is kept.",
+      .Value = "false",
+      .Flag = true
+    } },
+    { AUDIO_IN "flac-level"s, {
+      .Doc = "FLAC compression level, 0 (fastest) to 8 (smallest files)",
+      .Value = "5"
+    } },
+    { AUDIO_IN "flac-blocksize"s, {
+      .Doc = "Frames per FLAC block, 0 to use the default of the level. "
+      "Above 4608 the file is not streamable anymore.",
+      .Value = "0"
+    } },
+    { AUDIO_IN "flac-apodization"s, {
+      .Doc = "FLAC apodization functions (eg 'tukey(0.5)'), empty to use "
+      "the default of the level.",
+      .Value = ""
+    } },
+    { AUDIO_IN "flac-threads"s, {
+      .Doc = "0 to encode in the recording thread, otherwise the number of "
+      "threads encoding FLAC blocks in parallel.",
+      .Value = "0"
+    } },
+    { AUDIO_IN "record-rate"s, {
+      .Doc = "Sample rate of the recordings, 0 to keep the rate of the card. "
+      "Stems are always at the rate of the card.",
+      .Value = "0"
+    } },
+    { AUDIO_IN "resample-quality"s, {
+      .Doc = "fast, medium or best. Used when " AUDIO_IN "record-rate differs "
+      "from the rate of the card.",
+      .Value = "best"
+    } },
+    { AUDIO_IN "stems"s, {
+      .Doc = "none to record " AUDIO_IN "channels only, pairs for one stereo "
+      "file per pair of input channels, all for a single file with every "
+      "channel (FLAC is limited to 8). Stems do not get any pre-roll.",
+      .Value = "none"
+    } },
+    { AUDIO_IN "preallocate-mb"s, {
+      .Doc = "Disk space reserved ahead of the recording, in MB, so that the "
+      "file stays contiguous. 0 to disable.",
+      .Value = "64"
+    } },
+    { AUDIO_IN "direct-io"s, {
+      .Doc = "Write recordings with O_DIRECT, bypassing the page cache.",
+      .Value = "false",
+      .Flag = true
+    } },
+    { AUDIO_IN "sync-mb"s, {
+      .Doc = "Push recordings to disk every that many MB rather than letting "
+      "the kernel flush a lot at once. 0 to leave it to the kernel.",
+      .Value = "4"
+    } },
+    { AUDIO_IN "live-seconds"s, {
+      .Doc = "Seconds of input kept in memory for live sampling. The input is "
+      "then read all the time, not only when recording. 0 to disable.",
+      .Value = "30"
+    } },
+    { AUDIO_IN "preroll-seconds"s, {
+      .Doc = "Seconds of input from before the record button was pressed "
+      "that start the recording. The input is then read all the time. 0 to "
+      "disable.",
+      .Value = "5"
+    } },
+    { AUDIO_IN "live-sample-seconds"s, {
+      .Doc = "Length of the samples taken from the input with the pads of "
+      "the recorder view.",
+      .Value = "4"
+    } },
+    { AUDIO_IN "detect-tempo"s, {
+      .Doc = "Find the tempo of the input on a thread of its own, the input is "
+      "then read all the time. Pads can be quantized to it, unless tapped on "
+      "the Click button or followed from a MIDI clock.",
+      .Value = "false",
+      .Flag = true
     } }
   };
 }
 
-Recorder::Recorder(Device& d, Pads& pads, const ArgMap& args)
+Recorder::Recorder(Device& d, Pads& pads, Player& player, const ArgMap& args)
   : PadsAccess(pads)
   , _device(d)
+  , _player(player)
   , _recordDir(* args.find(AUDIO_IN "record-dir")->second.Value)
   , _interface(* args.find(AUDIO_IN "card")->second.Value)
   , _inputChannelCount(stoi(* args.find(AUDIO_IN "channel-count")->second.Value))
   , _channels(parseChannels(* args.find(AUDIO_IN "channels")->second.Value))
   , _in(_interface, SND_PCM_STREAM_CAPTURE, _inputChannelCount, _channels)
   , _storageBytes(storageBytes(_in.Format.Bits))
+  , _flac(flacSettings(args, _in.Format))
+  , _format(parseRecordingFormat(* args.find(AUDIO_IN "format")->second.Value))
+  , _transcode(* args.find(AUDIO_IN "transcode")->second.Value == "true")
+  , _writer(writerOptions(args))
+  , _stemMode(parseStemMode(* args.find(AUDIO_IN "stems")->second.Value))
+  , _resampleQuality(parseResampleQuality(
+        * args.find(AUDIO_IN "resample-quality")->second.Value))
 {
   if (not _recordDir.empty() && _recordDir.back() != '/') {
     filesystem::directory_entry dir(_recordDir);
@@ -102,11 +236,80 @@ Recorder::Recorder(Device& d, Pads& pads, const ArgMap& args)
   // flac always take in 24 bit samples padded to 32 bits and always
   // 2 channels.
   _convBuf.resize(sampleCount * sizeof(uint32_t) * _channels.size());
+
+  double liveSeconds = stod(* args.find(AUDIO_IN "live-seconds")->second.Value);
+  double sampleSeconds =
+      stod(* args.find(AUDIO_IN "live-sample-seconds")->second.Value);
+  double prerollSeconds =
+      stod(* args.find(AUDIO_IN "preroll-seconds")->second.Value);
+  const bool detectTempo =
+      * args.find(AUDIO_IN "detect-tempo")->second.Value == "true";
+  // All come from the same ring, the tempo only needs what it did not read
+  // yet.
+  double ringSeconds = max(liveSeconds, prerollSeconds);
+  if (ringSeconds > 0 or detectTempo) {
+    // Written a read at a time.
+    _ring = make_unique<CaptureRing>(_channels.size(),
+        long(max(ringSeconds, 1.) * _in.Format.Rate), sampleCount);
+    if (ringSeconds > 0 and sampleSeconds > ringSeconds) {
+      logger.warn(AUDIO_IN "live-sample-seconds is more than what is kept "
+          "in memory ({}s)", ringSeconds);
+    }
+  }
+  _liveSampleFrames = liveSeconds > 0 ? long(sampleSeconds * _in.Format.Rate) : 0;
+  _prerollFrames = long(prerollSeconds * _in.Format.Rate);
+  // copyLast only resizes within that, nothing is allocated when starting.
+  _prerollBuf.reserve(_prerollFrames * _channels.size());
+
+  _liveSamples.fill(-1);
+  if (detectTempo) {
+    // extractChannels keeps at most 24 bits.
+    _tempo = make_unique<TempoDetector>(
+        _in.Format.Rate, min(24, _in.Format.Bits), _ring.get());
+  }
+
+  if (_flac.Rate != _in.Format.Rate) {
+    // Also checks the ratio now rather than on the recording thread.
+    auto bank = filterBank(_in.Format.Rate, _flac.Rate, _resampleQuality);
+    // Up to one buffer of _convBuf at a time, and the tail of the filter.
+    long inFrames = _convBuf.size() / _outputChannelCount;
+    long outFrames =
+        (int64_t(inFrames) + bank->Taps) * _flac.Rate / _in.Format.Rate + 1;
+    _resampleIn.resize(_convBuf.size());
+    _resampleOut.resize(outFrames * _outputChannelCount);
+    _resampled.resize(outFrames * _outputChannelCount);
+  }
+
   logger.info("input channels: {}, rate: {}, sample bits: {} (stored: {})",
     _inputChannelCount, _in.Format.Rate, _in.Format.Bits, _storageBytes * 8);
 
   logger.info("Recording channels {},{} on {}",
       _channels[0], _channels[1], _interface);
+  // Checked here rather than failing later on the recording thread.
+  if (_stemMode == StemMode::Pairs and _inputChannelCount % 2 != 0) {
+    logger.throw_(AUDIO_IN "stems pairs needs an even number of channels");
+  }
+  if (_stemMode == StemMode::All and _format == RecordingFormat::Flac and
+      _inputChannelCount > 8)
+  {
+    logger.throw_(AUDIO_IN "stems all is limited to 8 channels with FLAC, "
+        "there are {}", _inputChannelCount);
+  }
+  if (_stemMode != StemMode::None) {
+    logger.info("Recording {} of the {} input channels as stems",
+        _stemMode == StemMode::Pairs ? "pairs" : "all", _inputChannelCount);
+  }
+  logger.info("Recording format: {}{}",
+      _format == RecordingFormat::Flac ? "flac" : "wav",
+      _format == RecordingFormat::Wav and _transcode ? ", then transcoding" : "");
+  if (_flac.Rate != _in.Format.Rate) {
+    logger.info("Recording at {}Hz ({} resampling)", _flac.Rate,
+        toString(_resampleQuality));
+  }
+  logger.info("FLAC level {}, blocksize {}, {}", _flac.Level,
+      _flac.Blocksize == 0 ? "default"s : to_string(_flac.Blocksize),
+      _flac.Threads == 0 ? "encoding in the recording thread"s :
+          fmt::format("{} encoding threads", _flac.Threads));
   cout.flush();
   _thread = thread([this]{ run(); });
 }
@@ -121,6 +324,19 @@ Recorder::~Recorder()
   if (_on) {
     stopRecording(true /*drain*/);
   }
+
+  if (_transcoder.joinable()) {
+    {
+      lock_guard lock(_transcodeMutex);
+      _stopTranscoding = true;
+      if (not _toTranscode.empty()) {
+        logger.info("Waiting for {} FLAC transcodes to complete",
+            _toTranscode.size());
+      }
+    }
+    _transcodeWake.notify_one();
+    _transcoder.join();
+  }
 }
 
 void Recorder::toggle()
@@ -137,7 +353,6 @@ void Recorder::toggle()
 void Recorder::poll()
 {
   // slow path poll - do not access audio here.
-
   if (!_on) {
     return;
   }
@@ -152,31 +367,100 @@ void Recorder::poll()
   }
 }
 
+void Recorder::padPressed(atom::Pad pad, bool recapture)
+{
+  if (pad < Pad::One or pad >= Pad::Last) {
+    return;
+  }
+  if (_liveSampleFrames == 0) {
+    logger.warn("Live sampling is disabled (" AUDIO_IN "live-seconds is 0)");
+    return;
+  }
+
+  int& sample = _liveSamples[pad - Pad::One];
+  if (sample >= 0 and not recapture) {
+    _player.play(sample);
+    return;
+  }
+
+  long frames = _ring->copyLast(_liveSampleFrames, _liveBuf);
+  if (frames == 0) {
+    logger.warn("Nothing captured yet to sample");
+    return;
+  }
+
+  // extractChannels keeps at most 24 bits.
+  FrameFormat format{
+    .Rate = _in.Format.Rate,
+    .Bits = min(24, _in.Format.Bits),
+    .Channels = _outputChannelCount
+  };
+  int index = _player.load(format, _liveBuf.data(), frames, sample);
+  if (index < 0) {
+    return;
+  }
+  sample = index;
+  logger.info("Sampled {:.1f}s of input on pad {}",
+      double(frames) / _in.Format.Rate, pad - Pad::One + 1);
+
+  if (isAccessing()) {
+    pads().setPad(pad, PadMode::On, LiveSampleColor);
+  }
+}
+
+void Recorder::onAccess()
+{
+  for (int i = 0; i < NumPads; ++i) {
+    if (_liveSamples[i] >= 0) {
+      pads().setPad(Pad::One + i, PadMode::On, LiveSampleColor);
+    }
+    else {
+      pads().setPad(Pad::One + i, PadMode::Off, Color{});
+    }
+  }
+}
+
 void Recorder::startRecording()
 {
-  // Setup FLAC
-  auto fileName = _recordDir + filenameForTime(c::system_clock::now());
-
-  _enc.reset(FLAC__stream_encoder_new());
-  // we are receiving N channels but always keep 2, no plans to support mono
-  FLAC__stream_encoder_set_channels(_enc.get(), _channels.size());
-  // We may get more precision in and convert down to 24 bit as FLAC
-  // can’t support more than that.
-  FLAC__stream_encoder_set_bits_per_sample(
-      _enc.get(),
-      min(24, _in.Format.Bits));
-  FLAC__stream_encoder_set_sample_rate(_enc.get(), _in.Format.Rate);
-  auto res = FLAC__stream_encoder_init_file(
-      _enc.get(),
-      fileName.c_str(),
-      nullptr,
-      nullptr
-  );
-  if (res != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
-    logger.throw_("Could not initialize FLAC encoder ({})", (int)res);
-  }
-
-  logger.info("Starting to record to {}\n", fileName);
+  // The ring is only written by this thread, what it holds ends exactly
+  // where the next read starts.
+  // Stems are not kept in the ring, they start when the button is pressed.
+  long preroll = 0;
+  if (_ring and _prerollFrames > 0 and _stemMode == StemMode::None) {
+    preroll = _ring->copyLast(_prerollFrames, _prerollBuf);
+  }
+
+  // Named after the first frame recorded.
+  auto start = c::system_clock::now() -
+      c::duration_cast<c::system_clock::duration>(
+          c::duration<double>(double(preroll) / _in.Format.Rate));
+  auto baseName = _recordDir + filenameForTime(start);
+
+  _recordedFrames = 0;
+  if (_stemMode != StemMode::None) {
+    auto stemSettings = _flac;
+    stemSettings.Rate = _in.Format.Rate;
+    _stems = make_unique<StemSinks>(_stemMode, _format, baseName,
+        _inputChannelCount, _in.Format.Bits,
+        _readBuf.size() / _inputChannelCount / _storageBytes, stemSettings,
+        _writer);
+    logger.info("Starting to record stems to {}\n",
+        fmt::join(_stems->fileNames(), ", "));
+    return;
+  }
+  _sink = makeSink(_format, baseName, _flac, _writer);
+  if (_flac.Rate != _in.Format.Rate) {
+    _resampler = make_unique<Resampler>(_in.Format.Rate, _flac.Rate,
+        _outputChannelCount, _resampleQuality, _convBuf.size() / 2);
+  }
+
+  logger.info("Starting to record to {} ({:.1f}s of pre-roll)\n",
+      _sink->fileName(), double(preroll) / _in.Format.Rate);
+
+  if (preroll > 0) {
+    _recordedFrames += preroll;
+    writeToSink(_prerollBuf.data(), preroll);
+  }
 }
 
 void Recorder::stopRecording(bool drain)
@@ -184,18 +468,116 @@ void Recorder::stopRecording(bool drain)
   if (drain) {
     snd_pcm_drain(_in.Ptr);
     recordFrames();
+    // Drained means stopped, be ready for the next recording.
+    snd_pcm_prepare(_in.Ptr);
+  }
+  if (not _sink and not _stems) {
+    return;
   }
-  if (_enc) {
-    FLAC__stream_encoder_finish(_enc.get());
+
+  try {
+    if (_stems) {
+      _stems->finish();
+    }
+    else {
+      if (_resampler) {
+        long frames = _resampler->flush(_resampleOut.data());
+        writeResampled(frames);
+      }
+      _sink->finish();
+    }
   }
-  _enc.reset();
+  catch (const exception& ex) {
+    logger.error("Failed to complete the recording: {}", ex.what());
+  }
+  auto files = _stems ? _stems->fileNames() : vector{_sink->fileName()};
+  auto processTime = _stems ? _stems->processTime() : _sink->processTime();
+
   logger.info("Stopped recording (ok: {}, errors: {})\n", _readOk, _readErrors);
+  double audioSeconds = double(_recordedFrames) / _in.Format.Rate;
+  double processSeconds = c::duration<double>(processTime).count();
+  if (processSeconds > 0) {
+    logger.info("Wrote {:.1f}s of audio in {:.1f}s, realtime factor {:.1f}",
+        audioSeconds, processSeconds, audioSeconds / processSeconds);
+  }
   cout.flush();
   _readErrors = 0;
+
+  if (_format == RecordingFormat::Wav and _transcode) {
+    {
+      lock_guard lock(_transcodeMutex);
+      _toTranscode.insert(end(_toTranscode), begin(files), end(files));
+    }
+    if (not _transcoder.joinable()) {
+      _transcoder = thread([this] { transcodeQueued(); });
+    }
+    _transcodeWake.notify_one();
+  }
+  _sink.reset();
+  _stems.reset();
+  _resampler.reset();
+}
+
+void Recorder::transcodeQueued()
+{
+  trace::setThreadName("transcode");
+  // Nice value for this thread only, do not compete with the audio.
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+  unique_lock lock(_transcodeMutex);
+  while (true) {
+    _transcodeWake.wait(lock, [this] {
+      return _stopTranscoding or not _toTranscode.empty();
+    });
+    if (_toTranscode.empty()) {
+      return; // stopped, and all done
+    }
+    auto file = move(_toTranscode.front());
+    _toTranscode.pop_front();
+    lock.unlock();
+    try {
+      transcodeToFlac(file, _flac);
+    }
+    catch (const exception& ex) {
+      logger.error("Failed to transcode {}: {}", file, ex.what());
+    }
+    lock.lock();
+  }
+}
+
+void Recorder::writeToSink(const int32_t* samples, long frames)
+{
+  if (not _resampler) {
+    _sink->write(samples, frames);
+    return;
+  }
+
+  const float toFloat = 1.f / (1 << (_flac.Bits - 1));
+  const long chunk = _convBuf.size() / _outputChannelCount;
+  while (frames > 0) {
+    long count = min(frames, chunk);
+    for (long i = 0; i < count * _outputChannelCount; ++i) {
+      _resampleIn[i] = samples[i] * toFloat;
+    }
+    writeResampled(_resampler->process(_resampleIn.data(), count,
+        _resampleOut.data()));
+    samples += count * _outputChannelCount;
+    frames -= count;
+  }
+}
+
+void Recorder::writeResampled(long frames)
+{
+  const float fromFloat = (1 << (_flac.Bits - 1)) - 1;
+  for (long i = 0; i < frames * _outputChannelCount; ++i) {
+    _resampled[i] = lrintf(clamp(_resampleOut[i], -1.f, 1.f) * fromFloat);
+  }
+  _sink->write(_resampled.data(), frames);
 }
 
 void Recorder::recordFrames()
 {
+  PS_TRACE_SCOPE("Recorder::recordFrames");
+
   // blocking while buffer is not full, using 100ms buffer size
   // (i.e sample rate/10)
   auto nFrames = snd_pcm_readi(_in.Ptr, _readBuf.data(),
@@ -226,42 +608,39 @@ void Recorder::recordFrames()
 
     ++_readOk;
 
-    // We get too many channels from the card (on my mixer I get 10 or 5*2).
-    // The code below selects the two channels we want to record by 
-    // de-interleaving the data.
-    // TODO: this shouts "vectorize me"
-    for (long i = 0; i < nFrames; ++i) {
-      for (long j = 0; j < 2; ++ j) {
-        auto idx = i * 2 + j; // out i-th frame, j-th channel 
-        _convBuf[idx] = 0;
-        memcpy(
-          &_convBuf[idx],
-          &_readBuf[
-            i * _storageBytes * _inputChannelCount + 
-            _channels[j] * _storageBytes
-          ],
-          _in.Format.Bits * 8
-        );
-        if (_in.Format.Bits == 32) {
-          _convBuf[idx] = _convBuf[idx] / 256;
-        }
-      }
+    if (_stems) {
+      _recordedFrames += nFrames;
+      _stems->write(_readBuf.data(), nFrames);
     }
+    if (not _ring and not _sink) {
+      return;
+    }
+
+    // We get too many channels from the card (on my mixer I get 10 or 5*2).
+    // Select the two channels we want to record by de-interleaving the data.
+    extractChannels(_readBuf.data(), _inputChannelCount, _in.Format.Bits,
+        _channels.data(), _channels.size(), _convBuf.data(), nFrames);
 
-    // Let’s note that for FLAC a sample is an Alsa frame.
-    FLAC__stream_encoder_process_interleaved(
-        _enc.get(), (int32_t*)_convBuf.data(), nFrames);
+    if (_ring) {
+      _ring->write(_convBuf.data(), nFrames);
+    }
+    if (_sink) {
+      _recordedFrames += nFrames;
+      writeToSink(_convBuf.data(), nFrames);
+    }
   }
 }
 
 void Recorder::run()
 {
+  trace::setThreadName("rec");
   bool wasOn = false;
 
   while (not _stop) {
     if (wasOn) {
       if (!_on) {
-        stopRecording(true /*drain*/);
+        // With live sampling the input keeps being read, nothing to drain.
+        stopRecording(not _ring /*drain*/);
         wasOn = false;
       }
       else {
@@ -274,6 +653,9 @@ void Recorder::run()
         startRecording();
         wasOn = true;
       }
+      else if (_ring) {
+        recordFrames();
+      }
       else {
         this_thread::sleep_for(c::milliseconds(1));
       }
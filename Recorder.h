@@ -3,38 +3,38 @@
 #include "Device.h"
 #include "Alsa.h"
 #include "Arguments.h"
+#include "CaptureRing.h"
+#include "Player.h"
+#include "RecordingSink.h"
+#include "Resampler.h"
+#include "Stems.h"
+#include "TempoDetector.h"
 #include "PadsAccess.h"
 
 #include <alsa/asoundlib.h>
-#include <FLAC/stream_encoder.h>
 
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 #include <atomic>
 #include <fstream>
 
 namespace ps
 {
-  struct FlacDeleter
-  {
-    void operator()(FLAC__StreamEncoder* enc)
-    {
-      if (enc) {
-        FLAC__stream_encoder_delete(enc);
-      }
-    }
-  };
-  using FlacPtr = std::unique_ptr<FLAC__StreamEncoder, FlacDeleter>;
-
-
   /// This is meant to record a full DJ set to disk rather than a sample.
-  /// TODO: record to memory for live sampling.
+  ///
+  /// The last seconds of the input are also kept in memory. Recordings start
+  /// with what was played just before the button was pressed (pre-roll) and
+  /// pads in the recorder view turn them into samples of the player (live
+  /// sampling).
   class Recorder : public PadsAccess
   {
   public:
     /// Note: The device is used to affect some buttons
     /// TODO: could we break the dependency ? not worth it for now.
-    Recorder(Device& d, Pads&, const ArgMap&);
+    Recorder(Device& d, Pads&, Player&, const ArgMap&);
     Recorder(const Recorder&) = delete;
     ~Recorder();
 
@@ -45,7 +45,17 @@ namespace ps
 
     void poll();
 
+    /// A pad was pressed while in the recorder view. Captures the last
+    /// seconds of input into that pad, or plays what it already holds.
+    /// `recapture` to replace what the pad holds.
+    void padPressed(atom::Pad, bool recapture);
+
+    /// Of the input, null unless detecting it.
+    const TempoDetector* tempo() const { return _tempo.get(); }
+
   private:
+    void onAccess() override;
+
     std::atomic<bool> _on   = false;
     std::atomic<bool> _stop = false;
 
@@ -55,11 +65,26 @@ namespace ps
     void startRecording();
     void stopRecording(bool drain);
     void recordFrames();
+    void writeToSink(const int32_t* samples, long frames);
+    void writeResampled(long frames);
     void run();
+    /// Of the transcode thread, until stopped and nothing is left to do.
+    void transcodeQueued();
 
     std::thread _thread;
 
+    // WAV files are transcoded one after the other on a thread of their own,
+    // started with the first one.
+    std::thread _transcoder;
+    std::mutex _transcodeMutex;
+    std::condition_variable _transcodeWake;
+    // ---------- members below must be accessed under the mutex ------------ //
+    std::deque<std::string> _toTranscode;
+    bool _stopTranscoding = false;
+    // ---------------------------------------------------------------------- //
+
     Device& _device;
+    Player& _player;
 
     // ----- these variables should only be accessed in the rec thread ------ //
     // (they are set in the constructor)
@@ -79,15 +104,41 @@ namespace ps
     std::array<int, _outputChannelCount> _channels;
     Pcm _in;
     int _storageBytes = -1;
-    FlacPtr _enc;
+    FlacSettings _flac;
+    RecordingFormat _format;
+    bool _transcode;
+    FileWriter::Options _writer;
+    StemMode _stemMode;
+    std::unique_ptr<RecordingSink> _sink;
+    std::unique_ptr<StemSinks> _stems; // instead of _sink
+    ResampleQuality _resampleQuality;
+    // Only when recording at another rate than the card's.
+    std::unique_ptr<Resampler> _resampler;
+    std::vector<float> _resampleIn;
+    std::vector<float> _resampleOut;
+    std::vector<int32_t> _resampled;
+    // to report how much faster than realtime writing is.
+    long _recordedFrames = 0;
     std::vector<uint8_t> _readBuf;
     // flac always take int32_t i.e. signed 32 bit values
     std::vector<int32_t> _convBuf;
+    // Written by the rec thread only, read from the main thread.
+    std::unique_ptr<CaptureRing> _ring;
+    long _prerollFrames;
+    std::vector<int32_t> _prerollBuf;
     size_t _readOk = 0;
     size_t _readErrors = 0;
     // ---------------------------------------------------------------------- //
 
     std::chrono::system_clock::time_point _last = {};
     bool _buttonOn = true;
+
+    // Live sampling, main thread only.
+    long _liveSampleFrames;
+    std::array<int, atom::NumPads> _liveSamples; // player indices, or -1
+    std::vector<int32_t> _liveBuf;
+
+    // Reads _ring on its own thread, null unless detecting the tempo.
+    std::unique_ptr<TempoDetector> _tempo;
   };
 }
@@ -0,0 +1,360 @@
+#include "RecordingSink.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+
+using namespace ps;
+using namespace std;
+namespace c = std::chrono;
+
+namespace
+{
+  auto logger = Log("SINK");
+
+  class FlacSink : public RecordingSink
+  {
+  public:
+    FlacSink(
+        const string& fileName, const FlacSettings& settings,
+        const FileWriter::Options& options)
+      : _fileName(fileName)
+    {
+      if (settings.Threads > 0) {
+        _parallel = make_unique<ParallelFlacEncoder>(fileName, settings, options);
+        return;
+      }
+
+      _file = make_unique<FileWriter>(fileName, options);
+      _enc.reset(FLAC__stream_encoder_new());
+      configure(_enc.get(), settings);
+      auto res = FLAC__stream_encoder_init_stream(
+          _enc.get(),
+          &FlacSink::writeCallback,
+          &FlacSink::seekCallback,
+          &FlacSink::tellCallback,
+          nullptr,
+          this
+      );
+      if (res != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        logger.throw_("Could not initialize FLAC encoder ({})", (int)res);
+      }
+    }
+
+    void write(const int32_t* samples, long frames) override
+    {
+      if (_parallel) {
+        _parallel->process(samples, frames);
+        return;
+      }
+
+      // Let’s note that for FLAC a sample is an Alsa frame.
+      PS_TRACE_SCOPE("FLAC encode");
+      auto start = c::steady_clock::now();
+      FLAC__stream_encoder_process_interleaved(_enc.get(), samples, frames);
+      _encodeTime += c::steady_clock::now() - start;
+    }
+
+    void finish() override
+    {
+      if (_parallel) {
+        _parallel->finish();
+        return;
+      }
+      auto start = c::steady_clock::now();
+      FLAC__stream_encoder_finish(_enc.get());
+      _file->close();
+      _encodeTime += c::steady_clock::now() - start;
+      if (not _writeError.empty()) {
+        logger.throw_("{}, the FLAC file is likely incomplete", _writeError);
+      }
+    }
+
+    c::nanoseconds processTime() override
+    {
+      // With several threads this is CPU time rather than wall time.
+      return _parallel ? _parallel->encodeTime() : _encodeTime;
+    }
+
+    const string& fileName() const override { return _fileName; }
+
+  private:
+    // libFLAC seeks back to rewrite STREAMINFO (and the seek table) when
+    // finishing, so writes below the end become writeAt.
+    static FLAC__StreamEncoderWriteStatus writeCallback(
+        const FLAC__StreamEncoder*, const FLAC__byte buffer[], size_t bytes,
+        uint32_t, uint32_t, void* data)
+    {
+      auto self = static_cast<FlacSink*>(data);
+      try {
+        auto& file = *self->_file;
+        size_t inside = min<uint64_t>(bytes, file.size() - self->_position);
+        if (inside > 0) {
+          file.writeAt(self->_position, buffer, inside);
+        }
+        file.write(buffer + inside, bytes - inside);
+        self->_position += bytes;
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+      }
+      catch (const exception& ex) {
+        self->_writeError = ex.what();
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+      }
+    }
+
+    static FLAC__StreamEncoderSeekStatus seekCallback(
+        const FLAC__StreamEncoder*, FLAC__uint64 offset, void* data)
+    {
+      auto self = static_cast<FlacSink*>(data);
+      if (offset > self->_file->size()) {
+        return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+      }
+      self->_position = offset;
+      return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
+    }
+
+    static FLAC__StreamEncoderTellStatus tellCallback(
+        const FLAC__StreamEncoder*, FLAC__uint64* offset, void* data)
+    {
+      *offset = static_cast<FlacSink*>(data)->_position;
+      return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+    }
+
+    string _fileName;
+    std::unique_ptr<FileWriter> _file;
+    uint64_t _position = 0;
+    string _writeError;
+    FlacPtr _enc;
+    std::unique_ptr<ParallelFlacEncoder> _parallel;
+    c::nanoseconds _encodeTime{};
+  };
+
+
+  // ------------------------------ WAV ----------------------------------- //
+  // Layout written, the JUNK chunk is turned into ds64 when switching to RF64
+  // (EBU Tech 3306) so that nothing has to move.
+  constexpr uint64_t RiffSizeOffset = 4;
+  constexpr uint64_t JunkOffset = 12;
+  constexpr uint64_t DataSizeOffset = 76;
+  constexpr uint64_t WavHeaderSize = 80;
+
+  void put16(uint8_t* out, uint16_t v) { out[0] = v; out[1] = v >> 8; }
+  void put32(uint8_t* out, uint32_t v) { put16(out, v); put16(out + 2, v >> 16); }
+  void put64(uint8_t* out, uint64_t v) { put32(out, v); put32(out + 4, v >> 32); }
+  uint16_t get16(const uint8_t* in) { return in[0] | (in[1] << 8); }
+  uint32_t get32(const uint8_t* in) { return get16(in) | (uint32_t(get16(in + 2)) << 16); }
+  uint64_t get64(const uint8_t* in) { return get32(in) | (uint64_t(get32(in + 4)) << 32); }
+
+  int wavBytesPerSample(int bits)
+  {
+    return bits <= 16 ? 2 : 3;
+  }
+
+  class WavSink : public RecordingSink
+  {
+  public:
+    WavSink(
+        const string& fileName, const FlacSettings& settings,
+        const FileWriter::Options& options)
+      : _file(fileName, options)
+      , _channels(settings.Channels)
+      , _bytesPerSample(wavBytesPerSample(settings.Bits))
+    {
+      array<uint8_t, WavHeaderSize> header = {};
+      memcpy(&header[0], "RIFF", 4);
+      memcpy(&header[8], "WAVE", 4);
+      memcpy(&header[JunkOffset], "JUNK", 4);
+      put32(&header[JunkOffset + 4], 28); // room for ds64
+      memcpy(&header[48], "fmt ", 4);
+      put32(&header[52], 16);
+      put16(&header[56], 1); // PCM
+      put16(&header[58], _channels);
+      put32(&header[60], settings.Rate);
+      put32(&header[64], settings.Rate * _channels * _bytesPerSample);
+      put16(&header[68], _channels * _bytesPerSample);
+      put16(&header[70], _bytesPerSample * 8);
+      memcpy(&header[72], "data", 4);
+      _file.write(header.data(), header.size());
+    }
+
+    void write(const int32_t* samples, long frames) override
+    {
+      PS_TRACE_SCOPE("WAV write");
+      auto start = c::steady_clock::now();
+
+      // Only grows on the first buffer, the recorder always reads as much.
+      _buf.resize(frames * _channels * _bytesPerSample);
+      uint8_t* out = _buf.data();
+      const long count = frames * _channels;
+      if (_bytesPerSample == 2) {
+        for (long i = 0; i < count; ++i, out += 2) {
+          put16(out, samples[i]);
+        }
+      }
+      else {
+        for (long i = 0; i < count; ++i, out += 3) {
+          out[0] = samples[i];
+          out[1] = samples[i] >> 8;
+          out[2] = samples[i] >> 16;
+        }
+      }
+      _file.write(_buf.data(), _buf.size());
+
+      _processTime += c::steady_clock::now() - start;
+    }
+
+    void finish() override
+    {
+      auto start = c::steady_clock::now();
+
+      uint64_t dataSize = _file.size() - WavHeaderSize;
+      uint8_t size32[4];
+      if (_file.size() - 8 <= 0xffffffff) {
+        put32(size32, _file.size() - 8);
+        _file.writeAt(RiffSizeOffset, size32, 4);
+        put32(size32, dataSize);
+        _file.writeAt(DataSizeOffset, size32, 4);
+      }
+      else {
+        _file.writeAt(0, "RF64", 4);
+        put32(size32, 0xffffffff);
+        _file.writeAt(RiffSizeOffset, size32, 4);
+        _file.writeAt(DataSizeOffset, size32, 4);
+
+        array<uint8_t, 36> ds64 = {'d', 's', '6', '4'};
+        put32(&ds64[4], 28);
+        put64(&ds64[8], _file.size() - 8);
+        put64(&ds64[16], dataSize);
+        put64(&ds64[24], dataSize / (_channels * _bytesPerSample));
+        put32(&ds64[32], 0); // no table
+        _file.writeAt(JunkOffset, ds64.data(), ds64.size());
+      }
+      _file.close();
+
+      _processTime += c::steady_clock::now() - start;
+    }
+
+    c::nanoseconds processTime() override { return _processTime; }
+
+    const string& fileName() const override { return _file.fileName(); }
+
+  private:
+    FileWriter _file;
+    int _channels;
+    int _bytesPerSample;
+    std::vector<uint8_t> _buf;
+    c::nanoseconds _processTime{};
+  };
+}
+
+RecordingFormat ps::parseRecordingFormat(const string& str)
+{
+  if (str == "flac") {
+    return RecordingFormat::Flac;
+  }
+  if (str == "wav") {
+    return RecordingFormat::Wav;
+  }
+  throw Exception("Unknown recording format '{}', expecting flac or wav", str);
+}
+
+unique_ptr<RecordingSink> ps::makeSink(
+    RecordingFormat format, const string& baseName, const FlacSettings& settings,
+    const FileWriter::Options& options)
+{
+  switch (format) {
+    case RecordingFormat::Flac:
+      return make_unique<FlacSink>(baseName + ".flac", settings, options);
+    case RecordingFormat::Wav:
+      return make_unique<WavSink>(baseName + ".wav", settings, options);
+  }
+  __builtin_unreachable();
+}
+
+void ps::transcodeToFlac(const string& wavFile, const FlacSettings& settings)
+{
+  ifstream in(wavFile, ios::binary);
+  if (not in) {
+    logger.throw_("Could not open {} for transcoding", wavFile);
+  }
+
+  // Walk the chunks rather than assuming our own layout.
+  array<uint8_t, 12> riff;
+  in.read((char*)riff.data(), riff.size());
+  bool rf64 = memcmp(&riff[0], "RF64", 4) == 0;
+  if (not in or (memcmp(&riff[0], "RIFF", 4) != 0 and not rf64) or
+      memcmp(&riff[8], "WAVE", 4) != 0)
+  {
+    logger.throw_("{} is not a WAV file", wavFile);
+  }
+
+  FlacSettings flac = settings;
+  flac.Threads = 0; // no hurry, leave the other cores to the audio
+  uint64_t dataSize64 = 0;
+  uint64_t dataSize = 0;
+  int bytesPerSample = 0;
+  while (true) {
+    array<uint8_t, 8> chunk;
+    in.read((char*)chunk.data(), chunk.size());
+    if (not in) {
+      logger.throw_("No data in {}", wavFile);
+    }
+    uint32_t size = get32(&chunk[4]);
+    vector<uint8_t> body;
+    if (memcmp(&chunk[0], "data", 4) == 0) {
+      dataSize = rf64 and size == 0xffffffff ? dataSize64 : size;
+      break;
+    }
+    body.resize(size + (size % 2)); // chunks are word aligned
+    in.read((char*)body.data(), body.size());
+    if (memcmp(&chunk[0], "ds64", 4) == 0 and size >= 16) {
+      dataSize64 = get64(&body[8]);
+    }
+    else if (memcmp(&chunk[0], "fmt ", 4) == 0 and size >= 16) {
+      flac.Channels = get16(&body[2]);
+      flac.Rate = get32(&body[4]);
+      flac.Bits = get16(&body[14]);
+      bytesPerSample = flac.Bits / 8;
+      if (get16(&body[0]) != 1 or (flac.Bits != 16 and flac.Bits != 24)) {
+        logger.throw_("{} is not 16 or 24 bit PCM", wavFile);
+      }
+    }
+  }
+  if (bytesPerSample == 0) {
+    logger.throw_("No format chunk before the data in {}", wavFile);
+  }
+
+  auto baseName = wavFile.substr(0, wavFile.rfind('.'));
+  auto sink = makeSink(RecordingFormat::Flac, baseName, flac);
+
+  constexpr long blockFrames = 1 << 14;
+  const long frameBytes = flac.Channels * bytesPerSample;
+  vector<uint8_t> bytes(blockFrames * frameBytes);
+  vector<int32_t> samples(blockFrames * flac.Channels);
+  uint64_t left = dataSize;
+  while (left > 0) {
+    long frames = min<uint64_t>(blockFrames, left / frameBytes);
+    if (frames == 0) {
+      break;
+    }
+    in.read((char*)bytes.data(), frames * frameBytes);
+    frames = in.gcount() / frameBytes;
+    if (frames == 0) {
+      logger.warn("{} is shorter than its header says", wavFile);
+      break;
+    }
+    const uint8_t* b = bytes.data();
+    for (long i = 0; i < frames * flac.Channels; ++i, b += bytesPerSample) {
+      samples[i] = bytesPerSample == 2 ?
+          int16_t(get16(b)) :
+          int32_t((b[0] << 8) | (b[1] << 16) | (uint32_t(b[2]) << 24)) >> 8;
+    }
+    sink->write(samples.data(), frames);
+    left -= frames * frameBytes;
+  }
+  sink->finish();
+
+  logger.info("Transcoded {} to {}", wavFile, sink->fileName());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/// \file Where recorded audio goes: the capture side of the Recorder gives
+/// frames to a sink that encodes and writes them.
+
+#include "FileWriter.h"
+#include "FlacEncoder.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace ps
+{
+  enum class RecordingFormat
+  {
+    Flac,
+    /// RF64 once bigger than 4GB.
+    Wav,
+  };
+
+  RecordingFormat parseRecordingFormat(const std::string&);
+
+  class RecordingSink
+  {
+  public:
+    virtual ~RecordingSink() = default;
+
+    /// Interleaved frames, each value has at most `Bits` significant bits as
+    /// given by extractChannels.
+    virtual void write(const int32_t* samples, long frames) = 0;
+
+    /// Complete the file, the sink is not used after that.
+    virtual void finish() = 0;
+
+    /// Time spent in write and finish, to tell how far from realtime we are.
+    virtual std::chrono::nanoseconds processTime() = 0;
+
+    virtual const std::string& fileName() const = 0;
+  };
+
+  /// `baseName` is the path without extension, `settings` gives the audio
+  /// format (and FLAC options when relevant), `options` how the file is
+  /// written.
+  std::unique_ptr<RecordingSink> makeSink(
+      RecordingFormat, const std::string& baseName, const FlacSettings& settings,
+      const FileWriter::Options& options = {});
+
+  /// Encode a WAV file written by a Wav sink to FLAC. Meant to run in a low
+  /// priority thread once a recording is done, the WAV is kept.
+  void transcodeToFlac(const std::string& wavFile, const FlacSettings&);
+}
@@ -0,0 +1,259 @@
+#include "Resampler.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <tuple>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("RESAMPLE");
+
+  struct QualityParams
+  {
+    int Taps;
+    double Beta;    // Kaiser window
+    double Rolloff; // passband edge, fraction of the lower Nyquist
+  };
+
+  QualityParams params(ResampleQuality quality)
+  {
+    switch (quality) {
+      case ResampleQuality::Fast:   return {16, 6.0, 0.85};
+      case ResampleQuality::Medium: return {32, 8.0, 0.91};
+      case ResampleQuality::Best:   return {64, 10.0, 0.95};
+    }
+    __builtin_unreachable();
+  }
+
+  /// Modified Bessel function of the first kind, order 0.
+  double besselI0(double x)
+  {
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; ++k) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+      if (term < sum * 1e-12) {
+        break;
+      }
+    }
+    return sum;
+  }
+
+  shared_ptr<const FilterBank> makeBank(int up, int down, ResampleQuality quality)
+  {
+    auto p = params(quality);
+    // Downsampling needs a longer filter for the same transition band.
+    int taps = int(ceil(p.Taps * max(1.0, double(down) / up) / 8)) * 8;
+    double cutoff = 0.5 * p.Rolloff * min(1.0, double(up) / down);
+
+    auto bank = make_shared<FilterBank>();
+    bank->Up = up;
+    bank->Down = down;
+    bank->Taps = taps;
+    bank->Coeffs.resize(size_t(up) * taps);
+
+    const double half = taps / 2.0;
+    const double i0Beta = besselI0(p.Beta);
+    for (int phase = 0; phase < up; ++phase) {
+      float* coeffs = bank->Coeffs.data() + size_t(phase) * taps;
+      double sum = 0;
+      for (int k = 0; k < taps; ++k) {
+        // Distance in input frames between the output and the tap.
+        double t = double(phase) / up + half - 1 - k;
+        double x = 2 * cutoff * t;
+        double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+        double r = t / half;
+        double window = r * r >= 1 ? 0 : besselI0(p.Beta * sqrt(1 - r * r)) / i0Beta;
+        coeffs[k] = 2 * cutoff * sinc * window;
+        sum += coeffs[k];
+      }
+      // Unity gain at DC for every phase, no ripple on constant input.
+      for (int k = 0; k < taps; ++k) {
+        coeffs[k] /= sum;
+      }
+    }
+    return bank;
+  }
+
+  /// GCC vector extension, SSE on x86 and NEON on the Pi.
+  using Float4 = float __attribute__((vector_size(16)));
+
+  inline Float4 load4(const float* p)
+  {
+    Float4 result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+  }
+
+  /// `n` is a multiple of 8.
+  inline float dot(const float* a, const float* b, int n)
+  {
+    // Two accumulators to hide the latency of the adds.
+    Float4 acc0 = {};
+    Float4 acc1 = {};
+    for (int k = 0; k < n; k += 8) {
+      acc0 += load4(a + k) * load4(b + k);
+      acc1 += load4(a + k + 4) * load4(b + k + 4);
+    }
+    acc0 += acc1;
+    return (acc0[0] + acc0[1]) + (acc0[2] + acc0[3]);
+  }
+}
+
+ResampleQuality ps::parseResampleQuality(const string& str)
+{
+  if (str == "fast") {
+    return ResampleQuality::Fast;
+  }
+  if (str == "medium") {
+    return ResampleQuality::Medium;
+  }
+  if (str == "best") {
+    return ResampleQuality::Best;
+  }
+  throw Exception("Unknown resampling quality '{}', expecting fast, medium "
+      "or best", str);
+}
+
+const char* ps::toString(ResampleQuality quality)
+{
+  switch (quality) {
+    case ResampleQuality::Fast:   return "fast";
+    case ResampleQuality::Medium: return "medium";
+    case ResampleQuality::Best:   return "best";
+  }
+  __builtin_unreachable();
+}
+
+shared_ptr<const FilterBank> ps::filterBank(
+    int inRate, int outRate, ResampleQuality quality)
+{
+  int g = gcd(inRate, outRate);
+  int up = outRate / g;
+  int down = inRate / g;
+  if (up > 4096) {
+    logger.throw_("Cannot resample from {} to {}, the ratio is too complex",
+        inRate, outRate);
+  }
+
+  static mutex banksMutex;
+  static map<tuple<int, int, ResampleQuality>, shared_ptr<const FilterBank>> banks;
+
+  lock_guard lock(banksMutex);
+  auto& bank = banks[{up, down, quality}];
+  if (not bank) {
+    bank = makeBank(up, down, quality);
+  }
+  return bank;
+}
+
+Resampler::Resampler(
+    int inRate, int outRate, int channels, ResampleQuality quality,
+    long maxInFrames)
+  : _bank(filterBank(inRate, outRate, quality))
+  , _channels(channels)
+  , _maxInFrames(max(maxInFrames, long(_bank->Taps)))
+  , _history(channels, vector<float>(_bank->Taps + _maxInFrames))
+    // Half the filter of silence so that the first output is centered on
+    // the first input frame.
+  , _filled(_bank->Taps / 2 - 1)
+{ }
+
+long Resampler::maxOutFrames(long inFrames) const
+{
+  return (int64_t(inFrames) + _bank->Taps) * _bank->Up / _bank->Down + 1;
+}
+
+long Resampler::process(const float* in, long inFrames, float* out)
+{
+  PS_TRACE_SCOPE("Resampler::process");
+  long written = 0;
+  while (inFrames > 0) {
+    long count = min(inFrames, _maxInFrames);
+    written += processChunk(in, count, out + written * _channels);
+    in += count * _channels;
+    inFrames -= count;
+  }
+  return written;
+}
+
+long Resampler::processChunk(const float* in, long inFrames, float* out)
+{
+  for (int c = 0; c < _channels; ++c) {
+    float* history = _history[c].data() + _filled;
+    for (long i = 0; i < inFrames; ++i) {
+      history[i] = in[i * _channels + c];
+    }
+  }
+  _filled += inFrames;
+
+  long written = produce(out);
+
+  // Keep what the next outputs need at the front. When downsampling _base
+  // may already be past what we have, it then skips future input.
+  long shift = min(_base, _filled);
+  for (auto& history: _history) {
+    copy(history.begin() + shift, history.begin() + _filled, history.begin());
+  }
+  _filled -= shift;
+  _base -= shift;
+  return written;
+}
+
+long Resampler::produce(float* out)
+{
+  const int taps = _bank->Taps;
+  const int up = _bank->Up;
+  const int down = _bank->Down;
+  long written = 0;
+  while (_base + taps <= _filled) {
+    const float* coeffs = _bank->Coeffs.data() + size_t(_phase) * taps;
+    for (int c = 0; c < _channels; ++c) {
+      *out++ = dot(coeffs, _history[c].data() + _base, taps);
+    }
+    ++written;
+    _phase += down;
+    _base += _phase / up;
+    _phase %= up;
+  }
+  return written;
+}
+
+long Resampler::flush(float* out)
+{
+  // The history always has room for that many frames.
+  const long frames = _bank->Taps / 2;
+  for (auto& history: _history) {
+    fill(history.begin() + _filled, history.begin() + _filled + frames, 0.f);
+  }
+  _filled += frames;
+  return produce(out);
+}
+
+vector<float> ps::resample(
+    const float* in, long frames, int channels,
+    int inRate, int outRate, ResampleQuality quality)
+{
+  PS_TRACE_SCOPE("resample");
+  Resampler resampler(inRate, outRate, channels, quality);
+  const long expected = (int64_t(frames) * outRate + inRate - 1) / inRate;
+
+  vector<float> result(
+      (resampler.maxOutFrames(frames) + resampler.maxOutFrames(resampler.taps()))
+      * channels);
+  long written = resampler.process(in, frames, result.data());
+  resampler.flush(result.data() + written * channels);
+  // What is past the end of the input is the tail of the filter.
+  result.resize(expected * channels);
+  return result;
+}
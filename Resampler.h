@@ -0,0 +1,79 @@
+#pragma once
+
+/// \file Sample rate conversion with polyphase filter banks.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ps
+{
+  enum class ResampleQuality
+  {
+    /// 16 taps, fine for previewing.
+    Fast,
+    /// 32 taps.
+    Medium,
+    /// 64 taps, transparent for anything we play.
+    Best,
+  };
+
+  ResampleQuality parseResampleQuality(const std::string&);
+  const char* toString(ResampleQuality);
+
+  /// Kaiser windowed sinc, one set of `Taps` coefficients for each of the
+  /// `Phases` fractional positions between two input frames. Built once
+  /// per ratio and quality, then shared.
+  struct FilterBank
+  {
+    int Up;   // output rate / gcd
+    int Down; // input rate / gcd
+    int Taps; // multiple of 8
+    std::vector<float> Coeffs; // Up * Taps, phase after phase
+  };
+
+  std::shared_ptr<const FilterBank> filterBank(
+      int inRate, int outRate, ResampleQuality);
+
+  /// Streaming conversion of interleaved float frames, keeps the history
+  /// between calls. Nothing is allocated after construction as long as
+  /// calls give at most `maxInFrames` (larger calls are cut).
+  class Resampler
+  {
+  public:
+    Resampler(
+        int inRate, int outRate, int channels, ResampleQuality,
+        long maxInFrames = 4096);
+
+    /// Most frames `process` can produce for `inFrames`.
+    long maxOutFrames(long inFrames) const;
+
+    /// Returns the number of frames written to `out`.
+    long process(const float* in, long inFrames, float* out);
+
+    /// Push the last frames out, as if the input was followed by silence.
+    /// At most maxOutFrames(Taps) frames.
+    long flush(float* out);
+
+    int taps() const { return _bank->Taps; }
+
+  private:
+    long processChunk(const float* in, long inFrames, float* out);
+    long produce(float* out);
+
+    std::shared_ptr<const FilterBank> _bank;
+    int _channels;
+    long _maxInFrames;
+    // Planar history so that the filter reads contiguous input.
+    std::vector<std::vector<float>> _history;
+    long _filled;
+    long _base = 0;  // first input frame of the next output
+    int _phase = 0;  // fraction of the next output, in 1/Up
+  };
+
+  /// Convert a whole buffer, e.g. a sample being loaded. The result has
+  /// frames * outRate / inRate frames (rounded up).
+  std::vector<float> resample(
+      const float* in, long frames, int channels,
+      int inRate, int outRate, ResampleQuality);
+}
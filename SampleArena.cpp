@@ -0,0 +1,137 @@
+#include "SampleArena.h"
+#include "Log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("ARENA");
+
+  constexpr size_t HugePageSize = 2 << 20;
+}
+
+SampleArena::SampleArena(size_t bytes)
+{
+  if (bytes == 0) {
+    return;
+  }
+
+  void* data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // Only works when huge pages were reserved, e.g. vm.nr_hugepages. Small
+  // banks would waste most of a page.
+  if (bytes >= HugePageSize) {
+    _size = (bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+    data = mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+      _data = static_cast<uint8_t*>(data);
+      _hugePages = true;
+      return;
+    }
+  }
+#endif
+
+  _size = bytes;
+  data = mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    logger.throw_("Failed to map {} bytes for samples: {}",
+        _size, strerror(errno));
+  }
+  _data = static_cast<uint8_t*>(data);
+#ifdef MADV_HUGEPAGE
+  // Best effort, not all kernels have transparent huge pages.
+  madvise(_data, _size, MADV_HUGEPAGE);
+#endif
+}
+
+SampleArena::~SampleArena()
+{
+  if (_data) {
+    munmap(_data, _size);
+  }
+}
+
+uint8_t* SampleArena::allocate(size_t bytes)
+{
+  const size_t start = (_used + SampleBuffer::Alignment - 1)
+      / SampleBuffer::Alignment * SampleBuffer::Alignment;
+  if (start + bytes > _size) {
+    logger.throw_("Arena of {} bytes is full, cannot allocate {} more bytes",
+        _size, bytes);
+  }
+  _used = start + bytes;
+  return _data + start;
+}
+
+unique_ptr<SampleBank> SampleBank::pack(
+    vector<SampleBuffer>&& samples, const SampleBank* previous,
+    const vector<bool>& keep)
+{
+  auto source = [&](size_t i) -> const SampleBuffer& {
+    bool kept = previous and i < keep.size() and keep[i] and
+        i < previous->Samples.size();
+    return kept ? previous->Samples[i] : samples[i];
+  };
+
+  size_t total = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    total += source(i).bytes();
+  }
+
+  auto bank = make_unique<SampleBank>();
+  bank->Arena = make_unique<SampleArena>(total);
+  bank->Samples.reserve(samples.size());
+  bank->Unchanged.resize(samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    bank->Samples.push_back(source(i).copyTo(*bank->Arena));
+    bank->Unchanged[i] = &source(i) != &samples[i];
+    samples[i] = {}; // not keeping both copies around
+  }
+  samples.clear();
+  logger.debug("Packed {} samples in {} bytes{}", bank->Samples.size(),
+      bank->Arena->size(), bank->Arena->hugePages() ? " of huge pages" : "");
+  return bank;
+}
+
+unique_ptr<SampleBank> SampleBank::replace(
+    shared_ptr<const SampleBank> previous, size_t count, size_t index,
+    SampleBuffer&& sample)
+{
+  struct Layer
+  {
+    shared_ptr<const SampleBank> Previous;
+    SampleBuffer Sample;
+  };
+  auto layer = make_shared<Layer>(Layer{move(previous), move(sample)});
+
+  auto bank = make_unique<SampleBank>();
+  bank->Samples.resize(count);
+  bank->Unchanged.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (i == index) {
+      bank->Samples[i] = layer->Sample.view();
+    }
+    else if (layer->Previous and i < layer->Previous->Samples.size()) {
+      bank->Samples[i] = layer->Previous->Samples[i].view();
+      bank->Unchanged[i] = true;
+    }
+  }
+  bank->Mapping = move(layer);
+  return bank;
+}
+
+size_t SampleBank::bytes() const
+{
+  size_t total = 0;
+  for (auto& sample: Samples) {
+    total += sample.bytes();
+  }
+  return total;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/// \file One block of memory for all the samples of a bank.
+
+#include "SampleBuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ps
+{
+  /// A single mapping that sample buffers are carved out of, freed all at
+  /// once. Huge pages are used when the system has some reserved, the
+  /// kernel is otherwise asked to back it with transparent huge pages.
+  ///
+  /// Keeps the heap from fragmenting when banks are reloaded, which matters
+  /// with hundreds of MB of samples on a 1GB Pi.
+  class SampleArena
+  {
+  public:
+    explicit SampleArena(size_t bytes);
+    SampleArena(const SampleArena&) = delete;
+    ~SampleArena();
+
+    /// `bytes` aligned to SampleBuffer::Alignment, throws when full.
+    uint8_t* allocate(size_t bytes);
+
+    size_t size() const { return _size; }
+    size_t used() const { return _used; }
+    bool hugePages() const { return _hugePages; }
+
+  private:
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+    size_t _used = 0;
+    bool _hugePages = false;
+  };
+
+  /// The samples of a bank, ready to play. Built away from the playing
+  /// thread and handed over as a whole (see Player::setBank).
+  struct SampleBank
+  {
+    /// Copies `samples` into a new arena, empty ones stay empty slots.
+    /// Samples for which `keep` is true are copied from `previous` instead,
+    /// they keep playing when this bank replaces `previous`.
+    static std::unique_ptr<SampleBank> pack(
+        std::vector<SampleBuffer>&& samples,
+        const SampleBank* previous = nullptr,
+        const std::vector<bool>& keep = {});
+
+    /// `previous` with sample `index` replaced by `sample`, nothing is
+    /// copied: the new bank keeps `previous` alive and points into it. Only
+    /// `index` is changed for the player. `previous` may be null, the other
+    /// samples of the `count` are then empty.
+    static std::unique_ptr<SampleBank> replace(
+        std::shared_ptr<const SampleBank> previous, size_t count,
+        size_t index, SampleBuffer&& sample);
+
+    /// Of the samples, padding included.
+    size_t bytes() const;
+
+    std::unique_ptr<SampleArena> Arena;
+    // Or whatever else the samples point into, e.g. a bank image.
+    std::shared_ptr<const void> Mapping;
+    std::vector<SampleBuffer> Samples; // pointing into Arena or Mapping
+    std::vector<bool> Unchanged;       // per sample, see pack
+  };
+}
@@ -0,0 +1,216 @@
+#include "SampleBuffer.h"
+#include "SampleArena.h"
+#include "Log.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("SAMPLE");
+
+  constexpr float Int16Scale = 1.f / 32768;
+
+  template <typename T>
+  void addTo(
+      float* __restrict out, const T* __restrict in, long count, float scale)
+  {
+    const auto gain = simd::broadcast(scale);
+    long i = 0;
+    for (; i + simd::Lanes <= count; i += simd::Lanes) {
+      simd::store(out + i, simd::load(out + i) + simd::load(in + i) * gain);
+    }
+    for (; i < count; ++i) {
+      out[i] += in[i] * scale;
+    }
+  }
+
+  template <typename T>
+  void addTo(
+      float* __restrict out, const T* __restrict in, long count, float scale,
+      const float* __restrict gains)
+  {
+    const auto gain = simd::broadcast(scale);
+    long i = 0;
+    for (; i + simd::Lanes <= count; i += simd::Lanes) {
+      simd::store(out + i, simd::load(out + i) +
+          simd::load(in + i) * gain * simd::load(gains + i));
+    }
+    for (; i < count; ++i) {
+      out[i] += in[i] * scale * gains[i];
+    }
+  }
+
+  /// Catmull-Rom between `in[at]` and `in[at + 1]`, `frames` long.
+  template <typename T>
+  void addResampled(
+      float* __restrict out, const T* __restrict in, long frames, double from,
+      double step, long count, float scale, const float* __restrict gains)
+  {
+    const long last = frames - 1;
+    for (long i = 0; i < count; ++i) {
+      // From the start rather than accumulated, the error stays that of a
+      // single product.
+      const double position = from + i * step;
+      const long at = long(position);
+      const float t = float(position - at);
+      const float x0 = in[clamp(at - 1, 0l, last)];
+      const float x1 = in[min(at, last)];
+      const float x2 = in[min(at + 1, last)];
+      const float x3 = in[min(at + 2, last)];
+      const float c1 = 0.5f * (x2 - x0);
+      const float c2 = x0 - 2.5f * x1 + 2 * x2 - 0.5f * x3;
+      const float c3 = 0.5f * (x3 - x0) + 1.5f * (x1 - x2);
+      const float value = ((c3 * t + c2) * t + c1) * t + x1;
+      out[i] += value * scale * (gains ? gains[i] : 1.f);
+    }
+  }
+}
+
+size_t SampleBuffer::bytesFor(
+    SamplePrecision precision, int channels, long frames)
+{
+  const size_t sampleBytes = precision == SamplePrecision::Int16 ? 2 : 4;
+  return (frames * sampleBytes + Alignment - 1) / Alignment * Alignment
+      * channels;
+}
+
+SampleBuffer::SampleBuffer(SamplePrecision precision, int channels, long frames)
+  : _precision(precision)
+  , _channels(channels)
+  , _frames(frames)
+  , _stride(channels == 0 ? 0 : bytesFor(precision, channels, frames) / channels)
+{
+  if (bytes() == 0) {
+    return;
+  }
+  _data.reset(static_cast<uint8_t*>(aligned_alloc(Alignment, bytes())));
+  if (not _data) {
+    logger.throw_("Failed to allocate {} bytes for a sample", bytes());
+  }
+  memset(_data.get(), 0, bytes());
+}
+
+SampleBuffer::SampleBuffer(
+    SamplePrecision precision, int channels, long frames, SampleArena& arena)
+  : _precision(precision)
+  , _channels(channels)
+  , _frames(frames)
+  , _stride(channels == 0 ? 0 : bytesFor(precision, channels, frames) / channels)
+  , _data(nullptr, details::SampleFree{.Owned = false})
+{
+  if (bytes() == 0) {
+    return;
+  }
+  _data.reset(arena.allocate(bytes()));
+  memset(_data.get(), 0, bytes());
+}
+
+SampleBuffer SampleBuffer::copyTo(SampleArena& arena) const
+{
+  SampleBuffer result(_precision, _channels, _frames, arena);
+  if (bytes() != 0) {
+    memcpy(result._data.get(), _data.get(), bytes());
+  }
+  return result;
+}
+
+SampleBuffer SampleBuffer::view(
+    SamplePrecision precision, int channels, long frames, const uint8_t* data)
+{
+  SampleBuffer result;
+  result._precision = precision;
+  result._channels = channels;
+  result._frames = frames;
+  result._stride =
+      channels == 0 ? 0 : bytesFor(precision, channels, frames) / channels;
+  result._data = decltype(_data)(
+      const_cast<uint8_t*>(data), details::SampleFree{.Owned = false});
+  return result;
+}
+
+SampleBuffer SampleBuffer::fromInterleaved(
+    SamplePrecision precision, const float* in, int channels, long frames)
+{
+  SampleBuffer result(precision, channels, frames);
+  for (int c = 0; c < channels; ++c) {
+    if (precision == SamplePrecision::Int16) {
+      int16_t* out = result.int16(c);
+      for (long f = 0; f < frames; ++f) {
+        long v = lrintf(in[f * channels + c] * 32768.f);
+        out[f] = int16_t(clamp(v, -32768l, 32767l));
+      }
+    }
+    else {
+      float* out = result.float32(c);
+      for (long f = 0; f < frames; ++f) {
+        out[f] = clamp(in[f * channels + c], -1.f, 1.f);
+      }
+    }
+  }
+  return result;
+}
+
+vector<float> SampleBuffer::interleaved() const
+{
+  vector<float> result(size_t(_frames) * _channels);
+  for (int c = 0; c < _channels; ++c) {
+    for (long f = 0; f < _frames; ++f) {
+      result[f * _channels + c] = _precision == SamplePrecision::Int16 ?
+          int16(c)[f] * Int16Scale : float32(c)[f];
+    }
+  }
+  return result;
+}
+
+void SampleBuffer::mixInto(float* left, float* right, long from, long count) const
+{
+  float* outs[2] = {left, right};
+  for (int side = 0; side < 2; ++side) {
+    int c = min(side, _channels - 1);
+    if (_precision == SamplePrecision::Int16) {
+      addTo(outs[side], int16(c) + from, count, Int16Scale);
+    }
+    else {
+      addTo(outs[side], float32(c) + from, count, 1.f);
+    }
+  }
+}
+
+void SampleBuffer::mixInto(
+    float* left, float* right, long from, long count,
+    const float* gains) const
+{
+  float* outs[2] = {left, right};
+  for (int side = 0; side < 2; ++side) {
+    int c = min(side, _channels - 1);
+    if (_precision == SamplePrecision::Int16) {
+      addTo(outs[side], int16(c) + from, count, Int16Scale, gains);
+    }
+    else {
+      addTo(outs[side], float32(c) + from, count, 1.f, gains);
+    }
+  }
+}
+
+void SampleBuffer::mixResampled(float* left, float* right, double from,
+    double step, long count, const float* gains) const
+{
+  float* outs[2] = {left, right};
+  for (int side = 0; side < 2; ++side) {
+    int c = min(side, _channels - 1);
+    if (_precision == SamplePrecision::Int16) {
+      addResampled(outs[side], int16(c), _frames, from, step, count,
+          Int16Scale, gains);
+    }
+    else {
+      addResampled(outs[side], float32(c), _frames, from, step, count, 1.f,
+          gains);
+    }
+  }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+/// \file Audio of the samples as kept in memory by the player.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ps
+{
+  class SampleArena;
+
+  namespace details
+  {
+    struct SampleFree
+    {
+      bool Owned = true; // false when from an arena
+      void operator()(uint8_t* p) const
+      {
+        if (Owned) {
+          std::free(p);
+        }
+      }
+    };
+  }
+
+  enum class SamplePrecision
+  {
+    /// Half the memory, plenty for sources that are 16 bits anyway.
+    Int16,
+    Float,
+  };
+
+  /// Planar frames, each channel starts on its own cache line so that the
+  /// mixer walks contiguous and aligned memory. Values are in [-1, 1],
+  /// 16 bit values are scaled when mixed.
+  ///
+  /// Move only, the samples are never copied once loaded. The memory comes
+  /// from the heap or from an arena, which then owns it.
+  class SampleBuffer
+  {
+  public:
+    static constexpr size_t Alignment = 64;
+
+    /// Memory needed for such a buffer, padding included.
+    static size_t bytesFor(SamplePrecision, int channels, long frames);
+
+    SampleBuffer() = default;
+    /// Zeroed frames.
+    SampleBuffer(SamplePrecision, int channels, long frames);
+    /// Zeroed frames allocated from `arena`.
+    SampleBuffer(SamplePrecision, int channels, long frames, SampleArena&);
+
+    /// Same frames, in memory from `arena`.
+    SampleBuffer copyTo(SampleArena&) const;
+
+    /// Frames already in memory laid out as a buffer would be (see
+    /// bytesFor), e.g. in a mapped file. Nothing is copied nor freed, the
+    /// memory is only read.
+    static SampleBuffer view(
+        SamplePrecision, int channels, long frames, const uint8_t* data);
+    /// Same, of this buffer which must outlive the view.
+    SampleBuffer view() const
+    {
+      return view(_precision, _channels, _frames, data());
+    }
+
+    /// Convert interleaved frames, values are clamped to [-1, 1].
+    static SampleBuffer fromInterleaved(
+        SamplePrecision, const float* in, int channels, long frames);
+
+    SamplePrecision precision() const { return _precision; }
+    int channels() const { return _channels; }
+    long frames() const { return _frames; }
+    bool empty() const { return _frames == 0; }
+    /// Memory used, padding included.
+    size_t bytes() const { return _stride * _channels; }
+    /// `bytes` bytes, channel after channel.
+    const uint8_t* data() const { return _data.get(); }
+
+    int16_t* int16(int channel)
+    {
+      return reinterpret_cast<int16_t*>(_data.get() + channel * _stride);
+    }
+    const int16_t* int16(int channel) const
+    {
+      return reinterpret_cast<const int16_t*>(_data.get() + channel * _stride);
+    }
+    float* float32(int channel)
+    {
+      return reinterpret_cast<float*>(_data.get() + channel * _stride);
+    }
+    const float* float32(int channel) const
+    {
+      return reinterpret_cast<const float*>(_data.get() + channel * _stride);
+    }
+
+    /// Back to interleaved float, e.g. to resample.
+    std::vector<float> interleaved() const;
+
+    /// Add `count` frames starting at `from` to the planar stereo `left` and
+    /// `right`. Mono is added to both.
+    void mixInto(float* left, float* right, long from, long count) const;
+    /// Same with a gain per frame, `count` of them, for fades.
+    void mixInto(float* left, float* right, long from, long count,
+        const float* gains) const;
+    /// Same reading a frame every `step` frames from `from`, between frames
+    /// with cubic interpolation, e.g. to play at another pitch. `gains` may
+    /// be null. Frames past the end read as the last one.
+    void mixResampled(float* left, float* right, double from, double step,
+        long count, const float* gains) const;
+
+  private:
+    SamplePrecision _precision = SamplePrecision::Float;
+    int _channels = 0;
+    long _frames = 0;
+    size_t _stride = 0; // bytes between channels, a multiple of Alignment
+    std::unique_ptr<uint8_t[], details::SampleFree> _data;
+  };
+}
@@ -0,0 +1,402 @@
+#include "Sequencer.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+using namespace atom;
+using namespace ps;
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace
+{
+  auto logger = Log("SEQ");
+
+  constexpr char Magic[8] = "PSPATTS";
+  constexpr uint32_t Version = 1;
+
+  /// Followed by the patterns of BankCount banks, as laid out in memory
+  /// (little endian, as on the Pi).
+  struct Header
+  {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t BankCount;
+  };
+
+  static_assert(is_trivially_copyable_v<Sequencer::Pattern>);
+  static_assert(sizeof(Sequencer::Step) == 18 and sizeof(Header) == 16);
+
+  // Edits are saved once they stop for that long, and on exit.
+  constexpr auto SaveDelay = c::seconds(2);
+
+  constexpr Color Playhead{.r = 0x7f, .g = 0x7f, .b = 0x7f};
+}
+
+Sequencer::Sequencer(Device& device, Pads& pads, Player& player, fs::path file)
+  : PadsAccess(pads)
+  , _device(device)
+  , _player(player)
+  , _file(move(file))
+{
+  try {
+    load();
+  }
+  catch (const exception& ex) {
+    logger.warn("Not using the patterns of {} ({})", _file, ex.what());
+    _patterns.clear();
+  }
+}
+
+Sequencer::~Sequencer()
+{
+  if (_unsaved) {
+    save();
+  }
+  if (_buttonOn) {
+    _device.sendControl(switchButton(Buttons::Play, false));
+  }
+}
+
+Sequencer::Pattern& Sequencer::pattern(int bank)
+{
+  if (bank >= int(_patterns.size())) {
+    _patterns.resize(bank + 1);
+  }
+  return _patterns[bank];
+}
+
+void Sequencer::setBank(int bank, const Sounds& sounds)
+{
+  _bank = bank;
+  _sounds = sounds;
+  if (isAccessing()) {
+    onAccess();
+  }
+}
+
+void Sequencer::toggle(const Beat& beat)
+{
+  if (_playing) {
+    _playing = false;
+    _recording = false;
+    // Drops what is scheduled, of the bars of every bank still in flight.
+    // What already plays goes on, as do the pads played meanwhile.
+    for (auto& bar: _bars) {
+      if (bar.Length.count() == 0) {
+        continue;
+      }
+      for (int sample: bar.Samples) {
+        if (sample >= 0) {
+          _player.cancel(bar.Bank, sample);
+        }
+      }
+      bar = {};
+    }
+    logger.info("Pattern stopped");
+    return;
+  }
+
+  if (beat) {
+    _beat = beat;
+  }
+  const auto now = c::steady_clock::now();
+  if (not _beat) {
+    // Free running, from now on.
+    _beat = Beat{
+      .Last = now,
+      .Period = c::microseconds(
+          llround(60e6 / _player.effects().tempo())),
+    };
+  }
+  _playing = true;
+  _nextBar = _beat.next(now, Beat::BeatsPerBar);
+  logger.info("Pattern of bank {} playing at {:.1f} BPM", _bank + 1,
+      _beat.bpm());
+}
+
+void Sequencer::toggleRecording(const Beat& beat)
+{
+  _recording = not _recording;
+  if (_recording and not _playing) {
+    toggle(beat);
+  }
+  logger.info("Pattern recording {}", _recording ? "on" : "off");
+}
+
+void Sequencer::hit(int pad, c::steady_clock::time_point time)
+{
+  if (not _recording or pad < 0 or pad >= NumPads) {
+    return;
+  }
+  // The bar of the nearest step, a hit just before a bar is on its first.
+  for (auto& bar: _bars) {
+    const auto halfStep = bar.Length / (2 * Steps);
+    if (bar.Length.count() == 0 or bar.Bank != _bank or
+        time < bar.Start - halfStep or time >= bar.Start + bar.Length - halfStep)
+    {
+      continue;
+    }
+    const long units = lround(double((time - bar.Start).count()) *
+        Steps * NudgesPerStep / bar.Length.count());
+    const int step = clamp(int(floor(double(units) / NudgesPerStep + 0.5)),
+        0, Steps - 1);
+    const int nudge = clamp(units - step * NudgesPerStep,
+        long(INT8_MIN), long(INT8_MAX));
+
+    auto& on = pattern(_bank)[step];
+    on.Pads |= 1 << pad;
+    on.Nudges[pad] = nudge;
+    logger.debug("Recorded pad {} on step {} ({:+})", pad + 1, step + 1, nudge);
+    changed();
+    // It was just heard, but not in the bars scheduled after this one.
+    playLate(step, pad, time + halfStep);
+    return;
+  }
+}
+
+void Sequencer::padPressed(atom::Pad p, bool select)
+{
+  const int index = p - Pad::One;
+  if (index < 0 or index >= NumPads) {
+    return;
+  }
+  if (select) {
+    _track = index;
+    logger.info("Track of pad {}", _track + 1);
+    onAccess();
+    return;
+  }
+
+  auto& step = pattern(_bank)[index];
+  step.Pads ^= 1 << _track;
+  step.Nudges[_track] = 0;
+  if (step.Pads & (1 << _track)) {
+    playLate(index, _track, c::steady_clock::now());
+  }
+  changed();
+  if (isAccessing()) {
+    showStep(index);
+  }
+}
+
+void Sequencer::clear(bool all)
+{
+  for (auto& step: pattern(_bank)) {
+    if (all) {
+      step = {};
+    }
+    else {
+      step.Pads &= ~(1 << _track);
+      step.Nudges[_track] = 0;
+    }
+  }
+  logger.info("Cleared the {} of bank {}",
+      all ? "pattern" : fmt::format("track of pad {}", _track + 1), _bank + 1);
+  changed();
+  if (isAccessing()) {
+    onAccess();
+  }
+}
+
+void Sequencer::poll(const Beat& beat)
+{
+  if (beat) {
+    _beat = beat;
+  }
+  const auto now = c::steady_clock::now();
+  if (_playing) {
+    const auto length = _beat.Period * Beat::BeatsPerBar;
+    if (_nextBar + length < now) {
+      // Stalled for more than a bar, better skip than play it all at once.
+      _nextBar = _beat.next(now, Beat::BeatsPerBar);
+    }
+    if (_nextBar - now < length) {
+      scheduleBar();
+    }
+  }
+
+  int step = currentStep(now);
+  if (step != _shownStep and isAccessing()) {
+    const int previous = _shownStep;
+    _shownStep = step;
+    if (previous >= 0) {
+      showStep(previous);
+    }
+    if (step >= 0) {
+      showStep(step);
+    }
+  }
+  // Lit while playing, blinks on the beat while recording.
+  const bool on = _playing and (not _recording or step % 4 < 2);
+  if (on != _buttonOn) {
+    _buttonOn = on;
+    _device.sendControl(switchButton(Buttons::Play, on));
+  }
+
+  if (_unsaved and now - _changedAt > SaveDelay) {
+    save();
+  }
+}
+
+void Sequencer::scheduleBar()
+{
+  PS_TRACE_SCOPE("Sequencer::scheduleBar");
+  Bar bar{
+    .Start = _nextBar,
+    .Length = _beat.Period * Beat::BeatsPerBar,
+    .Bank = _bank,
+  };
+  bar.Samples.fill(-1);
+  const auto& steps = pattern(_bank);
+  for (int step = 0; step < Steps; ++step) {
+    for (int pad = 0; pad < NumPads; ++pad) {
+      if (steps[step].Pads & (1 << pad)) {
+        play(bar, step, pad);
+      }
+    }
+  }
+  _bars = {_bars[1], bar};
+  // The bar closest to the end of this one, which moves with the beat.
+  _nextBar = _beat.next(bar.Start + bar.Length / 2, Beat::BeatsPerBar);
+}
+
+void Sequencer::play(Bar& bar, int step, int pad)
+{
+  const auto& sound = _sounds[pad];
+  if (sound.Sample < 0) {
+    return;
+  }
+  bar.Samples[pad] = sound.Sample;
+  auto settings = sound.Play;
+  if (settings.Mode == PlayMode::Gate) {
+    settings.Mode = PlayMode::OneShot; // nothing releases it
+  }
+  _player.play(bar.Bank, sound.Sample, settings,
+      timeOf(bar, step, pattern(bar.Bank)[step].Nudges[pad]));
+}
+
+void Sequencer::playLate(int step, int pad, c::steady_clock::time_point after)
+{
+  for (auto& bar: _bars) {
+    if (bar.Length.count() > 0 and bar.Bank == _bank and
+        timeOf(bar, step, pattern(_bank)[step].Nudges[pad]) > after)
+    {
+      play(bar, step, pad);
+    }
+  }
+}
+
+c::steady_clock::time_point Sequencer::timeOf(
+    const Bar& bar, int step, int nudge) const
+{
+  return bar.Start +
+      bar.Length * (step * NudgesPerStep + nudge) / (Steps * NudgesPerStep);
+}
+
+int Sequencer::currentStep(c::steady_clock::time_point now) const
+{
+  if (not _playing) {
+    return -1;
+  }
+  for (auto& bar: _bars) {
+    if (bar.Length.count() > 0 and now >= bar.Start and
+        now < bar.Start + bar.Length)
+    {
+      return (now - bar.Start) * Steps / bar.Length;
+    }
+  }
+  return -1;
+}
+
+void Sequencer::onAccess()
+{
+  for (int step = 0; step < Steps; ++step) {
+    showStep(step);
+  }
+}
+
+void Sequencer::showStep(int step)
+{
+  if (step == _shownStep) {
+    pads().setPad(Pad::One + step, PadMode::On, Playhead);
+  }
+  else if (pattern(_bank)[step].Pads & (1 << _track)) {
+    pads().setPad(Pad::One + step, PadMode::On, _sounds[_track].Color);
+  }
+  else {
+    pads().setPad(Pad::One + step, PadMode::Off, Color{});
+  }
+}
+
+void Sequencer::changed()
+{
+  _unsaved = true;
+  _changedAt = c::steady_clock::now();
+}
+
+void Sequencer::load()
+{
+  error_code error;
+  if (not fs::exists(_file, error)) {
+    return;
+  }
+  ifstream in(_file, ios::binary);
+  Header header{};
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (not in or memcmp(header.Magic, Magic, sizeof(Magic)) != 0) {
+    logger.throw_("{} is not a patterns file", _file);
+  }
+  if (header.Version != Version) {
+    logger.throw_("{} has version {}, expecting {}", _file, header.Version,
+        Version);
+  }
+  if (header.BankCount > uint32_t(Player::MaxBanks)) {
+    logger.throw_("{} has {} banks, at most {} are supported", _file,
+        header.BankCount, Player::MaxBanks);
+  }
+  vector<Pattern> patterns(header.BankCount);
+  in.read(reinterpret_cast<char*>(patterns.data()),
+      patterns.size() * sizeof(Pattern));
+  if (not in) {
+    logger.throw_("{} is truncated", _file);
+  }
+  _patterns = move(patterns);
+  logger.info("Loaded the patterns of {} banks from {}", _patterns.size(),
+      _file);
+}
+
+void Sequencer::save()
+{
+  _unsaved = false;
+  Header header{};
+  memcpy(header.Magic, Magic, sizeof(Magic));
+  header.Version = Version;
+  header.BankCount = _patterns.size();
+
+  // Written aside and renamed, never half written.
+  auto temporary = _file;
+  temporary += ".tmp";
+  {
+    ofstream out(temporary, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(_patterns.data()),
+        _patterns.size() * sizeof(Pattern));
+    out.close();
+    if (not out) {
+      logger.warn("Failed to write the patterns to {}", temporary);
+      return;
+    }
+  }
+  error_code error;
+  fs::rename(temporary, _file, error);
+  if (error) {
+    logger.warn("Failed to save the patterns to {} ({})", _file,
+        error.message());
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+/// \file The pattern sequencer of the Player view.
+
+#include "Device.h"
+#include "PadsAccess.h"
+#include "Playback.h"
+#include "Player.h"
+#include "Tempo.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace ps
+{
+  namespace c = std::chrono;
+
+  /// Loops a bar of 16 steps per bank, each step hitting any of the pads of
+  /// the bank. A bar is given to the player a bar before it starts, with
+  /// when each hit is to be heard, so that it starts on its frame however
+  /// late the main loop wakes up. Pads hit while recording are kept on the
+  /// nearest step, with how far from it they were heard.
+  ///
+  /// In the Player view the pads are the steps of a track, that of one pad
+  /// of the bank. Patterns are saved next to the samples file.
+  class Sequencer : public PadsAccess
+  {
+  public:
+    static constexpr int Steps = 16;
+    /// Hits are kept that precisely, in fractions of a step.
+    static constexpr int NudgesPerStep = 256;
+
+    /// The pads hit on a step.
+    struct Step
+    {
+      uint16_t Pads = 0; // a bit per pad
+      /// From the step, in 1/NudgesPerStep of a step.
+      std::array<int8_t, atom::NumPads> Nudges{};
+    };
+    using Pattern = std::array<Step, Steps>;
+
+    /// What a pad of the bank plays.
+    struct Sound
+    {
+      int Sample = -1; // in the bank of the player, -1 for none
+      PlaySettings Play;
+      atom::Color Color;
+    };
+    using Sounds = std::array<Sound, atom::NumPads>;
+
+    /// Patterns are read from `file` and saved to it.
+    Sequencer(Device&, Pads&, Player&, std::filesystem::path file);
+    Sequencer(const Sequencer&) = delete;
+    /// Saves what changed.
+    ~Sequencer();
+
+    /// The pattern of `bank` plays from the next bar scheduled on, with
+    /// `sounds`.
+    void setBank(int bank, const Sounds& sounds);
+
+    /// Starts on the next bar of `beat`, or stops. Without a tempo, at that
+    /// of the delay.
+    void toggle(const Beat& beat);
+    /// Starts playing as well. Pads hit are recorded until toggled again.
+    void toggleRecording(const Beat& beat);
+
+    /// A pad of the bank was hit, it is heard at `time`.
+    void hit(int pad, c::steady_clock::time_point time);
+
+    /// A pad was pressed in the Player view, toggles the step of the track.
+    /// `select` makes the pad of the same index the track instead.
+    void padPressed(atom::Pad, bool select);
+    /// The steps of the track, or all of the pattern. What was already
+    /// scheduled still plays, at most a bar.
+    void clear(bool all);
+
+    /// Schedules the next bar once it is a bar away, shows the steps.
+    /// `beat` as PiSample::currentBeat gives it, the last one is kept while
+    /// there is none.
+    void poll(const Beat& beat);
+
+  private:
+    struct Bar
+    {
+      c::steady_clock::time_point Start;
+      c::steady_clock::duration Length{0}; // 0 when none
+      int Bank = -1;
+      // Of the pads it hits, to stop them.
+      std::array<int, atom::NumPads> Samples{};
+    };
+
+    void onAccess() override;
+
+    Pattern& pattern(int bank);
+    void scheduleBar();
+    /// The hit of `pad` on `step` in `bar`.
+    void play(Bar& bar, int step, int pad);
+    /// Same in the bars already scheduled, when heard after `after`.
+    void playLate(int step, int pad, c::steady_clock::time_point after);
+    c::steady_clock::time_point timeOf(const Bar&, int step, int nudge) const;
+    /// The step playing, -1 for none.
+    int currentStep(c::steady_clock::time_point now) const;
+    void showStep(int step);
+    void changed();
+
+    void load();
+    void save();
+
+    Device& _device;
+    Player& _player;
+    const std::filesystem::path _file;
+
+    std::vector<Pattern> _patterns; // per bank, grown as needed
+    int _bank = 0;
+    Sounds _sounds;
+    int _track = 0;
+
+    bool _playing = false;
+    bool _recording = false;
+    Beat _beat;
+    // The last two scheduled, the latest last.
+    std::array<Bar, 2> _bars;
+    c::steady_clock::time_point _nextBar;
+
+    int _shownStep = -1; // the playhead on the pads
+    bool _buttonOn = false;
+    bool _unsaved = false;
+    c::steady_clock::time_point _changedAt;
+  };
+}
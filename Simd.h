@@ -0,0 +1,77 @@
+#pragma once
+
+/// \file GCC vector extensions for the mixer: NEON on the Pi, SSE or AVX2 on
+/// x86 depending on what the compiler targets. No intrinsics, the same code
+/// builds everywhere.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace ps::simd
+{
+#ifdef __AVX2__
+  constexpr int Lanes = 8;
+#else
+  constexpr int Lanes = 4;
+#endif
+
+  using Floats = float __attribute__((vector_size(Lanes * sizeof(float))));
+  using Ints = int32_t __attribute__((vector_size(Lanes * sizeof(int32_t))));
+
+  inline Floats load(const float* p)
+  {
+    Floats result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+  }
+
+  /// Widened to float, not scaled.
+  inline Floats load(const int16_t* p)
+  {
+#if defined(__clang__) or __GNUC__ >= 9
+    using Shorts = int16_t __attribute__((vector_size(Lanes * sizeof(int16_t))));
+    Shorts shorts;
+    memcpy(&shorts, p, sizeof(shorts));
+    return __builtin_convertvector(shorts, Floats);
+#else
+    // The cross compiler (GCC 8) does not have __builtin_convertvector.
+    Floats result;
+    for (int i = 0; i < Lanes; ++i) {
+      result[i] = p[i];
+    }
+    return result;
+#endif
+  }
+
+  inline void store(float* p, Floats value)
+  {
+    memcpy(p, &value, sizeof(value));
+  }
+
+  inline Floats broadcast(float value)
+  {
+    Floats result;
+    for (int i = 0; i < Lanes; ++i) {
+      result[i] = value;
+    }
+    return result;
+  }
+
+  /// Clamped to [low, high], branch free.
+  inline Floats clamp(Floats value, Floats low, Floats high)
+  {
+    value = value < low ? low : value;
+    return value > high ? high : value;
+  }
+
+  /// Rounded to nearest, values must fit in an int32.
+  inline Ints round(Floats value)
+  {
+    Ints result;
+    for (int i = 0; i < Lanes; ++i) {
+      result[i] = lrintf(value[i]); // a single instruction
+    }
+    return result;
+  }
+}
@@ -0,0 +1,198 @@
+#include "Stems.h"
+#include "Frames.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+using namespace ps;
+using namespace std;
+namespace c = std::chrono;
+
+namespace
+{
+  auto logger = Log("STEM");
+}
+
+StemMode ps::parseStemMode(const string& str)
+{
+  if (str.empty() or str == "none") {
+    return StemMode::None;
+  }
+  if (str == "pairs") {
+    return StemMode::Pairs;
+  }
+  if (str == "all") {
+    return StemMode::All;
+  }
+  throw Exception("Unknown stem mode '{}', expecting none, pairs or all", str);
+}
+
+StemSinks::StemSinks(
+    StemMode mode, RecordingFormat format, const string& baseName,
+    int inChannelCount, int bits, long maxFrames,
+    const FlacSettings& settings, const FileWriter::Options& options)
+  : _inChannelCount(inChannelCount)
+  , _bits(bits)
+  , _groupSize(mode == StemMode::Pairs ? 2 : inChannelCount)
+  , _maxFrames(maxFrames)
+{
+  if (mode == StemMode::None) {
+    logger.throw_("No stems to record");
+  }
+  if (inChannelCount % _groupSize != 0) {
+    logger.throw_("Cannot record pairs of an odd number of channels ({})",
+        inChannelCount);
+  }
+  if (format == RecordingFormat::Flac and _groupSize > 8) {
+    logger.throw_("FLAC supports at most 8 channels, there are {}. Record "
+        "pairs or wav instead.", _groupSize);
+  }
+
+  FlacSettings stem = settings;
+  stem.Channels = _groupSize;
+  const int groups = inChannelCount / _groupSize;
+  for (int g = 0; g < groups; ++g) {
+    auto name = mode == StemMode::Pairs ?
+        fmt::format("{}-ch{}-{}", baseName, g * 2, g * 2 + 1) :
+        baseName + "-all";
+    _sinks.push_back(makeSink(format, name, stem, options));
+  }
+
+  for (int set = 0; set < 2; ++set) {
+    _buffers[set].resize(groups);
+    for (auto& buffer: _buffers[set]) {
+      buffer.resize(maxFrames * _groupSize);
+      _bufferPtrs[set].push_back(buffer.data());
+    }
+  }
+
+  _written.resize(groups);
+  for (int g = 0; g < groups; ++g) {
+    _workers.emplace_back([this, g] { work(g); });
+  }
+}
+
+StemSinks::~StemSinks()
+{
+  try {
+    finish();
+  }
+  catch (const exception& ex) {
+    logger.error("{}", ex.what());
+  }
+}
+
+void StemSinks::write(const uint8_t* in, long frames)
+{
+  PS_TRACE_SCOPE("StemSinks::write");
+  while (frames > 0) {
+    long count = min(frames, _maxFrames);
+    int set = _posted % 2;
+    {
+      // The set was given to the workers two writes ago.
+      unique_lock lock(_mutex);
+      _cond.wait(lock, [&] {
+        return all_of(begin(_written), end(_written),
+            [&](long written) { return written >= _posted - 1; });
+      });
+    }
+
+    splitChannels(in, _inChannelCount, _bits, _groupSize,
+        _bufferPtrs[set].data(), count);
+
+    {
+      lock_guard lock(_mutex);
+      _frames[set] = count;
+      ++_posted;
+    }
+    _cond.notify_all();
+
+    in += count * _inChannelCount * storageBytes(_bits);
+    frames -= count;
+  }
+}
+
+void StemSinks::work(int stem)
+{
+  trace::setThreadName("stem");
+  while (true) {
+    long block;
+    long frames;
+    {
+      unique_lock lock(_mutex);
+      _cond.wait(lock, [&] { return _stop or _posted > _written[stem]; });
+      if (_posted == _written[stem]) {
+        return; // stopping, and everything is written
+      }
+      block = _written[stem];
+      frames = _frames[block % 2];
+    }
+
+    try {
+      _sinks[stem]->write(_buffers[block % 2][stem].data(), frames);
+    }
+    catch (const exception& ex) {
+      lock_guard lock(_mutex);
+      if (_error.empty()) {
+        _error = fmt::format("{}: {}", _sinks[stem]->fileName(), ex.what());
+      }
+    }
+
+    {
+      lock_guard lock(_mutex);
+      ++_written[stem];
+    }
+    _cond.notify_all();
+  }
+}
+
+void StemSinks::finish()
+{
+  if (_finished) {
+    return;
+  }
+  _finished = true;
+
+  {
+    lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _cond.notify_all();
+  for (auto& worker: _workers) {
+    worker.join();
+  }
+
+  string error = _error;
+  for (auto& sink: _sinks) {
+    try {
+      sink->finish();
+    }
+    catch (const exception& ex) {
+      if (error.empty()) {
+        error = fmt::format("{}: {}", sink->fileName(), ex.what());
+      }
+    }
+  }
+  if (not error.empty()) {
+    logger.throw_("Failed to record stems, {}", error);
+  }
+}
+
+c::nanoseconds StemSinks::processTime()
+{
+  c::nanoseconds result{};
+  for (auto& sink: _sinks) {
+    result += sink->processTime();
+  }
+  return result;
+}
+
+vector<string> StemSinks::fileNames() const
+{
+  vector<string> result;
+  for (auto& sink: _sinks) {
+    result.push_back(sink->fileName());
+  }
+  return result;
+}
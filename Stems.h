@@ -0,0 +1,84 @@
+#pragma once
+
+/// \file Recording all the channels of the input, as stems.
+
+#include "RecordingSink.h"
+
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  enum class StemMode
+  {
+    /// Only the channels given to the recorder.
+    None,
+    /// One stereo file per pair of channels.
+    Pairs,
+    /// One file with every channel.
+    All,
+  };
+
+  StemMode parseStemMode(const std::string&);
+
+  /// Splits ALSA buffers into groups of channels and gives each group to its
+  /// own sink, encoded by its own thread.
+  ///
+  /// The split is done on the calling thread, in a single pass, into one of
+  /// two sets of buffers. `write` only waits if the sinks did not finish
+  /// the previous buffer yet.
+  class StemSinks
+  {
+  public:
+    /// `format` and `settings` are the ones of a single stem except for the
+    /// number of channels, which is set here.
+    StemSinks(
+        StemMode, RecordingFormat, const std::string& baseName,
+        int inChannelCount, int bits, long maxFrames,
+        const FlacSettings& settings, const FileWriter::Options& options);
+    StemSinks(const StemSinks&) = delete;
+    /// Finishes if needed, errors are only logged.
+    ~StemSinks();
+
+    /// Frames as read from ALSA, with `inChannelCount` channels.
+    void write(const uint8_t* in, long frames);
+
+    /// Wait for the sinks and complete their files.
+    void finish();
+
+    /// Sum across the sinks, i.e. CPU time rather than wall time.
+    std::chrono::nanoseconds processTime();
+
+    std::vector<std::string> fileNames() const;
+
+  private:
+    void work(int stem);
+
+    int _inChannelCount;
+    int _bits;
+    int _groupSize;
+    long _maxFrames;
+    std::vector<std::unique_ptr<RecordingSink>> _sinks;
+    std::vector<std::thread> _workers;
+    bool _finished = false;
+
+    // Two sets of stem buffers, alternating.
+    std::array<std::vector<std::vector<int32_t>>, 2> _buffers;
+    std::array<std::vector<int32_t*>, 2> _bufferPtrs;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    // ---------- members below must be accessed under the mutex ------------ //
+    long _posted = 0;                 // buffers given to the workers
+    std::array<long, 2> _frames = {}; // in each set of buffers
+    std::vector<long> _written;       // buffers written by each worker
+    std::string _error;
+    bool _stop = false;
+    // ---------------------------------------------------------------------- //
+  };
+}
@@ -0,0 +1,277 @@
+#include "Stretcher.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("STRETCH");
+
+  // Long enough for a bass note to repeat in a window, short enough not to
+  // smear the hits much.
+  constexpr double WindowSeconds = 0.04;
+  // How far a window moves from where the pace of the output puts it.
+  constexpr double ToleranceSeconds = 0.01;
+  // The search runs at about that rate first, then around the best match
+  // at full rate.
+  constexpr int SearchRate = 12000;
+
+  // Factors are kept to that precision, e.g. 0.01% of the tempo.
+  constexpr long RatioScale = 10000;
+
+  /// Where, from `from` to `to`, `mono` over `length` frames best looks
+  /// like it does at `reference`, every `stride` frames. Normalized, so that
+  /// louder parts do not win for being louder.
+  long bestMatch(const vector<float>& mono, long reference, long from, long to,
+      long stride, long length)
+  {
+    long best = from;
+    double bestScore = -1e30;
+    for (long at = from; at <= to; at += stride) {
+      double dot = 0;
+      double energy = 1e-9;
+      for (long i = 0; i < length; i += stride) {
+        dot += mono[reference + i] * mono[at + i];
+        energy += mono[at + i] * mono[at + i];
+      }
+      const double score = dot / sqrt(energy);
+      if (score > bestScore) {
+        bestScore = score;
+        best = at;
+      }
+    }
+    return best;
+  }
+}
+
+SampleBuffer ps::timeStretch(const SampleBuffer& in, double factor, int rate)
+{
+  PS_TRACE_SCOPE("timeStretch");
+  const int channels = in.channels();
+  const long inFrames = in.frames();
+  const long outFrames = lround(inFrames * factor);
+  const long hop = max(8l, lround(WindowSeconds * rate / 2));
+  const long window = 2 * hop;
+  const long tolerance = lround(ToleranceSeconds * rate);
+  const long stride = max(1, rate / SearchRate);
+
+  const auto x = in.interleaved();
+  vector<float> out(outFrames * channels, 0.f);
+  if (inFrames < window + 2 * tolerance) {
+    // Too short to stretch, cut or padded with silence.
+    copy_n(x.begin(), min(inFrames, outFrames) * channels, out.begin());
+    return SampleBuffer::fromInterleaved(
+        in.precision(), out.data(), channels, outFrames);
+  }
+
+  vector<float> mono(inFrames);
+  for (long f = 0; f < inFrames; ++f) {
+    for (int c = 0; c < channels; ++c) {
+      mono[f] += x[f * channels + c];
+    }
+  }
+  // Squared sines overlapped by half sum to 1. They never reach 0 so that
+  // the edges, under a single window, can be divided by it.
+  vector<float> shape(window);
+  for (long n = 0; n < window; ++n) {
+    const double s = sin(M_PI * (n + 0.5) / window);
+    shape[n] = s * s;
+  }
+  vector<float> weights(outFrames, 0.f);
+
+  const long last = inFrames - window;
+  long previous = 0;
+  for (long at = 0; at < outFrames; at += hop) {
+    long start = 0;
+    if (at > 0) {
+      // Around where the pace puts it, what best follows the previous window
+      // as it went on.
+      const long natural = min(previous + hop, last);
+      const long nominal = clamp(lround(at / factor), 0l, last);
+      const long from = max(0l, nominal - tolerance);
+      const long to = min(last, nominal + tolerance);
+      start = bestMatch(mono, natural, from, to, stride, hop);
+      start = bestMatch(mono, natural, max(from, start - stride + 1),
+          min(to, start + stride - 1), 1, hop);
+    }
+    const long count = min(window, outFrames - at);
+    for (long n = 0; n < count; ++n) {
+      const float w = shape[n];
+      weights[at + n] += w;
+      for (int c = 0; c < channels; ++c) {
+        out[(at + n) * channels + c] += w * x[(start + n) * channels + c];
+      }
+    }
+    previous = start;
+  }
+  for (long f = 0; f < outFrames; ++f) {
+    for (int c = 0; c < channels; ++c) {
+      out[f * channels + c] /= weights[f];
+    }
+  }
+  return SampleBuffer::fromInterleaved(
+      in.precision(), out.data(), channels, outFrames);
+}
+
+Stretcher::Stretcher(Player& player, size_t budget)
+  : _player(player)
+  , _budget(budget)
+  , _wanted(Player::MaxBanks * atom::NumPads, RatioScale)
+  , _generations(Player::MaxBanks * atom::NumPads, 0)
+{
+  _thread = thread([this] { run(); });
+}
+
+Stretcher::~Stretcher()
+{
+  {
+    lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _wake.notify_one();
+  _thread.join();
+}
+
+void Stretcher::stretch(int bank, int sample,
+    shared_ptr<const SampleBank> source, double factor)
+{
+  if (bank < 0 or bank >= Player::MaxBanks or sample < 0 or
+      sample >= atom::NumPads or not source)
+  {
+    return;
+  }
+  const int slot = bank * atom::NumPads + sample;
+  const long ratio = lround(factor * RatioScale);
+  lock_guard lock(_mutex);
+  if (_wanted[slot] == ratio) {
+    return;
+  }
+  _wanted[slot] = ratio;
+  _jobs.erase(
+      remove_if(begin(_jobs), end(_jobs), [&](auto& job) {
+        return job.Bank == bank and job.Sample == sample;
+      }),
+      end(_jobs));
+
+  if (ratio == RatioScale) {
+    _player.setStretched(bank, sample, nullptr);
+    return;
+  }
+  if (auto stretched = find(bank, sample, ratio)) {
+    stretched->LastUsed = ++_clock;
+    _player.setStretched(bank, sample, stretched->Data);
+    return;
+  }
+  _jobs.push_back(Job{
+    .Bank = bank, .Sample = sample, .Ratio = ratio, .Source = move(source)});
+  _wake.notify_one();
+}
+
+void Stretcher::forget(int bank, int sample)
+{
+  if (bank < 0 or bank >= Player::MaxBanks or sample < 0 or
+      sample >= atom::NumPads)
+  {
+    return;
+  }
+  const int slot = bank * atom::NumPads + sample;
+  lock_guard lock(_mutex);
+  ++_generations[slot];
+  _wanted[slot] = RatioScale;
+  _jobs.erase(
+      remove_if(begin(_jobs), end(_jobs), [&](auto& job) {
+        return job.Bank == bank and job.Sample == sample;
+      }),
+      end(_jobs));
+  _cache.erase(
+      remove_if(begin(_cache), end(_cache), [&](auto& stretched) {
+        if (stretched.Bank != bank or stretched.Sample != sample) {
+          return false;
+        }
+        _bytes -= stretched.Data->bytes();
+        return true;
+      }),
+      end(_cache));
+  _player.setStretched(bank, sample, nullptr);
+}
+
+Stretcher::Stretched* Stretcher::find(int bank, int sample, long ratio)
+{
+  for (auto& stretched: _cache) {
+    if (stretched.Bank == bank and stretched.Sample == sample and
+        stretched.Ratio == ratio)
+    {
+      return &stretched;
+    }
+  }
+  return nullptr;
+}
+
+void Stretcher::evict()
+{
+  // The one just stretched is the most recent, it always stays.
+  while (_budget > 0 and _bytes > _budget and _cache.size() > 1) {
+    auto oldest = min_element(begin(_cache), end(_cache),
+        [](auto& a, auto& b) { return a.LastUsed < b.LastUsed; });
+    _bytes -= oldest->Data->bytes();
+    _cache.erase(oldest);
+  }
+}
+
+void Stretcher::run()
+{
+  trace::setThreadName("stretch");
+  // Below the audio threads, a sample stretched late only plays as is a
+  // little longer.
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+  unique_lock lock(_mutex);
+  while (true) {
+    _wake.wait(lock, [this] { return _stop or not _jobs.empty(); });
+    if (_stop) {
+      return;
+    }
+    auto job = move(_jobs.front());
+    _jobs.erase(_jobs.begin());
+    const int slot = job.Bank * atom::NumPads + job.Sample;
+    const uint64_t generation = _generations[slot];
+    lock.unlock();
+
+    shared_ptr<const SampleBuffer> data;
+    if (job.Sample < int(job.Source->Samples.size()) and
+        not job.Source->Samples[job.Sample].empty())
+    {
+      const double factor = double(job.Ratio) / RatioScale;
+      PS_LOG_TIME(logger, "stretching {}",
+          fmt::format("pad {} of bank {} by {:.4f}", job.Sample + 1,
+              job.Bank + 1, factor))
+      {
+        data = make_shared<const SampleBuffer>(timeStretch(
+            job.Source->Samples[job.Sample], factor, _player.rate()));
+      };
+    }
+    job.Source.reset(); // not under the mutex, it may be the last one
+
+    lock.lock();
+    if (not data or generation != _generations[slot]) {
+      continue; // the sample changed meanwhile
+    }
+    _cache.push_back(Stretched{
+      .Bank = job.Bank, .Sample = job.Sample, .Ratio = job.Ratio,
+      .Data = data, .LastUsed = ++_clock});
+    _bytes += data->bytes();
+    if (_wanted[slot] == job.Ratio) {
+      _player.setStretched(job.Bank, job.Sample, data);
+    }
+    evict();
+  }
+}
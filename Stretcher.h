@@ -0,0 +1,90 @@
+#pragma once
+
+/// \file Samples time-stretched to the tempo, in the background.
+
+#include "Player.h"
+#include "SampleArena.h"
+#include "SampleBuffer.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  /// `in` made `factor` times as long at the same pitch, with WSOLA: windows
+  /// of the input overlapped at the pace of the output, each moved a little
+  /// to where it best continues the previous one. `rate` of the sample.
+  /// Any thread.
+  SampleBuffer timeStretch(const SampleBuffer& in, double factor, int rate);
+
+  /// Stretches samples of the banks of the player on its own thread, and
+  /// gives each to the player once done (see Player::setStretched), so that
+  /// the playing thread only ever reads ready buffers. Samples stretched
+  /// are kept per ratio within a memory budget, tempos already played are
+  /// instant.
+  class Stretcher
+  {
+  public:
+    /// `budget` in bytes, 0 for no limit.
+    Stretcher(Player&, size_t budget);
+    Stretcher(const Stretcher&) = delete;
+    ~Stretcher();
+
+    /// The player plays the sample at `sample` in `bank`, held by `source`,
+    /// `factor` times as long from when it is ready on. 1 plays it as is.
+    /// The last call for a sample wins.
+    void stretch(int bank, int sample, std::shared_ptr<const SampleBank> source,
+        double factor);
+    /// The sample changed, what was stretched from it is dropped and the
+    /// player plays it as is.
+    void forget(int bank, int sample);
+
+  private:
+    struct Job
+    {
+      int Bank = -1;
+      int Sample = -1;
+      long Ratio = 0; // factor in 1/RatioScale
+      std::shared_ptr<const SampleBank> Source;
+    };
+
+    struct Stretched
+    {
+      int Bank = -1;
+      int Sample = -1;
+      long Ratio = 0;
+      std::shared_ptr<const SampleBuffer> Data;
+      uint64_t LastUsed = 0;
+    };
+
+    void run();
+    /// Under the mutex, null when not stretched to `ratio` yet.
+    Stretched* find(int bank, int sample, long ratio);
+    /// Drop the least recently used until under the budget, under the mutex.
+    void evict();
+
+    Player& _player;
+    const size_t _budget;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    // ---------- members below must be accessed under the mutex ------------ //
+    std::vector<Job> _jobs; // one per sample at most, oldest first
+    std::vector<Stretched> _cache;
+    size_t _bytes = 0;
+    // Per bank * atom::NumPads + sample: the ratio the player is to play,
+    // and how many times the sample changed, to drop what was stretched
+    // from an older one.
+    std::vector<long> _wanted;
+    std::vector<uint64_t> _generations;
+    uint64_t _clock = 0;
+    bool _stop = false;
+    // ---------------------------------------------------------------------- //
+
+    std::thread _thread;
+  };
+}
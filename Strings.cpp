@@ -1,7 +1,14 @@
 #include "Strings.h"
 #include "fmt.h"
 
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace ps;
 using namespace std;
@@ -15,21 +22,22 @@ string ps::readTextFile(const filesystem::path file)
         static_cast<string>(file));
   }
 
-  if (not entry.is_regular_file() or not entry.is_symlink()) {
+  // Symlinks are followed.
+  if (not entry.is_regular_file()) {
     throw Exception("Not supporting reading '{}', it’s not a normal file or a "
         "symlink.", static_cast<string>(file));
   }
 
-  string result;
-  result.resize(entry.file_size());
-
-  ifstream in(file);
+  ifstream in(file, ios::binary);
   if (not in) {
     throw Exception("Failed to open '{}' for reading", static_cast<string>(file));
   }
 
-  in.read(result.data(), result.size());
-  if (not in) {
+  // Up to its end as it is now, it may have changed since its size was read.
+  string result;
+  result.reserve(entry.file_size());
+  result.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  if (in.bad()) {
     throw Exception("Failed to read '{}'", static_cast<string>(file));
   }
 
@@ -47,4 +55,40 @@ void ps::split(vector<string_view>& out, string_view in, char delim)
     pos = in.find(delim);
   }
   out.push_back(string_view(begin(in), end(in) - begin(in)));
-}
\ No newline at end of file
+}
+
+MappedFile::MappedFile(const filesystem::path& file)
+{
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw Exception("Failed to open '{}' for reading: {}",
+        static_cast<string>(file), strerror(errno));
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    int error = errno;
+    close(fd);
+    throw Exception("Failed to read '{}': {}", static_cast<string>(file),
+        strerror(error));
+  }
+  _size = info.st_size;
+  if (_size == 0) {
+    close(fd); // nothing to map, an empty view
+    return;
+  }
+  void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int error = errno;
+  close(fd); // the mapping keeps the file
+  if (data == MAP_FAILED) {
+    throw Exception("Failed to map '{}': {}", static_cast<string>(file),
+        strerror(error));
+  }
+  _data = static_cast<const char*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+  if (_data) {
+    munmap(const_cast<char*>(_data), _size);
+  }
+}
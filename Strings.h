@@ -1,7 +1,11 @@
 #pragma once
 
+#include <charconv>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <filesystem>
+#include <vector>
 
 
 namespace ps
@@ -10,6 +14,45 @@ namespace ps
   /// Not ideal for huge files.
   std::string readTextFile(const std::filesystem::path file);
 
+  /// A file mapped read only in memory, parsed in place without copies.
+  class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::filesystem::path&);
+    MappedFile(const MappedFile&) = delete;
+    ~MappedFile();
+
+    std::string_view text() const { return {_data, _size}; }
+
+  private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+  };
+
+  /// Call `f(line, lineNumber)` for each line of `text`, 1-based, without
+  /// the end of line (\n or \r\n).
+  template <class Func>
+  void forEachLine(std::string_view text, Func&& f)
+  {
+    int number = 0;
+    while (not text.empty()) {
+      auto end = text.find('\n');
+      auto line = text.substr(0, end);
+      text = end == std::string_view::npos ?
+          std::string_view{} : text.substr(end + 1);
+      if (not line.empty() and line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+      f(line, ++number);
+    }
+  }
+
+  /// 1-based column of `part` in `line`, `part` must be a view into `line`.
+  inline int columnOf(std::string_view line, std::string_view part)
+  {
+    return int(part.data() - line.data()) + 1;
+  }
+
   /// Split a string_view into parts, over a single character.
   void split(std::vector<std::string_view>& out, std::string_view in, char delim);
 
@@ -29,11 +72,30 @@ namespace ps
     return in;
   }
 
-  /// No from chars in this GCC version (8.3.0) :'(
-  /// Going the slow way as this is not needed in the fastpath.
-  /// Throw on errors.
-  inline int svtoi(std::string_view in)
+  /// The whole of `in` must be the number, throws on errors.
+  inline int svtoi(std::string_view in, int base = 10)
+  {
+    int result = 0;
+    auto [end, error] = std::from_chars(in.data(), in.data() + in.size(),
+        result, base);
+    if (error == std::errc::result_out_of_range) {
+      throw std::out_of_range("Number out of range: " + std::string(in));
+    }
+    if (error != std::errc() or end != in.data() + in.size() or in.empty()) {
+      throw std::invalid_argument("Not a number: " + std::string(in));
+    }
+    return result;
+  }
+
+  /// Same for a decimal number.
+  inline double svtod(std::string_view in)
   {
-    return std::stoi(std::string(in));
+    const std::string str(in);
+    size_t end = 0;
+    double result = std::stod(str, &end);
+    if (end != str.size()) {
+      throw std::invalid_argument("Not a number: " + str);
+    }
+    return result;
   }
 }
\ No newline at end of file
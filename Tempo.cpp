@@ -0,0 +1,46 @@
+#include "Tempo.h"
+
+using namespace ps;
+using namespace std;
+
+c::steady_clock::time_point Beat::next(
+    c::steady_clock::time_point time, int beats) const
+{
+  // Groups start on a beat before Last, counted from the bar.
+  const auto start = Last - (BeatInBar % beats) * Period;
+  const auto group = beats * Period;
+  if (time <= start) {
+    return start;
+  }
+  const auto groups = (time - start + group - c::nanoseconds(1)) / group;
+  return start + groups * group;
+}
+
+void TapTempo::tap(c::steady_clock::time_point time)
+{
+  if (not _taps.empty() and time - _taps.back() > MaxGap) {
+    _taps.clear();
+    _count = 0;
+  }
+  if (int(_taps.size()) == MaxTaps) {
+    _taps.erase(_taps.begin());
+  }
+  _taps.push_back(time);
+  ++_count;
+  if (_taps.size() < 2) {
+    return;
+  }
+  _beat = Beat{
+    .Last = time,
+    .Period = c::duration_cast<c::microseconds>(
+        (_taps.back() - _taps.front()) / (_taps.size() - 1)),
+    .BeatInBar = (_count - 1) % Beat::BeatsPerBar,
+  };
+}
+
+void TapTempo::clear()
+{
+  _taps.clear();
+  _count = 0;
+  _beat = {};
+}
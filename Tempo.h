@@ -0,0 +1,50 @@
+#pragma once
+
+/// \file Where the beats fall, whoever tells it.
+
+#include <chrono>
+#include <vector>
+
+namespace ps
+{
+  namespace c = std::chrono;
+
+  struct Beat
+  {
+    static constexpr int BeatsPerBar = 4;
+
+    c::steady_clock::time_point Last; // when the last beat was heard
+    c::microseconds Period{0};        // 0 when there is no tempo
+    /// Of Last, 0 for the first beat of a bar. When the source does not know
+    /// where bars start, any beat is as good.
+    int BeatInBar = 0;
+
+    explicit operator bool() const { return Period.count() > 0; }
+    double bpm() const { return 60e6 / Period.count(); }
+    /// The first start of a group of `beats` beats from `time` on, e.g. the
+    /// next bar for BeatsPerBar. Must have a tempo.
+    c::steady_clock::time_point next(
+        c::steady_clock::time_point time, int beats = 1) const;
+  };
+
+  /// The tempo of a button tapped on the beat, the first tap of a series
+  /// starts a bar. Taps further apart than MaxGap start a new series.
+  class TapTempo
+  {
+  public:
+    static constexpr c::milliseconds MaxGap{2000};
+    /// Taps averaged, the last ones.
+    static constexpr int MaxTaps = 8;
+
+    void tap(c::steady_clock::time_point);
+    /// Forget the taps and the tempo.
+    void clear();
+    /// No tempo until tapped twice.
+    const Beat& beat() const { return _beat; }
+
+  private:
+    std::vector<c::steady_clock::time_point> _taps;
+    int _count = 0; // in the series, more than kept in _taps
+    Beat _beat;
+  };
+}
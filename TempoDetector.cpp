@@ -0,0 +1,338 @@
+#include "TempoDetector.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("TEMPO");
+
+  // Onsets are found at about that rate, plenty for kicks and snares.
+  constexpr int AnalysisRate = 12000;
+  constexpr int FftSize = 512;
+  constexpr int Hop = 128; // about 10ms
+  // Of magnitudes, log(1 + C x) so that quiet parts still have onsets.
+  constexpr float Compression = 100;
+  // Bins above weigh less and less in the flux.
+  constexpr float KickHz = 150;
+
+  constexpr double HistorySeconds = 8;
+  constexpr double MinHistorySeconds = 4;
+  constexpr double EstimateSeconds = 0.5;
+  constexpr double MinBpm = 60;
+  constexpr double MaxBpm = 180;
+  constexpr double PreferredBpm = 120;
+  // The best lag must stand that much above the average one.
+  constexpr double MinConfidence = 1.1;
+  // Estimates closer than that to the published tempo refine it, others
+  // must be heard twice in a row to replace it.
+  constexpr double SameTempo = 0.03;
+
+  constexpr uint64_t LastMask = (uint64_t(1) << 40) - 1;
+  constexpr uint64_t PeriodMask = (uint64_t(1) << 24) - 1;
+
+  /// In place radix 2, `n` a power of 2.
+  void fft(float* re, float* im, int n, const float* cosines, const float* sines)
+  {
+    for (int i = 1, j = 0; i < n; ++i) {
+      int bit = n >> 1;
+      for (; j & bit; bit >>= 1) {
+        j ^= bit;
+      }
+      j ^= bit;
+      if (i < j) {
+        swap(re[i], re[j]);
+        swap(im[i], im[j]);
+      }
+    }
+    for (int length = 2; length <= n; length <<= 1) {
+      const int stride = n / length;
+      for (int start = 0; start < n; start += length) {
+        for (int k = 0; k < length / 2; ++k) {
+          const float wr = cosines[k * stride];
+          const float wi = -sines[k * stride];
+          const int a = start + k;
+          const int b = a + length / 2;
+          const float tr = re[b] * wr - im[b] * wi;
+          const float ti = re[b] * wi + im[b] * wr;
+          re[b] = re[a] - tr;
+          im[b] = im[a] - ti;
+          re[a] += tr;
+          im[a] += ti;
+        }
+      }
+    }
+  }
+}
+
+TempoDetector::TempoDetector(int rate, int bits, const CaptureRing* ring)
+  : _rate(rate)
+  , _scale(1.f / (1 << (bits - 1)))
+  , _decimation(max(1, int(lround(double(rate) / AnalysisRate))))
+  , _hopSeconds(double(Hop) * _decimation / rate)
+  , _ring(ring)
+  , _epoch(c::steady_clock::now())
+{
+  _window.resize(FftSize);
+  _hann.resize(FftSize);
+  for (int i = 0; i < FftSize; ++i) {
+    _hann[i] = 0.5f - 0.5f * cos(2 * float(M_PI) * i / FftSize);
+  }
+  _re.resize(FftSize);
+  _im.resize(FftSize);
+  _twiddles.resize(FftSize);
+  for (int k = 0; k < FftSize / 2; ++k) {
+    _twiddles[k] = cos(2 * M_PI * k / FftSize);
+    _twiddles[FftSize / 2 + k] = sin(2 * M_PI * k / FftSize);
+  }
+  _magnitudes.resize(FftSize / 2 + 1);
+  _weights.resize(FftSize / 2 + 1);
+  const float lowBins = KickHz * FftSize * _decimation / rate;
+  for (int k = 0; k <= FftSize / 2; ++k) {
+    _weights[k] = 1 / (1 + k / lowBins);
+  }
+  _onsets.resize(size_t(ceil(HistorySeconds / _hopSeconds)));
+  _envelope.resize(_onsets.size());
+  _sums.resize(_onsets.size() + 1);
+  _correlation.resize(size_t(ceil(60 / MinBpm / _hopSeconds)) + 2);
+
+  if (_ring) {
+    _thread = thread([this] { run(); });
+  }
+}
+
+TempoDetector::~TempoDetector()
+{
+  _stop = true;
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+Beat TempoDetector::beat() const
+{
+  const uint64_t packed = _beat.load(memory_order_acquire);
+  if (packed == 0) {
+    return {};
+  }
+  // The bits above the 40 kept are those of now, the beat is not that far.
+  const int64_t now = c::duration_cast<c::microseconds>(
+      c::steady_clock::now() - _epoch).count();
+  int64_t ago = (uint64_t(now) - (packed >> 24)) & LastMask;
+  if (ago > int64_t(LastMask / 2)) {
+    ago -= LastMask + 1;
+  }
+  return Beat{
+    .Last = _epoch + c::microseconds(now - ago),
+    .Period = c::microseconds(packed & PeriodMask),
+  };
+}
+
+double TempoDetector::load() const
+{
+  const double seconds = double(_analyzedFrames.load()) / _rate;
+  return seconds > 0 ? _busyMicros.load() / 1e6 / seconds : 0.;
+}
+
+void TempoDetector::run()
+{
+  trace::setThreadName("tempo");
+  // Below the audio threads, it can always catch up later.
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+  vector<int32_t> samples;
+  samples.reserve(_ring->capacity() * _ring->channels());
+  uint64_t position = _ring->written();
+  while (not _stop) {
+    // Often enough that the beats are not late by much.
+    this_thread::sleep_for(c::milliseconds(5));
+    long frames = _ring->copyFrom(position, _ring->capacity(), samples);
+    if (frames == 0) {
+      continue;
+    }
+    const auto start = c::steady_clock::now();
+    analyze(samples.data(), _ring->channels(), frames, start);
+    _busyMicros += c::duration_cast<c::microseconds>(
+        c::steady_clock::now() - start).count();
+  }
+}
+
+void TempoDetector::analyze(const int32_t* samples, int channels, long frames,
+    c::steady_clock::time_point end)
+{
+  PS_TRACE_SCOPE("TempoDetector::analyze");
+  const float scale = _scale / (channels * _decimation);
+  const uint64_t estimateHops = max(1l, lround(EstimateSeconds / _hopSeconds));
+  for (long f = 0; f < frames; ++f) {
+    for (int ch = 0; ch < channels; ++ch) {
+      _sum += samples[f * channels + ch];
+    }
+    if (++_summed < _decimation) {
+      continue;
+    }
+    _window[_filled++] = _sum * scale;
+    _sum = 0;
+    _summed = 0;
+    if (_filled < FftSize) {
+      continue;
+    }
+
+    _onsets[_hops++ % _onsets.size()] = flux();
+    copy(_window.begin() + Hop, _window.end(), _window.begin());
+    _filled = FftSize - Hop;
+    if (_hops % estimateHops == 0) {
+      estimate(end - c::duration_cast<c::steady_clock::duration>(
+          c::duration<double>(double(frames - 1 - f) / _rate)));
+    }
+  }
+  _analyzedFrames += frames;
+}
+
+float TempoDetector::flux()
+{
+  for (int i = 0; i < FftSize; ++i) {
+    _re[i] = _window[i] * _hann[i];
+    _im[i] = 0;
+  }
+  fft(_re.data(), _im.data(), FftSize, _twiddles.data(),
+      _twiddles.data() + FftSize / 2);
+  // Only what got louder, onsets rather than their tails. Low bins weigh
+  // more, the beat is where the kicks are rather than the hi-hats.
+  float result = 0;
+  for (int k = 1; k <= FftSize / 2; ++k) {
+    const float magnitude =
+        log1p(Compression * sqrt(_re[k] * _re[k] + _im[k] * _im[k]));
+    result += max(0.f, magnitude - _magnitudes[k]) * _weights[k];
+    _magnitudes[k] = magnitude;
+  }
+  return result;
+}
+
+void TempoDetector::estimate(c::steady_clock::time_point end)
+{
+  PS_TRACE_SCOPE("TempoDetector::estimate");
+  const long n = min<uint64_t>(_hops, _onsets.size());
+  if (n * _hopSeconds < MinHistorySeconds) {
+    return;
+  }
+  // In order, minus the average around so that only what stands out
+  // counts.
+  _sums[0] = 0;
+  for (long i = 0; i < n; ++i) {
+    _envelope[i] = _onsets[(_hops - n + i) % _onsets.size()];
+    _sums[i + 1] = _sums[i] + _envelope[i];
+  }
+  if (_sums[n] <= 0) {
+    return; // silence
+  }
+  const long around = lround(0.1 / _hopSeconds);
+  for (long i = 0; i < n; ++i) {
+    const long from = max(0l, i - around);
+    const long to = min(n, i + around + 1);
+    const double mean = (_sums[to] - _sums[from]) / (to - from);
+    _envelope[i] = max(0., _envelope[i] - mean);
+  }
+
+  // The tempo, from the lag the onsets repeat at.
+  const int minLag = max(1, int(floor(60 / MaxBpm / _hopSeconds)));
+  const int maxLag = min(int(ceil(60 / MinBpm / _hopSeconds)),
+      int(_correlation.size()) - 1);
+  int bestLag = 0;
+  double best = 0;
+  double total = 0;
+  for (int lag = minLag; lag <= maxLag; ++lag) {
+    double sum = 0;
+    for (long i = lag; i < n; ++i) {
+      sum += _envelope[i] * _envelope[i - lag];
+    }
+    _correlation[lag] = sum / (n - lag);
+    total += _correlation[lag];
+    // Half or double tempos correlate too, the one closer to the usual
+    // tempos wins.
+    const double octaves = log2(60 / (lag * _hopSeconds) / PreferredBpm);
+    const double weighted = _correlation[lag] * exp(-2 * octaves * octaves);
+    if (weighted > best) {
+      best = weighted;
+      bestLag = lag;
+    }
+  }
+  const double mean = total / (maxLag - minLag + 1);
+  if (bestLag == 0 or _correlation[bestLag] < MinConfidence * mean) {
+    return; // nothing regular enough
+  }
+  double lag = bestLag;
+  if (bestLag > minLag and bestLag < maxLag) {
+    // Between lags, from the neighbours.
+    const double a = _correlation[bestLag - 1];
+    const double b = _correlation[bestLag];
+    const double c = _correlation[bestLag + 1];
+    const double curvature = a - 2 * b + c;
+    if (curvature < 0) {
+      lag += 0.5 * (a - c) / curvature;
+    }
+  }
+
+  const double period = lag * _hopSeconds;
+  auto same = [](double a, double b) { return abs(a - b) < SameTempo * b; };
+  if (_period > 0 and same(period, _period)) {
+    _period += 0.3 * (period - _period);
+    _candidate = 0;
+  }
+  else if (_candidate > 0 and same(period, _candidate)) {
+    _period = period;
+    _candidate = 0;
+  }
+  else {
+    _candidate = period;
+  }
+  if (_period == 0) {
+    return;
+  }
+
+  // The beats, where a comb at that tempo catches the most onsets.
+  const double beatHops = _period / _hopSeconds;
+  int phase = 0;
+  double bestScore = -1;
+  for (int p = 0; p < int(beatHops); ++p) {
+    double score = 0;
+    for (double at = n - 1 - p; at >= 0; at -= beatHops) {
+      score += _envelope[lround(at)];
+    }
+    if (score > bestScore) {
+      bestScore = score;
+      phase = p;
+    }
+  }
+  // The flux of an onset grows the most where the window rises the most, a
+  // quarter of it from its end.
+  const double ago = double(phase * Hop + FftSize / 4) * _decimation / _rate;
+  publish(end - c::duration_cast<c::steady_clock::duration>(
+      c::duration<double>(ago)), _period);
+}
+
+void TempoDetector::publish(c::steady_clock::time_point last, double periodSeconds)
+{
+  const int64_t micros =
+      c::duration_cast<c::microseconds>(last - _epoch).count();
+  const uint64_t period = llround(periodSeconds * 1e6);
+  if (micros < 0 or period == 0 or period > PeriodMask) {
+    return;
+  }
+  _beat.store((uint64_t(micros) & LastMask) << 24 | period, memory_order_release);
+
+  const double bpm = 60 / periodSeconds;
+  if (abs(bpm - _loggedBpm) >= 1) {
+    _loggedBpm = bpm;
+    logger.info("Tempo {:.1f} BPM, the analysis takes {:.2f}% of a core",
+        bpm, 100 * load());
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/// \file The tempo of what is being played, heard on the input.
+
+#include "CaptureRing.h"
+#include "Tempo.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace ps
+{
+  namespace c = std::chrono;
+
+  /// Estimates the tempo and the beat of the input from the onsets it hears,
+  /// on its own thread so that the capture never waits for it.
+  ///
+  /// Onsets come from the spectral flux of the input, downsampled to about
+  /// 12kHz. Every half second, the autocorrelation of the last seconds of
+  /// onsets gives the tempo (favouring those around 120 BPM) and a comb at
+  /// that tempo gives where the beats fall.
+  class TempoDetector
+  {
+  public:
+    /// Reads `ring` on its own thread. Without a ring the frames must be
+    /// given to `analyze`, e.g. to benchmark it.
+    TempoDetector(int rate, int bits, const CaptureRing* ring);
+    TempoDetector(const TempoDetector&) = delete;
+    ~TempoDetector();
+
+    /// Any thread, all at once. Where bars start is not known.
+    Beat beat() const;
+
+    /// Interleaved frames of `bits` bits, the last of which was captured at
+    /// `end`. Detection thread only.
+    void analyze(const int32_t* samples, int channels, long frames,
+        c::steady_clock::time_point end);
+
+    /// Share of a core taken by the analysis so far.
+    double load() const;
+
+  private:
+    void run();
+    /// The spectral flux of the window of samples just completed.
+    float flux();
+    /// From the onsets heard so far, the newest sample of which was captured
+    /// at `end`.
+    void estimate(c::steady_clock::time_point end);
+    void publish(c::steady_clock::time_point last, double periodSeconds);
+
+    const int _rate;
+    const float _scale; // int to float of a mono sample
+    const int _decimation;
+    const double _hopSeconds;
+    const CaptureRing* _ring;
+    const c::steady_clock::time_point _epoch;
+    // The last beat in microseconds since _epoch (40 bits, wrapping after 12
+    // days), then the period in microseconds (24 bits). 0 when not found.
+    std::atomic<uint64_t> _beat = 0;
+    std::atomic<bool> _stop = false;
+    // Busy time against the time of audio analyzed.
+    std::atomic<int64_t> _busyMicros = 0;
+    std::atomic<int64_t> _analyzedFrames = 0;
+
+    // --------- members below must be accessed in the thread only ---------- //
+    float _sum = 0; // of the samples being decimated
+    int _summed = 0;
+    std::vector<float> _window; // decimated samples, a window of the FFT
+    int _filled = 0;
+    std::vector<float> _hann;
+    std::vector<float> _re, _im; // FFT in place
+    std::vector<float> _twiddles; // cos then sin, FftSize / 2 each
+    std::vector<float> _magnitudes; // of the previous window, compressed
+    std::vector<float> _weights;    // of the bins in the flux
+    std::vector<float> _onsets; // ring of the flux of the last seconds
+    uint64_t _hops = 0;         // written in _onsets
+    std::vector<float> _envelope; // _onsets in order, for an estimate
+    std::vector<double> _sums;    // prefix sums of _envelope
+    std::vector<double> _correlation; // per lag, in hops
+    double _period = 0;          // seconds, as published
+    double _candidate = 0;       // a new tempo, published when heard twice
+    double _loggedBpm = 0;
+    // ---------------------------------------------------------------------- //
+
+    std::thread _thread;
+  };
+}
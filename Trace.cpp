@@ -0,0 +1,178 @@
+#include "Trace.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace ps;
+using namespace std;
+
+namespace
+{
+  auto logger = Log("TRACE");
+
+  struct Span
+  {
+    const char* Name;
+    int64_t Start;
+    int64_t End;
+  };
+
+  /// 16k spans per thread, about 400kB each. At a span every ms that is
+  /// more than 15 seconds of history.
+  constexpr size_t BufferSize = 1 << 14;
+
+  struct ThreadBuffer
+  {
+    const char* Name = nullptr;
+    int Tid = 0;
+    /// Total number of spans ever written, the slot is Head % BufferSize.
+    std::atomic<uint64_t> Head = 0;
+    /// Its thread exited, the next thread to trace takes it over.
+    bool Free = false; // under the registry mutex
+    std::array<Span, BufferSize> Spans;
+  };
+
+  // Buffers of threads that exited are kept until another thread takes them
+  // over, so that a dump still shows those that just did, e.g. the threads
+  // of a recording. There are never more than threads traced at once.
+  mutex registryMutex;
+  vector<unique_ptr<ThreadBuffer>> registry;
+  int lastTid = 0;
+
+  /// Of the calling thread, gives its buffer back when it exits.
+  struct Owner
+  {
+    ThreadBuffer* Buffer = nullptr;
+    const char* Name = nullptr;
+
+    ~Owner()
+    {
+      if (Buffer != nullptr) {
+        lock_guard lock(registryMutex);
+        Buffer->Free = true;
+      }
+    }
+  };
+
+  thread_local Owner current;
+
+  /// Only allocated once the thread records a span, when tracing.
+  ThreadBuffer& threadBuffer()
+  {
+    if (current.Buffer == nullptr) {
+      lock_guard lock(registryMutex);
+      auto free = find_if(begin(registry), end(registry),
+          [](auto& buffer) { return buffer->Free; });
+      if (free != end(registry)) {
+        // Its thread is gone and dumps are under the mutex, nobody reads it.
+        current.Buffer = free->get();
+        current.Buffer->Free = false;
+        current.Buffer->Head.store(0, memory_order_relaxed);
+      }
+      else {
+        registry.push_back(make_unique<ThreadBuffer>());
+        current.Buffer = registry.back().get();
+      }
+      current.Buffer->Name = current.Name;
+      current.Buffer->Tid = ++lastTid;
+    }
+    return *current.Buffer;
+  }
+
+  void writeEscaped(string& out, const char* str)
+  {
+    for (; *str != '\0'; ++str) {
+      if (*str == '"' or *str == '\\') {
+        out += '\\';
+      }
+      out += *str;
+    }
+  }
+}
+
+std::atomic<bool> trace::Enabled = false;
+
+void trace::record(const char* name, int64_t startNs, int64_t endNs)
+{
+  auto& buffer = threadBuffer();
+  // Only this thread writes Head, readers need the slot to be filled before
+  // they see the new value.
+  auto head = buffer.Head.load(memory_order_relaxed);
+  buffer.Spans[head % BufferSize] = Span{name, startNs, endNs};
+  buffer.Head.store(head + 1, memory_order_release);
+}
+
+void trace::setThreadName(const char* name)
+{
+  current.Name = name;
+  if (current.Buffer != nullptr) {
+    lock_guard lock(registryMutex);
+    current.Buffer->Name = name;
+  }
+}
+
+void trace::dump(const filesystem::path& file)
+{
+  string json = "{\"traceEvents\":[\n";
+  size_t spanCount = 0;
+  bool first = true;
+  auto separator = [&] {
+    if (not first) {
+      json += ",\n";
+    }
+    first = false;
+  };
+
+  lock_guard lock(registryMutex);
+  vector<Span> copy;
+  for (auto& buffer: registry) {
+    if (buffer->Name != nullptr) {
+      separator();
+      json += fmt::format("{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+          "\"tid\":{},\"args\":{{\"name\":\"", buffer->Tid);
+      writeEscaped(json, buffer->Name);
+      json += "\"}}";
+    }
+
+    auto head = buffer->Head.load(memory_order_acquire);
+    auto begin = head > BufferSize ? head - BufferSize : 0;
+    copy.clear();
+    for (auto i = begin; i < head; ++i) {
+      copy.push_back(buffer->Spans[i % BufferSize]);
+    }
+    // The owning thread may have lapped us while copying, drop what it could
+    // have overwritten. It writes the slot of newHead before publishing
+    // newHead + 1, that one may be half written too.
+    auto newHead = buffer->Head.load(memory_order_acquire);
+    size_t skip = 0;
+    if (newHead + 1 > BufferSize and newHead - BufferSize + 1 > begin) {
+      skip = min<size_t>(newHead - BufferSize + 1 - begin, copy.size());
+    }
+
+    for (size_t i = skip; i < copy.size(); ++i) {
+      auto& span = copy[i];
+      separator();
+      json += "{\"ph\":\"X\",\"name\":\"";
+      writeEscaped(json, span.Name);
+      // Chrome expects microseconds, keeping the nanoseconds as decimals.
+      json += fmt::format("\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+          buffer->Tid, span.Start / 1000.0, (span.End - span.Start) / 1000.0);
+      ++spanCount;
+    }
+  }
+  json += "\n]}\n";
+
+  ofstream out(file);
+  out.write(json.data(), json.size());
+  if (not out) {
+    logger.error("Failed to write trace to {}", file);
+    return;
+  }
+  logger.info("Wrote {} spans from {} threads to {}",
+      spanCount, registry.size(), file);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/// \file Lightweight scoped tracing for the hot paths.
+///
+/// Usage:
+///   void Recorder::recordFrames()
+///   {
+///     PS_TRACE_SCOPE("Recorder::recordFrames");
+///     ...
+///   }
+///
+/// Each thread writes complete spans (name, start, duration) into its own
+/// fixed size ring buffer, no lock and no allocation after the first span
+/// of a thread. When tracing is disabled a span costs a relaxed atomic load.
+/// `Trace::dump` writes all the buffers as a Chrome trace JSON file that can
+/// be opened with chrome://tracing or https://ui.perfetto.dev .
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+namespace ps
+{
+  namespace trace
+  {
+    /// Nanoseconds from an arbitrary (steady) origin.
+    inline int64_t now()
+    {
+      namespace c = std::chrono;
+      return c::duration_cast<c::nanoseconds>(
+          c::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// Global switch, spans are dropped when false.
+    extern std::atomic<bool> Enabled;
+
+    /// Record a finished span for the calling thread. `name` must have static
+    /// storage duration (string literals), only the pointer is kept.
+    void record(const char* name, int64_t startNs, int64_t endNs);
+
+    /// Name the calling thread in the trace output, same rule as above for
+    /// the lifetime of `name`.
+    void setThreadName(const char* name);
+
+    /// Write every thread buffer to `file` in the Chrome trace event format.
+    /// Safe to call while other threads keep tracing, spans overwritten
+    /// during the dump are skipped.
+    void dump(const std::filesystem::path& file);
+
+    class Scope
+    {
+    public:
+      explicit Scope(const char* name)
+        : _name(name)
+        , _start(Enabled.load(std::memory_order_relaxed) ? now() : -1)
+      { }
+
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+      ~Scope()
+      {
+        if (_start >= 0) {
+          record(_name, _start, now());
+        }
+      }
+
+    private:
+      const char* _name;
+      int64_t _start;
+    };
+  }
+
+  #define PS_TRACE_CONCAT_(a, b) a ## b
+  #define PS_TRACE_CONCAT(a, b) PS_TRACE_CONCAT_(a, b)
+  #define PS_TRACE_SCOPE(name) \
+    ::ps::trace::Scope PS_TRACE_CONCAT(psTraceScope, __LINE__)(name)
+}
@@ -16,10 +16,13 @@
 #include "Arguments.h"
 #include "Atom.h"
 #include "Device.h"
+#include "MidiClock.h"
 #include "Pads.h"
 #include "PiSample.h"
 #include "Player.h"
 #include "Recorder.h"
+#include "Strings.h"
+#include "Trace.h"
 
 using namespace ps; // PiSample
 using namespace atom;
@@ -40,6 +43,12 @@ void signalHandler(int)
   goOn = false;
 }
 
+atomic<bool> dumpTrace = false;
+void traceSignalHandler(int)
+{
+  dumpTrace = true;
+}
+
 void setupSignals()
 {
   struct sigaction action;
@@ -52,6 +61,10 @@ void setupSignals()
   sigaction(SIGKILL, &action, nullptr);
   sigaction(SIGHUP, &action, nullptr);
   sigaction(SIGABRT, &action, nullptr);
+
+  // `kill -USR1 $(pidof pisample)` to get a trace without stopping.
+  action.sa_handler = &traceSignalHandler;
+  sigaction(SIGUSR1, &action, nullptr);
 }
 
 
@@ -70,14 +83,6 @@ void printHelp(const unordered_map<string, Argument>& args)
   exit(EXIT_FAILURE);
 }
 
-// probably not the most efficient way, too lazy to deal with indices.
-string trimSpaces(const string& s)
-{
-  string_view v = s;
-  while (not v.empty() and v.front() == ' ') v = v.substr(1);
-  while (not v.empty() and v.back()  == ' ') v = v.substr(0, v.size() - 1);
-  return (string)v;
-}
 
 void readArguments(
     unordered_map<string, Argument>& args,
@@ -112,7 +117,7 @@ void readArguments(
     }
     arg.Given = true;
 
-    presentOnCommandLine.insert(argv[i]);
+    presentOnCommandLine.insert(argName);
 
     if (i+1 < argc) {
       bool nextIsArg = string(argv[i+1]).substr(0, 2) == "--";
@@ -146,46 +151,31 @@ void readArguments(
 
   auto configFileName = * args.find("config")->second.Value;
   if (not configFileName.empty()) {
-    ifstream config(configFileName);
-    if (!config) {
-      throw Exception("Could not open config file: {}", configFileName);
-    }
+    MappedFile config(configFileName);
 
-    string line;
-    int lineNo = 0;
-    while (getline(config, line)) {
-      ++lineNo;
+    string key; // args are keyed by std::string
+    forEachLine(config.text(), [&](string_view rawLine, int lineNo) {
+      auto line = trim(rawLine);
       if (line.empty() or line[0] == '#') {
-        continue;
+        return;
       }
       auto equalPos = line.find('=');
-      if (equalPos == string::npos) {
-        auto it = args.find(line);
-        if (it == end(args)) {
-          throw Exception("At line {}, unknown argument: {}", lineNo, line);
-        }
-        if (not it->second.Flag) {
-          throw Exception("At line {}, '{}' requires a value", lineNo, line);
-        }
-        if (presentOnCommandLine.count(line) > 0) {
-          continue;
-        }
-        it->second.Value = "true";
+      key = trim(line.substr(0, equalPos));
+      auto it = args.find(key);
+      if (it == end(args)) {
+        throw Exception("{}:{}:{}: unknown argument: {}", configFileName,
+            lineNo, columnOf(rawLine, line), key);
       }
-
-      else {
-        auto key = trimSpaces(line.substr(0, equalPos));
-        auto it = args.find(key);
-        if (it == end(args)) {
-          throw Exception("At line {}, unknown argument: {}", lineNo, line);
-        }
-        if (presentOnCommandLine.count(key) > 0) {
-          continue;
-        }
-
-        it->second.Value = trimSpaces(line.substr(equalPos + 1));
+      if (equalPos == string_view::npos and not it->second.Flag) {
+        throw Exception("{}:{}:{}: '{}' requires a value", configFileName,
+            lineNo, columnOf(rawLine, line.substr(line.size())), key);
       }
-    }
+      if (presentOnCommandLine.count(key) > 0) {
+        return; // the command line wins
+      }
+      it->second.Value = equalPos == string_view::npos ?
+          "true" : string(trim(line.substr(equalPos + 1)));
+    });
   }
 
   for (auto& [name, arg]: args) {
@@ -213,12 +203,18 @@ try {
       .Doc = "Start recording on startup. Meant for testing mainly.",
       .Value = "false",
       .Flag = true,
+    } },
+    { "trace-file"s, {
+      .Doc = "Enable tracing of the hot paths. The trace is written to this "
+             "file (Chrome trace format) on exit and on SIGUSR1.",
+      .Value = "",
     } }
   };
 
   merge(args, PiSample::args());
   merge(args, Recorder::args());
   merge(args, Player::args());
+  merge(args, MidiClock::args());
 
   readArguments(args, argc, argv);
 
@@ -226,11 +222,22 @@ try {
   bool recordOnStart;
   stringstream(args["record"].Value->c_str()) >> boolalpha >> recordOnStart;
 
+  auto traceFile = *args["trace-file"].Value;
+  if (not traceFile.empty()) {
+    trace::Enabled = true;
+    trace::setThreadName("main");
+  }
+
   Device device(devicePortName);
   Pads pads(device);
   Player player(args, pads);
-  Recorder recorder(device, pads, args);
-  PiSample piSample(args, device, pads, recorder, player);
+  if (*args["compile-banks"].Value == "true") {
+    PiSample::compileBanks(args, player);
+    return EXIT_SUCCESS;
+  }
+  MidiClock clock(args);
+  Recorder recorder(device, pads, player, args);
+  PiSample piSample(args, device, pads, recorder, player, clock);
 
   device.setSynth(piSample);
 
@@ -245,6 +252,13 @@ try {
       piSample.poll();
       this_thread::sleep_for(c::microseconds(500));
     }
+    if (dumpTrace.exchange(false) and trace::Enabled) {
+      trace::dump(traceFile);
+    }
+  }
+
+  if (trace::Enabled) {
+    trace::dump(traceFile);
   }
 
   cout.flush();